@@ -0,0 +1,203 @@
+// Scaling benchmark for the thread-safe trees.
+//
+// Reads: reader threads search random keys for a fixed time while one
+// writer keeps inserting and removing keys the readers do not look for,
+// against ConcurrentRedBlackTree. Writes: every thread inserts and removes
+// random keys, against ShardedRedBlackTree. Both are repeated against a
+// RedBlackTree behind one mutex, which every search and update takes, for
+// each thread count.
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "concurrent_red_black_tree.hpp"
+#include "red_black_tree.hpp"
+#include "sharded_tree.hpp"
+#include "workload.hpp"
+
+// RedBlackTree with the same interface, every call under one mutex
+class LockedRedBlackTree {
+    private:
+        RedBlackTree tree;
+        std::mutex lock;
+
+    public:
+        int search(int key) {
+            std::lock_guard<std::mutex> guard(lock);
+            return tree.search(key);
+        }
+
+        void insert(int key, int data) {
+            std::lock_guard<std::mutex> guard(lock);
+            tree.insert(key, data);
+        }
+
+        void remove(int key) {
+            std::lock_guard<std::mutex> guard(lock);
+            tree.remove(key);
+        }
+};
+
+// Even keys are loaded and only searched, the writer churns odd ones
+template<class Tree>
+static void run_readers(const char *name, size_t size, unsigned readers, double seconds, uint64_t seed) {
+    Tree tree;
+    for(size_t i = 0; i < size; i++) {
+        tree.insert((int)(2 * i), (int)i);
+    }
+
+    std::atomic<bool> stop(false);
+    std::atomic<unsigned long long> reads(0);
+    std::atomic<unsigned long long> wrong(0);
+
+    std::vector<std::thread> threads;
+    for(unsigned r = 0; r < readers; r++) {
+        threads.emplace_back([&, r]() {
+            std::mt19937_64 rng(seed + r);
+            unsigned long long done = 0, mismatches = 0;
+            while(!stop.load(std::memory_order_relaxed)) {
+                size_t i = rng() % size;
+                mismatches += tree.search((int)(2 * i)) != (int)i;
+                done++;
+            }
+            reads += done;
+            wrong += mismatches;
+        });
+    }
+
+    unsigned long long writes = 0;
+    std::mt19937_64 rng(seed);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::chrono::duration<double> limit(seconds);
+    while(std::chrono::steady_clock::now() - start < limit) {
+        int key = (int)(2 * (rng() % size) + 1);
+        tree.insert(key, key);
+        tree.remove(key);
+        writes += 2;
+    }
+
+    stop = true;
+    for(std::thread &thread : threads) {
+        thread.join();
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    printf("%-10s %10zu %8u %14.0f %14.0f  %s\n", name, size, readers, reads / elapsed, writes / elapsed,
+           wrong == 0 ? "ok" : "wrong results");
+    fflush(stdout);
+}
+
+// Every thread inserts a random odd key and removes it again, so the tree
+// keeps its size
+template<class Tree>
+static void run_writers(const char *name, size_t size, unsigned writers, double seconds, uint64_t seed) {
+    Tree tree;
+    for(size_t i = 0; i < size; i++) {
+        tree.insert((int)(2 * i), (int)i);
+    }
+
+    std::atomic<bool> stop(false);
+    std::atomic<unsigned long long> writes(0);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for(unsigned w = 0; w < writers; w++) {
+        threads.emplace_back([&, w]() {
+            std::mt19937_64 rng(seed + w);
+            unsigned long long done = 0;
+            while(!stop.load(std::memory_order_relaxed)) {
+                int key = (int)(2 * (rng() % size) + 1);
+                tree.insert(key, key);
+                tree.remove(key);
+                done += 2;
+            }
+            writes += done;
+        });
+    }
+
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+    stop = true;
+    for(std::thread &thread : threads) {
+        thread.join();
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    printf("%-10s %10zu %8u %14s %14.0f  %s\n", name, size, writers, "-", writes / elapsed,
+           tree.search(1) == -1 ? "ok" : "wrong results");
+    fflush(stdout);
+}
+
+static void usage(const char *prog) {
+    std::cerr
+        << "usage: " << prog << " [options]\n"
+        << "  --size N         keys loaded before the run, K/M/G suffixes allowed (default: 1M)\n"
+        << "  --threads LIST   reader or writer thread counts (default: 1,2,4,8)\n"
+        << "  --seconds S      length of each run (default: 2)\n"
+        << "  --seed N         random seed (default: 42)\n";
+}
+
+int main(int argc, char **argv) {
+    size_t size = 1000000;
+    std::vector<unsigned> thread_counts = {1, 2, 4, 8};
+    double seconds = 2;
+    uint64_t seed = 42;
+
+    for(int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if(arg == "-h" || arg == "--help") {
+            usage(argv[0]);
+            return 0;
+        }
+        if(i + 1 >= argc) {
+            usage(argv[0]);
+            return 2;
+        }
+
+        std::string value = argv[++i];
+        bool ok = true;
+        if(arg == "--size") {
+            ok = parse_count(value, size) && size > 0 && size <= INT32_MAX / 2;
+        } else if(arg == "--threads") {
+            thread_counts.clear();
+            for(const std::string &text : split_list(value)) {
+                size_t count = 0;
+                ok = ok && parse_count(text, count) && count > 0 && count <= EpochDomain::READER_SLOTS;
+                thread_counts.push_back((unsigned)count);
+            }
+        } else if(arg == "--seconds") {
+            seconds = strtod(value.c_str(), nullptr);
+            ok = seconds > 0;
+        } else if(arg == "--seed") {
+            seed = strtoull(value.c_str(), nullptr, 10);
+        } else {
+            ok = false;
+        }
+
+        if(!ok) {
+            std::cerr << "invalid argument: " << arg << " " << value << "\n";
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    printf("%-10s %10s %8s %14s %14s  %s\n", "tree", "size", "threads", "reads/s", "writes/s", "status");
+
+    for(unsigned readers : thread_counts) {
+        run_readers<ConcurrentRedBlackTree>("optimistic", size, readers, seconds, seed);
+        run_readers<LockedRedBlackTree>("mutex", size, readers, seconds, seed);
+    }
+
+    for(unsigned writers : thread_counts) {
+        run_writers<ShardedRedBlackTree>("sharded", size, writers, seconds, seed);
+        run_writers<LockedRedBlackTree>("mutex", size, writers, seconds, seed);
+    }
+
+    return 0;
+}
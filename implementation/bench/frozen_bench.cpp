@@ -0,0 +1,164 @@
+// Lookup microbenchmark for FrozenIndex.
+//
+// Times the same random probes against every search kernel the CPU
+// supports, the plain binary search over the sorted keys that the kernels
+// replace, and the red-black tree the index was frozen from. Half of the
+// probes are keys in the index. Every variant has to return the same
+// checksum, which also keeps the lookups from being optimized away. With
+// --image, each index is also saved to a file and reopened with mmap, and
+// the time to open it and the lookups on the mapping are reported.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "frozen_index.hpp"
+#include "red_black_tree.hpp"
+#include "workload.hpp"
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+template<class Lookup>
+static void time_lookups(const char *name, size_t size, const std::vector<int> &probes, Lookup lookup, long long expected) {
+    long long checksum = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for(int probe : probes) {
+        checksum += lookup(probe);
+    }
+    double seconds = seconds_since(start);
+
+    printf("%-10s %10zu %10zu %10.1f  %s\n", name, size, probes.size(), seconds * 1e9 / probes.size(),
+           (checksum == expected) ? "ok" : "checksum mismatch");
+    fflush(stdout);
+}
+
+static void usage(const char *prog) {
+    std::cerr
+        << "usage: " << prog << " [options]\n"
+        << "  --sizes LIST   keys in the index, K/M/G suffixes allowed (default: 1K,64K,1M,10M)\n"
+        << "  --lookups N    probes per variant (default: 2M)\n"
+        << "  --seed N       random seed (default: 42)\n"
+        << "  --image FILE   also save each index to FILE and time lookups on the mapped copy\n";
+}
+
+int main(int argc, char **argv) {
+    std::vector<size_t> sizes = {1000, 64000, 1000000, 10000000};
+    size_t lookups = 2000000;
+    uint64_t seed = 42;
+    std::string image_path;
+
+    for(int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if(arg == "-h" || arg == "--help") {
+            usage(argv[0]);
+            return 0;
+        }
+        if(i + 1 >= argc) {
+            usage(argv[0]);
+            return 2;
+        }
+
+        std::string value = argv[++i];
+        bool ok = true;
+        if(arg == "--sizes") {
+            sizes.clear();
+            for(const std::string &text : split_list(value)) {
+                size_t size = 0;
+                ok = ok && parse_count(text, size) && size > 0 && size <= INT32_MAX / 2;
+                sizes.push_back(size);
+            }
+        } else if(arg == "--lookups") {
+            ok = parse_count(value, lookups) && lookups > 0;
+        } else if(arg == "--seed") {
+            seed = strtoull(value.c_str(), nullptr, 10);
+        } else if(arg == "--image") {
+            image_path = value;
+        } else {
+            ok = false;
+        }
+
+        if(!ok) {
+            std::cerr << "invalid argument: " << arg << " " << value << "\n";
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    printf("%-10s %10s %10s %10s  %s\n", "variant", "size", "lookups", "ns/lookup", "status");
+
+    for(size_t size : sizes) {
+        // Even keys are present, odd probes miss
+        std::mt19937_64 rng(seed);
+        std::vector<std::pair<int, int>> entries;
+        entries.reserve(size);
+        for(size_t i = 0; i < size; i++) {
+            entries.push_back({(int)(2 * i), (int)i});
+        }
+        std::shuffle(entries.begin(), entries.end(), rng);
+
+        RedBlackTree tree;
+        for(const std::pair<int, int> &entry : entries) {
+            tree.insert(entry.first, entry.second);
+        }
+
+        FrozenIndex index = tree.freeze();
+
+        std::vector<int> sorted_keys(size);
+        for(size_t i = 0; i < size; i++) {
+            sorted_keys[i] = (int)(2 * i);
+        }
+
+        std::vector<int> probes(lookups);
+        for(int &probe : probes) {
+            probe = (int)(rng() % (2 * size));
+        }
+
+        long long expected = 0;
+        for(int probe : probes) {
+            expected += (probe % 2 == 0) ? probe / 2 : -1;
+        }
+
+        time_lookups("rb", size, probes, [&tree](int key) { return tree.search(key); }, expected);
+
+        time_lookups("binary", size, probes, [&sorted_keys](int key) {
+            std::vector<int>::const_iterator it = std::lower_bound(sorted_keys.begin(), sorted_keys.end(), key);
+            return (it != sorted_keys.end() && *it == key) ? (int)(it - sorted_keys.begin()) : -1;
+        }, expected);
+
+        for(SearchKernel kernel : {SearchKernel::scalar, SearchKernel::sse42, SearchKernel::avx2}) {
+            if(!index.set_kernel(kernel)) {
+                printf("%-10s %10zu %10s %10s  %s\n", search_kernel_name(kernel), size, "-", "-", "not supported");
+                continue;
+            }
+            time_lookups(search_kernel_name(kernel), size, probes, [&index](int key) { return index.search(key); }, expected);
+        }
+
+        if(!image_path.empty()) {
+            FrozenIndex mapped;
+            if(!index.save(image_path)) {
+                printf("%-10s %10zu %10s %10s  %s\n", "mapped", size, "-", "-", "cannot write the image");
+                continue;
+            }
+
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            bool opened = mapped.open(image_path);
+            double open_seconds = seconds_since(start);
+            if(!opened) {
+                printf("%-10s %10zu %10s %10s  %s\n", "mapped", size, "-", "-", "cannot open the image");
+                continue;
+            }
+
+            printf("%-10s %10zu %10s %10.1f  us to open\n", "open", size, "-", open_seconds * 1e6);
+            time_lookups("mapped", size, probes, [&mapped](int key) { return mapped.search(key); }, expected);
+        }
+    }
+
+    return 0;
+}
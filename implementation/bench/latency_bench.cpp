@@ -0,0 +1,356 @@
+// Tail-latency benchmark for the tree implementations.
+//
+// Loads a tree, then times every operation of a mixed workload one at a
+// time (search, insert, remove, get_predecessor, get_successor) and records
+// it in a log-linear histogram per operation type. Reports the mean, p50,
+// p99, p99.9 and max for each (tree, key order, mix, operation), which
+// shows the rare slow operations an ns/op average hides: a remove with a
+// long fixup cascade, an insert that takes the allocator's slow path.
+//
+// Operations are timed with the TSC (rdtsc/rdtscp between fences) on x86,
+// calibrated against the steady clock, or with clock_gettime(CLOCK_MONOTONIC).
+// --cpu pins the process to one core, so migrations and frequency
+// differences between cores do not show up as latency.
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <sched.h>
+
+#include "latency_histogram.hpp"
+#include "workload.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define LATENCY_BENCH_TSC 1
+#endif
+
+static const OpType OP_TYPES[] = {OpType::search, OpType::insert, OpType::remove, OpType::predecessor, OpType::successor};
+static const size_t OP_TYPE_COUNT = sizeof(OP_TYPES) / sizeof(OP_TYPES[0]);
+
+static const char* op_name(OpType type) {
+    switch(type) {
+        case OpType::insert:      return "insert";
+        case OpType::search:      return "search";
+        case OpType::remove:      return "remove";
+        case OpType::predecessor: return "predecessor";
+        case OpType::successor:   return "successor";
+    }
+    return "?";
+}
+
+// Timestamps in nanoseconds
+struct MonotonicClock {
+    static uint64_t begin() {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+    }
+
+    static uint64_t end() {
+        return begin();
+    }
+};
+
+#ifdef LATENCY_BENCH_TSC
+// Timestamps in TSC ticks. The fences keep the timed operation from
+// starting before begin() or finishing after end()
+struct TscClock {
+    static uint64_t begin() {
+        _mm_lfence();
+        uint64_t ticks = __rdtsc();
+        _mm_lfence();
+        return ticks;
+    }
+
+    static uint64_t end() {
+        unsigned core;
+        uint64_t ticks = __rdtscp(&core);
+        _mm_lfence();
+        return ticks;
+    }
+};
+
+// TSC ticks per nanosecond, measured against the steady clock over 100 ms
+static double tsc_ticks_per_ns() {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    uint64_t first = TscClock::begin();
+    while(std::chrono::steady_clock::now() - start < std::chrono::milliseconds(100)) {}
+    uint64_t last = TscClock::end();
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    return (last - first) / ns;
+}
+#endif
+
+// Smallest time between begin() and end() with nothing in between, in ticks
+template<class Clock>
+static uint64_t clock_overhead() {
+    uint64_t best = UINT64_MAX;
+    for(int i = 0; i < 10000; i++) {
+        uint64_t start = Clock::begin();
+        uint64_t stop = Clock::end();
+        best = std::min(best, stop - start);
+    }
+    return best;
+}
+
+struct LatencyResult {
+    LatencyHistogram histograms[OP_TYPE_COUNT]; // indexed by OpType
+    long long checksum;
+};
+
+// The load phase is not timed, every operation after it is
+template<class Tree, class Clock>
+static void run_timed(const Workload &w, LatencyResult &result) {
+    std::mt19937_64 rng(w.seed);
+    std::vector<int> keys = make_load_keys(w, rng);
+    std::vector<Operation> ops = make_operations(w, keys, rng);
+
+    Tree *tree = new Tree();
+    for(int key : keys) {
+        TreeOps<Tree>::insert(*tree, key);
+    }
+
+    long long checksum = 0;
+    for(const Operation &op : ops) {
+        uint64_t start = Clock::begin();
+        switch(op.type) {
+            case OpType::insert:      TreeOps<Tree>::insert(*tree, op.key);                 break;
+            case OpType::search:      checksum += TreeOps<Tree>::search(*tree, op.key);      break;
+            case OpType::remove:      TreeOps<Tree>::remove(*tree, op.key);                 break;
+            case OpType::predecessor: checksum += TreeOps<Tree>::predecessor(*tree, op.key); break;
+            case OpType::successor:   checksum += TreeOps<Tree>::successor(*tree, op.key);   break;
+        }
+        uint64_t stop = Clock::end();
+        result.histograms[(size_t)op.type].record(stop - start);
+    }
+    result.checksum = checksum;
+
+    delete tree;
+}
+
+template<class Tree>
+static void run_latency(const Workload &w, bool use_tsc, LatencyResult &result) {
+#ifdef LATENCY_BENCH_TSC
+    if(use_tsc) {
+        run_timed<Tree, TscClock>(w, result);
+        return;
+    }
+#endif
+    run_timed<Tree, MonotonicClock>(w, result);
+}
+
+struct TreeEntry {
+    const char *name;
+    void (*run)(const Workload &w, bool use_tsc, LatencyResult &result);
+    bool balanced;
+};
+
+static std::vector<TreeEntry> tree_table() {
+    std::vector<TreeEntry> table;
+    for_each_tree([&](const char *name, bool balanced, auto tag) {
+        table.push_back({name, run_latency<typename decltype(tag)::type>, balanced});
+    });
+    return table;
+}
+
+static const std::vector<TreeEntry> TREES = tree_table();
+
+static bool pin_to_cpu(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+static void usage(const char *prog) {
+    std::cerr
+        << "usage: " << prog << " [options]\n"
+        << "  --trees LIST         trees to run (default: all):\n"
+        << tree_list(TREES)
+        << "  --orders LIST        key orders: uniform,sorted,reverse,zipf (default: uniform,zipf)\n"
+        << "  --mixes LIST         insert:search:remove or insert:search:remove:predecessor:successor\n"
+        << "                       percentages (default: 20:50:10:10:10)\n"
+        << "  --sizes LIST         keys loaded per run, K/M/G suffixes allowed (default: 1M)\n"
+        << "  --ops N              timed operations after the load phase (default: same as size)\n"
+        << "  --clock SOURCE       tsc or monotonic (default: tsc where available)\n"
+        << "  --cpu N              pin the benchmark to core N\n"
+        << "  --zipf-theta T       zipf skew in (0, 1) (default: 0.99)\n"
+        << "  --seed N             random seed (default: 42)\n"
+        << "  --degenerate-limit N largest size run on unbalanced trees with sorted/reverse keys (default: 100K)\n"
+        << "  --csv FILE           write results as csv\n";
+}
+
+int main(int argc, char **argv) {
+    std::vector<std::string> tree_names;
+    std::vector<KeyOrder> orders = {KeyOrder::uniform, KeyOrder::zipf};
+    std::vector<OperationMix> mixes = {{20, 50, 10, 10, 10}};
+    std::vector<size_t> sizes = {1000000};
+    size_t ops = 0;
+#ifdef LATENCY_BENCH_TSC
+    bool use_tsc = true;
+#else
+    bool use_tsc = false;
+#endif
+    int cpu = -1;
+    double zipf_theta = 0.99;
+    uint64_t seed = 42;
+    size_t degenerate_limit = 100000;
+    std::string csv_path;
+
+    for(int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if(arg == "-h" || arg == "--help") {
+            usage(argv[0]);
+            return 0;
+        }
+        if(i + 1 >= argc) {
+            usage(argv[0]);
+            return 2;
+        }
+
+        std::string value = argv[++i];
+        bool ok = true;
+        if(arg == "--trees") {
+            tree_names = split_list(value);
+        } else if(arg == "--orders") {
+            ok = parse_key_orders(value, orders);
+        } else if(arg == "--mixes") {
+            ok = parse_mixes(value, mixes);
+        } else if(arg == "--sizes") {
+            ok = parse_sizes(value, sizes);
+        } else if(arg == "--ops") {
+            ok = parse_count(value, ops);
+        } else if(arg == "--clock") {
+#ifdef LATENCY_BENCH_TSC
+            ok = value == "tsc" || value == "monotonic";
+#else
+            ok = value == "monotonic";
+#endif
+            use_tsc = value == "tsc";
+        } else if(arg == "--cpu") {
+            char *end = nullptr;
+            cpu = (int)strtol(value.c_str(), &end, 10);
+            ok = *end == '\0' && cpu >= 0 && cpu < CPU_SETSIZE;
+        } else if(arg == "--zipf-theta") {
+            zipf_theta = atof(value.c_str());
+            ok = zipf_theta > 0.0 && zipf_theta < 1.0;
+        } else if(arg == "--seed") {
+            seed = strtoull(value.c_str(), nullptr, 10);
+        } else if(arg == "--degenerate-limit") {
+            ok = parse_count(value, degenerate_limit);
+        } else if(arg == "--csv") {
+            csv_path = value;
+        } else {
+            ok = false;
+        }
+
+        if(!ok) {
+            std::cerr << "invalid argument: " << arg << " " << value << "\n";
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    std::vector<const TreeEntry*> trees;
+    if(!select_trees(tree_names, TREES, trees)) {
+        return 2;
+    }
+
+    if(cpu >= 0 && !pin_to_cpu(cpu)) {
+        std::cerr << "cannot pin to cpu " << cpu << ": " << strerror(errno) << "\n";
+        return 1;
+    }
+
+    // Histograms hold clock ticks, reported in nanoseconds
+    double ticks_per_ns = 1.0;
+    uint64_t overhead = 0;
+#ifdef LATENCY_BENCH_TSC
+    if(use_tsc) {
+        ticks_per_ns = tsc_ticks_per_ns();
+        overhead = clock_overhead<TscClock>();
+    } else {
+        overhead = clock_overhead<MonotonicClock>();
+    }
+#else
+    overhead = clock_overhead<MonotonicClock>();
+#endif
+    printf("# clock %s", use_tsc ? "tsc" : "monotonic");
+    if(use_tsc) {
+        printf(" at %.3f GHz", ticks_per_ns);
+    }
+    printf(", timing overhead %.1f ns (included below)", overhead / ticks_per_ns);
+    if(cpu >= 0) {
+        printf(", pinned to cpu %d", cpu);
+    }
+    printf("\n");
+
+    std::ofstream csv;
+    if(!csv_path.empty()) {
+        csv.open(csv_path);
+        if(!csv) {
+            std::cerr << "cannot write " << csv_path << "\n";
+            return 1;
+        }
+        csv << "tree,order,mix,size,op,count,mean_ns,p50_ns,p99_ns,p999_ns,max_ns\n";
+    }
+
+    printf("%-11s %-8s %-16s %10s %-12s %10s %9s %9s %9s %9s %11s\n",
+           "tree", "order", "mix", "size", "op", "count", "mean", "p50", "p99", "p99.9", "max (ns)");
+
+    for(size_t size : sizes) {
+        for(KeyOrder order : orders) {
+            for(const OperationMix &mix : mixes) {
+                Workload w = {order, mix, size, (ops > 0) ? ops : size, zipf_theta, seed, false, 0};
+
+                for(const TreeEntry *entry : trees) {
+                    bool degenerate = !entry->balanced && size > degenerate_limit
+                                      && (order == KeyOrder::sorted || order == KeyOrder::reverse);
+                    if(degenerate) {
+                        printf("%-11s %-8s %-16s %10zu  skipped (degenerate)\n",
+                               entry->name, key_order_name(order), mix_name(mix).c_str(), size);
+                        continue;
+                    }
+
+                    LatencyResult *result = new LatencyResult();
+                    entry->run(w, use_tsc, *result);
+
+                    for(OpType type : OP_TYPES) {
+                        const LatencyHistogram &histogram = result->histograms[(size_t)type];
+                        if(histogram.count() == 0) {
+                            continue;
+                        }
+
+                        double mean = histogram.mean() / ticks_per_ns;
+                        double p50 = histogram.percentile(0.50) / ticks_per_ns;
+                        double p99 = histogram.percentile(0.99) / ticks_per_ns;
+                        double p999 = histogram.percentile(0.999) / ticks_per_ns;
+                        double max = histogram.max() / ticks_per_ns;
+
+                        printf("%-11s %-8s %-16s %10zu %-12s %10llu %9.0f %9.0f %9.0f %9.0f %11.0f\n",
+                               entry->name, key_order_name(order), mix_name(mix).c_str(), size, op_name(type),
+                               (unsigned long long)histogram.count(), mean, p50, p99, p999, max);
+                        if(csv) {
+                            csv << entry->name << "," << key_order_name(order) << "," << mix_name(mix) << "," << size << ","
+                                << op_name(type) << "," << histogram.count() << "," << mean << "," << p50 << ","
+                                << p99 << "," << p999 << "," << max << "\n";
+                        }
+                    }
+                    fflush(stdout);
+                    delete result;
+                }
+            }
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Log-linear histogram in the style of HdrHistogram. Values below 256 get
+// a bucket each, and every power of two above that is cut into 128
+// buckets, so any recorded value is known to within 1/128 of itself from
+// one tick up to 2^64. Recording is an index computation and an increment,
+// cheap enough to run after every timed operation.
+class LatencyHistogram {
+    private:
+        static constexpr int SUB_BUCKET_BITS = 8;
+        static constexpr uint64_t SUB_BUCKETS = 1ULL << SUB_BUCKET_BITS;
+        static constexpr uint64_t HALF_BUCKETS = SUB_BUCKETS / 2;
+        static constexpr size_t BUCKETS = (66 - SUB_BUCKET_BITS) * HALF_BUCKETS;
+
+        std::vector<uint64_t> counts;
+        uint64_t total;
+        uint64_t sum;
+        uint64_t min_value;
+        uint64_t max_value;
+
+        // A value with its top bit at position b >= SUB_BUCKET_BITS keeps its
+        // top SUB_BUCKET_BITS bits, which lie in [HALF_BUCKETS, SUB_BUCKETS)
+        static size_t index_of(uint64_t value) {
+            if(value < SUB_BUCKETS) {
+                return (size_t)value;
+            }
+            int shift = (63 - __builtin_clzll(value)) - (SUB_BUCKET_BITS - 1);
+            return (size_t)shift * HALF_BUCKETS + (size_t)(value >> shift);
+        }
+
+        // Largest value that falls into bucket index
+        static uint64_t highest_in(size_t index) {
+            if(index < SUB_BUCKETS) {
+                return index;
+            }
+            int shift = (int)(index / HALF_BUCKETS) - 1;
+            uint64_t sub = index - (size_t)shift * HALF_BUCKETS;
+            return ((sub + 1) << shift) - 1;
+        }
+
+    public:
+        LatencyHistogram() : counts(BUCKETS, 0), total(0), sum(0), min_value(UINT64_MAX), max_value(0) {}
+
+        void record(uint64_t value) {
+            counts[index_of(value)]++;
+            total++;
+            sum += value;
+            min_value = std::min(min_value, value);
+            max_value = std::max(max_value, value);
+        }
+
+        uint64_t count() const { return total; }
+        uint64_t min() const   { return (total > 0) ? min_value : 0; }
+        uint64_t max() const   { return max_value; }
+
+        double mean() const {
+            return (total > 0) ? (double)sum / total : 0.0;
+        }
+
+        // Smallest recorded value that at least fraction (0 to 1) of the
+        // values do not exceed, reported as the top of its bucket
+        uint64_t percentile(double fraction) const {
+            if(total == 0) {
+                return 0;
+            }
+
+            uint64_t wanted = std::max<uint64_t>(1, (uint64_t)std::ceil(fraction * total));
+            uint64_t seen = 0;
+            for(size_t i = 0; i < BUCKETS; i++) {
+                seen += counts[i];
+                if(seen >= wanted) {
+                    return std::min(highest_in(i), max_value);
+                }
+            }
+            return max_value;
+        }
+};
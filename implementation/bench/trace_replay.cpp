@@ -0,0 +1,589 @@
+// Replays a captured trace of tree operations against one of the trees.
+//
+// A trace is text, one operation per line:
+//   insert KEY [VALUE]    VALUE defaults to KEY
+//   search KEY
+//   remove KEY
+//   pred KEY
+//   succ KEY
+//   range LO HI
+// with blank lines and lines starting with '#' ignored, or binary: a
+// 16-byte header (TRACE_MAGIC, version, byte order) followed by 12-byte
+// records, written in the byte order of the machine that captured them.
+// --convert turns a text trace into a binary one.
+//
+// The trace is memory-mapped and read front to back once per pass. Pages
+// already replayed are dropped from the mapping as the pass moves on, so a
+// trace larger than RAM streams through a small window. The timed pass
+// runs the tree alone. --verify adds a second, untimed pass that replays
+// the trace into a fresh tree and a std::multimap side by side and checks
+// every result against the multimap.
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "avl_tree.hpp"
+#include "binary_search_tree.hpp"
+#include "red_black_tree.hpp"
+
+enum class TraceOp : uint8_t {
+    insert, search, remove, predecessor, successor, range
+};
+
+static const char* const TRACE_OP_NAMES[] = {"insert", "search", "remove", "pred", "succ", "range"};
+static const size_t TRACE_OP_COUNT = sizeof(TRACE_OP_NAMES) / sizeof(TRACE_OP_NAMES[0]);
+
+// One operation. a is the key (lo for range), b the value (hi for range)
+struct TraceRecord {
+    uint8_t op;
+    uint8_t padding[3];
+    int32_t a;
+    int32_t b;
+};
+
+static_assert(sizeof(TraceRecord) == 12, "binary traces use 12-byte records");
+
+static const char TRACE_MAGIC[8] = {'T', 'R', 'E', 'E', 'T', 'R', 'C', '1'};
+static const uint32_t TRACE_VERSION = 1;
+static const uint32_t TRACE_BYTE_ORDER = 0x01020304;
+
+struct TraceHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+};
+
+static_assert(sizeof(TraceHeader) == 16, "binary traces start with a 16-byte header");
+
+// Read-only mapping of a trace file, read sequentially by TraceReader
+class MappedTrace {
+    private:
+        const char *data;
+        size_t bytes;
+
+    public:
+        MappedTrace() : data(nullptr), bytes(0) {}
+
+        ~MappedTrace() {
+            if(data != nullptr) {
+                munmap((void*)data, bytes);
+            }
+        }
+
+        MappedTrace(const MappedTrace &) = delete;
+        MappedTrace& operator=(const MappedTrace &) = delete;
+
+        bool open(const std::string &path) {
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if(fd < 0) {
+                return false;
+            }
+
+            struct stat info;
+            bool ok = fstat(fd, &info) == 0;
+            bytes = ok ? (size_t)info.st_size : 0;
+            if(ok && bytes > 0) {
+                void *mapping = mmap(nullptr, bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+                ok = mapping != MAP_FAILED;
+                data = ok ? static_cast<const char*>(mapping) : nullptr;
+            }
+            close(fd);
+            return ok;
+        }
+
+        const char* begin() const { return data; }
+        const char* end() const   { return data + bytes; }
+
+        bool binary() const {
+            return bytes >= sizeof(TraceHeader) && memcmp(data, TRACE_MAGIC, sizeof(TRACE_MAGIC)) == 0;
+        }
+
+        // Drops the pages before position that a pass has finished with.
+        // They are read back from the file if a later pass needs them
+        void release_before(const char *position) const {
+            size_t page = (size_t)sysconf(_SC_PAGESIZE);
+            size_t done = (size_t)(position - data) / page * page;
+            if(done > 0) {
+                madvise((void*)data, done, MADV_DONTNEED);
+            }
+        }
+};
+
+// Hands out the operations of a mapped trace in order, text or binary
+class TraceReader {
+    public:
+        // Pages are released every RELEASE_BYTES read
+        static constexpr size_t RELEASE_BYTES = 64 << 20;
+
+    private:
+        const MappedTrace &trace;
+        const char *position;
+        const char *released;
+        bool binary;
+        size_t line;
+        std::string failure;
+
+        static bool is_space(char c) {
+            return c == ' ' || c == '\t' || c == '\r';
+        }
+
+        void skip_spaces() {
+            while(position < trace.end() && is_space(*position)) {
+                position++;
+            }
+        }
+
+        bool parse_word(const char *&word, size_t &length) {
+            skip_spaces();
+            word = position;
+            while(position < trace.end() && !is_space(*position) && *position != '\n') {
+                position++;
+            }
+            length = (size_t)(position - word);
+            return length > 0;
+        }
+
+        // The mapping is not NUL-terminated, so strtol cannot be used
+        bool parse_int(int32_t &value) {
+            skip_spaces();
+            bool negative = position < trace.end() && *position == '-';
+            if(negative) {
+                position++;
+            }
+
+            const char *digits = position;
+            int64_t magnitude = 0;
+            while(position < trace.end() && *position >= '0' && *position <= '9') {
+                magnitude = magnitude * 10 + (*position - '0');
+                if(magnitude > (int64_t)INT32_MAX + 1) {
+                    return false;
+                }
+                position++;
+            }
+            if(position == digits) {
+                return false;
+            }
+
+            magnitude = negative ? -magnitude : magnitude;
+            if(magnitude > INT32_MAX) {
+                return false;
+            }
+            value = (int32_t)magnitude;
+            return true;
+        }
+
+        bool at_line_end() {
+            skip_spaces();
+            return position == trace.end() || *position == '\n';
+        }
+
+        bool fail(const std::string &message) {
+            failure = "line " + std::to_string(line) + ": " + message;
+            return false;
+        }
+
+        bool next_text(TraceRecord &record) {
+            for(;;) {
+                skip_spaces();
+                if(position == trace.end()) {
+                    return false;
+                }
+                if(*position == '\n' || *position == '#') {
+                    while(position < trace.end() && *position++ != '\n') {}
+                    line++;
+                    continue;
+                }
+                break;
+            }
+
+            const char *word;
+            size_t length;
+            parse_word(word, length);
+
+            size_t op = 0;
+            while(op < TRACE_OP_COUNT && (strlen(TRACE_OP_NAMES[op]) != length || memcmp(word, TRACE_OP_NAMES[op], length) != 0)) {
+                op++;
+            }
+            if(op == TRACE_OP_COUNT) {
+                return fail("unknown operation " + std::string(word, length));
+            }
+
+            record = {};
+            record.op = (uint8_t)op;
+            if(!parse_int(record.a)) {
+                return fail("missing or invalid key");
+            }
+            record.b = record.a;
+            if((TraceOp)op == TraceOp::range || ((TraceOp)op == TraceOp::insert && !at_line_end())) {
+                if(!parse_int(record.b)) {
+                    return fail("invalid second number");
+                }
+            }
+            if(!at_line_end()) {
+                return fail("unexpected text after the operation");
+            }
+
+            if(position < trace.end()) {
+                position++;
+            }
+            line++;
+            return true;
+        }
+
+        bool next_binary(TraceRecord &record) {
+            if((size_t)(trace.end() - position) < sizeof(TraceRecord)) {
+                if(position != trace.end()) {
+                    failure = "truncated record at the end of the trace";
+                }
+                return false;
+            }
+
+            memcpy(&record, position, sizeof(TraceRecord));
+            position += sizeof(TraceRecord);
+            if(record.op >= TRACE_OP_COUNT) {
+                failure = "unknown operation " + std::to_string(record.op) + " in record "
+                        + std::to_string((position - trace.begin() - sizeof(TraceHeader)) / sizeof(TraceRecord) - 1);
+                return false;
+            }
+            return true;
+        }
+
+    public:
+        explicit TraceReader(const MappedTrace &trace)
+            : trace(trace), position(trace.begin()), released(trace.begin()), binary(trace.binary()), line(1) {
+            if(!binary) {
+                return;
+            }
+
+            TraceHeader header;
+            memcpy(&header, position, sizeof(header));
+            if(header.version != TRACE_VERSION || header.byte_order != TRACE_BYTE_ORDER) {
+                failure = "binary trace of another version or byte order";
+                position = trace.end();
+                return;
+            }
+            position += sizeof(TraceHeader);
+        }
+
+        // False at the end of the trace or on a malformed operation, which
+        // error() then describes
+        bool next(TraceRecord &record) {
+            if((size_t)(position - released) >= RELEASE_BYTES) {
+                trace.release_before(position);
+                released = position;
+            }
+            return binary ? next_binary(record) : next_text(record);
+        }
+
+        const std::string& error() const {
+            return failure;
+        }
+};
+
+// Counts and checksums of one pass, per operation type
+struct ReplayResult {
+    size_t counts[TRACE_OP_COUNT] = {};
+    size_t ops = 0;
+    long long checksum = 0;
+    double seconds = 0;
+    size_t mismatches = 0;
+    std::string error;
+};
+
+// A range query's result: how many entries and the sum of their values
+struct RangeSummary {
+    size_t count;
+    long long sum;
+};
+
+template<class Tree>
+static RangeSummary tree_range(const Tree &tree, int lo, int hi) {
+    RangeSummary summary = {0, 0};
+    typename Tree::Map::Range entries = tree.range(lo, hi);
+    for(typename Tree::iterator it = entries.begin(); it != entries.end(); ++it) {
+        summary.count++;
+        summary.sum += it.value();
+    }
+    return summary;
+}
+
+// Timed pass: the tree alone
+template<class Tree>
+static void replay(const MappedTrace &trace, ReplayResult &result) {
+    Tree *tree = new Tree();
+    TraceReader reader(trace);
+    TraceRecord record;
+    long long checksum = 0;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    while(reader.next(record)) {
+        switch((TraceOp)record.op) {
+            case TraceOp::insert:      tree->insert(record.a, record.b);           break;
+            case TraceOp::search:      checksum += tree->search(record.a);          break;
+            case TraceOp::remove:      tree->remove(record.a);                     break;
+            case TraceOp::predecessor: checksum += tree->get_predecessor(record.a); break;
+            case TraceOp::successor:   checksum += tree->get_successor(record.a);   break;
+            case TraceOp::range:       checksum += tree_range(*tree, record.a, record.b).sum; break;
+        }
+        result.counts[record.op]++;
+        result.ops++;
+    }
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    result.checksum = checksum;
+    result.error = reader.error();
+
+    delete tree;
+}
+
+typedef std::multimap<int, int> Reference;
+
+// Equal keys can sit in any order in the trees, so a lookup may find any
+// of them: search may return any of their values, and pred or succ may
+// return the neighbour of any of them. The trees report a missing key or
+// neighbour as -1
+static bool equal_value(const Reference &reference, int key, int value) {
+    auto equal = reference.equal_range(key);
+    for(Reference::const_iterator it = equal.first; it != equal.second; ++it) {
+        if(it->second == value) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool check_search(const Reference &reference, int key, int value) {
+    return reference.count(key) == 0 ? value == -1 : equal_value(reference, key, value);
+}
+
+static bool check_predecessor(const Reference &reference, int key, int value) {
+    auto equal = reference.equal_range(key);
+    if(equal.first == equal.second) {
+        return value == -1;
+    }
+    int before = (equal.first == reference.begin()) ? -1 : std::prev(equal.first)->second;
+    return value == before || (std::next(equal.first) != equal.second && equal_value(reference, key, value));
+}
+
+static bool check_successor(const Reference &reference, int key, int value) {
+    auto equal = reference.equal_range(key);
+    if(equal.first == equal.second) {
+        return value == -1;
+    }
+    int after = (equal.second == reference.end()) ? -1 : equal.second->second;
+    return value == after || (std::next(equal.first) != equal.second && equal_value(reference, key, value));
+}
+
+static RangeSummary reference_range(const Reference &reference, int lo, int hi) {
+    RangeSummary summary = {0, 0};
+    if(hi < lo) {
+        return summary;
+    }
+    for(Reference::const_iterator it = reference.lower_bound(lo); it != reference.end() && it->first <= hi; ++it) {
+        summary.count++;
+        summary.sum += it->second;
+    }
+    return summary;
+}
+
+// Verifying pass: the tree and a std::multimap side by side. A remove of a
+// duplicated key may drop a different entry in each, so results are exact
+// only for traces whose equal keys carry equal values
+template<class Tree>
+static void verify(const MappedTrace &trace, ReplayResult &result) {
+    static const size_t REPORTED_MISMATCHES = 10;
+
+    Tree *tree = new Tree();
+    Reference reference;
+    TraceReader reader(trace);
+    TraceRecord record;
+
+    while(reader.next(record)) {
+        bool ok = true;
+        int got = 0;
+        switch((TraceOp)record.op) {
+            case TraceOp::insert:
+                tree->insert(record.a, record.b);
+                reference.emplace(record.a, record.b);
+                break;
+            case TraceOp::search:
+                got = tree->search(record.a);
+                ok = check_search(reference, record.a, got);
+                break;
+            case TraceOp::remove: {
+                tree->remove(record.a);
+                Reference::iterator it = reference.find(record.a);
+                if(it != reference.end()) {
+                    reference.erase(it);
+                }
+                break;
+            }
+            case TraceOp::predecessor:
+                got = tree->get_predecessor(record.a);
+                ok = check_predecessor(reference, record.a, got);
+                break;
+            case TraceOp::successor:
+                got = tree->get_successor(record.a);
+                ok = check_successor(reference, record.a, got);
+                break;
+            case TraceOp::range: {
+                RangeSummary mine = tree_range(*tree, record.a, record.b);
+                RangeSummary expected = reference_range(reference, record.a, record.b);
+                ok = mine.count == expected.count && mine.sum == expected.sum;
+                got = (int)mine.count;
+                break;
+            }
+        }
+
+        if(!ok && result.mismatches++ < REPORTED_MISMATCHES) {
+            printf("  mismatch at operation %zu: %s %d %d returned %d\n", result.ops, TRACE_OP_NAMES[record.op],
+                   record.a, record.b, got);
+        }
+        result.counts[record.op]++;
+        result.ops++;
+    }
+    result.error = reader.error();
+
+    if(tree->entries().size() != reference.size()) {
+        printf("  final size %zu, reference holds %zu\n", tree->entries().size(), reference.size());
+        result.mismatches++;
+    }
+
+    delete tree;
+}
+
+struct TreeEntry {
+    const char *name;
+    void (*replay)(const MappedTrace &trace, ReplayResult &result);
+    void (*verify)(const MappedTrace &trace, ReplayResult &result);
+};
+
+static const TreeEntry TREES[] = {
+    {"bst", replay<BinarySearchTree>, verify<BinarySearchTree>},
+    {"rb",  replay<RedBlackTree>,     verify<RedBlackTree>},
+    {"avl", replay<AVLTree>,          verify<AVLTree>},
+};
+
+// Writes the operations of trace as a binary trace at path
+static bool convert(const MappedTrace &trace, const std::string &path, std::string &error) {
+    std::ofstream out(path, std::ios::binary);
+    if(!out) {
+        error = "cannot write " + path;
+        return false;
+    }
+
+    TraceHeader header;
+    memcpy(header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+    header.version = TRACE_VERSION;
+    header.byte_order = TRACE_BYTE_ORDER;
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    TraceReader reader(trace);
+    TraceRecord record;
+    while(reader.next(record)) {
+        out.write(reinterpret_cast<const char*>(&record), sizeof(record));
+    }
+    error = reader.error();
+    out.close();
+    if(error.empty() && !out) {
+        error = "cannot write " + path;
+    }
+    return error.empty();
+}
+
+static void usage(const char *prog) {
+    std::cerr
+        << "usage: " << prog << " [options] TRACE\n"
+        << "  --tree NAME      tree to replay against: bst, rb or avl (default: rb)\n"
+        << "  --verify         replay a second time next to std::multimap and check every result\n"
+        << "  --convert FILE   write TRACE as a binary trace to FILE and exit\n";
+}
+
+int main(int argc, char **argv) {
+    std::string tree_name = "rb";
+    std::string trace_path;
+    std::string convert_path;
+    bool check = false;
+
+    for(int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if(arg == "-h" || arg == "--help") {
+            usage(argv[0]);
+            return 0;
+        } else if(arg == "--verify") {
+            check = true;
+        } else if((arg == "--tree" || arg == "--convert") && i + 1 < argc) {
+            (arg == "--tree" ? tree_name : convert_path) = argv[++i];
+        } else if(arg[0] != '-' && trace_path.empty()) {
+            trace_path = arg;
+        } else {
+            std::cerr << "invalid argument: " << arg << "\n";
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    const TreeEntry *entry = nullptr;
+    for(const TreeEntry &candidate : TREES) {
+        if(tree_name == candidate.name) {
+            entry = &candidate;
+        }
+    }
+    if(entry == nullptr || trace_path.empty()) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    MappedTrace trace;
+    if(!trace.open(trace_path)) {
+        std::cerr << "cannot open " << trace_path << ": " << strerror(errno) << "\n";
+        return 1;
+    }
+
+    if(!convert_path.empty()) {
+        std::string error;
+        if(!convert(trace, convert_path, error)) {
+            std::cerr << trace_path << ": " << error << "\n";
+            return 1;
+        }
+        return 0;
+    }
+
+    ReplayResult timed;
+    entry->replay(trace, timed);
+    if(!timed.error.empty()) {
+        std::cerr << trace_path << ": " << timed.error << "\n";
+        return 1;
+    }
+
+    printf("%-8s %-6s %12s %10s %10s\n", "tree", "op", "count", "Mops/s", "ns/op");
+    for(size_t op = 0; op < TRACE_OP_COUNT; op++) {
+        if(timed.counts[op] > 0) {
+            printf("%-8s %-6s %12zu\n", entry->name, TRACE_OP_NAMES[op], timed.counts[op]);
+        }
+    }
+    printf("%-8s %-6s %12zu %10.2f %10.1f  checksum %lld\n", entry->name, "all", timed.ops,
+           timed.seconds > 0 ? timed.ops / timed.seconds / 1e6 : 0.0,
+           timed.ops > 0 ? timed.seconds * 1e9 / timed.ops : 0.0, timed.checksum);
+
+    if(check) {
+        ReplayResult verified;
+        entry->verify(trace, verified);
+        printf("verify: %zu operations, %zu mismatches\n", verified.ops, verified.mismatches);
+        return verified.mismatches == 0 ? 0 : 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,382 @@
+// Throughput benchmark for the tree implementations.
+//
+// Every (tree, key order, operation mix, size) combination runs in its own
+// forked process, so the peak RSS reported by wait4() belongs to that run
+// alone and a crash or stack overflow in one tree does not end the sweep.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "workload.hpp"
+
+// Measurements sent from a run's child process back to the parent
+struct PhaseResult {
+    size_t ops;
+    double seconds;
+};
+
+struct RunResult {
+    PhaseResult load;
+    PhaseResult mixed;
+    long long checksum;
+};
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+template<class Tree>
+static RunResult run_workload(const Workload &w) {
+    std::mt19937_64 rng(w.seed);
+    std::vector<int> keys = make_load_keys(w, rng);
+    std::vector<Operation> ops = make_operations(w, keys, rng);
+
+    RunResult result = {};
+    Tree *tree = new Tree();
+
+    // Bulk loading starts from keys that are already sorted, sorting is not timed
+    SortedPairs pairs;
+    if(w.bulk_load) {
+        std::vector<int> sorted = keys;
+        std::sort(sorted.begin(), sorted.end());
+        pairs.reserve(sorted.size());
+        for(int key : sorted) {
+            pairs.push_back({key, key});
+        }
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    if(w.bulk_load) {
+        TreeOps<Tree>::build(*tree, pairs);
+    } else {
+        for(int key : keys) {
+            TreeOps<Tree>::insert(*tree, key);
+        }
+    }
+    result.load = {keys.size(), seconds_since(start)};
+
+    std::vector<int> batch_keys(w.batch);
+    std::vector<int> batch_out(w.batch);
+
+    long long checksum = 0;
+    start = std::chrono::steady_clock::now();
+    for(size_t i = 0; i < ops.size(); i++) {
+        const Operation &op = ops[i];
+
+        // Runs of consecutive searches go through search_batch
+        if(w.batch > 1 && op.type == OpType::search) {
+            size_t count = 0;
+            for(; count < w.batch && i < ops.size() && ops[i].type == OpType::search; count++, i++) {
+                batch_keys[count] = ops[i].key;
+            }
+            i--;
+
+            TreeOps<Tree>::search_batch(*tree, batch_keys.data(), batch_out.data(), count);
+            for(size_t j = 0; j < count; j++) {
+                checksum += batch_out[j];
+            }
+            continue;
+        }
+
+        switch(op.type) {
+            case OpType::insert:      TreeOps<Tree>::insert(*tree, op.key);                 break;
+            case OpType::search:      checksum += TreeOps<Tree>::search(*tree, op.key);      break;
+            case OpType::remove:      TreeOps<Tree>::remove(*tree, op.key);                 break;
+            case OpType::predecessor: checksum += TreeOps<Tree>::predecessor(*tree, op.key); break;
+            case OpType::successor:   checksum += TreeOps<Tree>::successor(*tree, op.key);   break;
+        }
+    }
+    result.mixed = {ops.size(), seconds_since(start)};
+    result.checksum = checksum;
+
+    delete tree;
+    return result;
+}
+
+struct TreeEntry {
+    const char *name;
+    RunResult (*run)(const Workload &w);
+    bool balanced;
+};
+
+static std::vector<TreeEntry> tree_table() {
+    std::vector<TreeEntry> table;
+    for_each_tree([&](const char *name, bool balanced, auto tag) {
+        table.push_back({name, run_workload<typename decltype(tag)::type>, balanced});
+    });
+    return table;
+}
+
+static const std::vector<TreeEntry> TREES = tree_table();
+
+struct Row {
+    std::string tree;
+    std::string order;
+    std::string mix;
+    size_t size;
+    std::string phase;
+    size_t ops;
+    double seconds;
+    long peak_rss_kb;
+    std::string status;
+
+    double ns_per_op() const { return (ops > 0) ? seconds * 1e9 / ops : 0.0; }
+    double mops() const { return (seconds > 0) ? ops / seconds / 1e6 : 0.0; }
+    std::string id() const { return tree + "," + order + "," + mix + "," + std::to_string(size) + "," + phase; }
+};
+
+// Runs one configuration in a child process and collects its result
+static bool run_isolated(const TreeEntry &entry, const Workload &w, RunResult &result, long &peak_rss_kb, std::string &status) {
+    int fds[2];
+    if(pipe(fds) != 0) {
+        status = "pipe failed";
+        return false;
+    }
+
+    pid_t pid = fork();
+    if(pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        status = "fork failed";
+        return false;
+    }
+
+    if(pid == 0) {
+        close(fds[0]);
+        RunResult r = entry.run(w);
+        ssize_t written = write(fds[1], &r, sizeof(r));
+        _exit(written == (ssize_t)sizeof(r) ? 0 : 1);
+    }
+
+    close(fds[1]);
+    ssize_t got = read(fds[0], &result, sizeof(result));
+    close(fds[0]);
+
+    int wstatus = 0;
+    struct rusage usage;
+    memset(&usage, 0, sizeof(usage));
+    wait4(pid, &wstatus, 0, &usage);
+    peak_rss_kb = usage.ru_maxrss;
+
+    if(WIFSIGNALED(wstatus)) {
+        status = std::string("killed by signal ") + std::to_string(WTERMSIG(wstatus));
+        return false;
+    }
+    if(got != (ssize_t)sizeof(result) || WEXITSTATUS(wstatus) != 0) {
+        status = "no result";
+        return false;
+    }
+
+    status = "ok";
+    return true;
+}
+
+static void write_csv(const std::string &path, const std::vector<Row> &rows) {
+    std::ofstream out(path);
+    out << "tree,order,mix,size,phase,ops,seconds,mops,ns_per_op,peak_rss_kb,status\n";
+    for(const Row &row : rows) {
+        out << row.id() << "," << row.ops << "," << row.seconds << "," << row.mops() << ","
+            << row.ns_per_op() << "," << row.peak_rss_kb << "," << row.status << "\n";
+    }
+}
+
+// Reads ns/op per configuration from a csv written by an earlier run
+static bool read_baseline(const std::string &path, std::map<std::string, double> &baseline) {
+    std::ifstream in(path);
+    if(!in) {
+        return false;
+    }
+
+    std::string line;
+    std::getline(in, line);
+    while(std::getline(in, line)) {
+        std::vector<std::string> fields;
+        std::stringstream stream(line);
+        std::string field;
+        while(std::getline(stream, field, ',')) {
+            fields.push_back(field);
+        }
+        if(fields.size() == 11 && fields[10] == "ok") {
+            std::string id = fields[0] + "," + fields[1] + "," + fields[2] + "," + fields[3] + "," + fields[4];
+            baseline[id] = atof(fields[8].c_str());
+        }
+    }
+    return true;
+}
+
+static void usage(const char *prog) {
+    std::cerr
+        << "usage: " << prog << " [options]\n"
+        << "  --trees LIST         trees to run (default: all):\n"
+        << tree_list(TREES)
+        << "  --orders LIST        key orders: uniform,sorted,reverse,zipf (default: all)\n"
+        << "  --mixes LIST         insert:search:remove or insert:search:remove:predecessor:successor\n"
+        << "                       percentages (default: 0:100:0,20:70:10)\n"
+        << "  --sizes LIST         keys loaded per run, K/M/G suffixes allowed (default: 1K,10K,100K,1M)\n"
+        << "  --ops N              operations after the load phase (default: same as size)\n"
+        << "  --load MODE          insert: one insert per key, bulk: sort the keys and\n"
+        << "                       build_from_sorted, reported as phase bulk (default: insert)\n"
+        << "  --batch N            issue up to N consecutive searches through search_batch (default: 0, one at a time)\n"
+        << "  --zipf-theta T       zipf skew in (0, 1) (default: 0.99)\n"
+        << "  --seed N             random seed (default: 42)\n"
+        << "  --degenerate-limit N largest size run on unbalanced trees with sorted/reverse keys (default: 100K)\n"
+        << "  --csv FILE           write results as csv\n"
+        << "  --baseline FILE      compare ns/op against a csv from an earlier run\n"
+        << "  --tolerance PCT      slowdown reported as a regression (default: 10)\n";
+}
+
+int main(int argc, char **argv) {
+    std::vector<std::string> tree_names;
+    std::vector<KeyOrder> orders = {KeyOrder::uniform, KeyOrder::sorted, KeyOrder::reverse, KeyOrder::zipf};
+    std::vector<OperationMix> mixes = {{0, 100, 0, 0, 0}, {20, 70, 10, 0, 0}};
+    std::vector<size_t> sizes = {1000, 10000, 100000, 1000000};
+    size_t ops = 0;
+    bool bulk_load = false;
+    size_t batch = 0;
+    double zipf_theta = 0.99;
+    uint64_t seed = 42;
+    size_t degenerate_limit = 100000;
+    std::string csv_path;
+    std::string baseline_path;
+    double tolerance = 10.0;
+
+    for(int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if(arg == "-h" || arg == "--help") {
+            usage(argv[0]);
+            return 0;
+        }
+        if(i + 1 >= argc) {
+            usage(argv[0]);
+            return 2;
+        }
+
+        std::string value = argv[++i];
+        bool ok = true;
+        if(arg == "--trees") {
+            tree_names = split_list(value);
+        } else if(arg == "--orders") {
+            ok = parse_key_orders(value, orders);
+        } else if(arg == "--mixes") {
+            ok = parse_mixes(value, mixes);
+        } else if(arg == "--sizes") {
+            ok = parse_sizes(value, sizes);
+        } else if(arg == "--ops") {
+            ok = parse_count(value, ops);
+        } else if(arg == "--load") {
+            bulk_load = value == "bulk";
+            ok = bulk_load || value == "insert";
+        } else if(arg == "--batch") {
+            ok = parse_count(value, batch);
+        } else if(arg == "--zipf-theta") {
+            zipf_theta = atof(value.c_str());
+            ok = zipf_theta > 0.0 && zipf_theta < 1.0;
+        } else if(arg == "--seed") {
+            seed = strtoull(value.c_str(), nullptr, 10);
+        } else if(arg == "--degenerate-limit") {
+            ok = parse_count(value, degenerate_limit);
+        } else if(arg == "--csv") {
+            csv_path = value;
+        } else if(arg == "--baseline") {
+            baseline_path = value;
+        } else if(arg == "--tolerance") {
+            tolerance = atof(value.c_str());
+        } else {
+            ok = false;
+        }
+
+        if(!ok) {
+            std::cerr << "invalid argument: " << arg << " " << value << "\n";
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    std::vector<const TreeEntry*> trees;
+    if(!select_trees(tree_names, TREES, trees)) {
+        return 2;
+    }
+
+    std::vector<Row> rows;
+    printf("%-11s %-8s %-16s %10s %-6s %10s %10s %10s %12s  %s\n",
+           "tree", "order", "mix", "size", "phase", "ops", "Mops/s", "ns/op", "peak_rss_kb", "status");
+
+    for(size_t size : sizes) {
+        for(KeyOrder order : orders) {
+            for(const OperationMix &mix : mixes) {
+                Workload w = {order, mix, size, (ops > 0) ? ops : size, zipf_theta, seed, bulk_load, batch};
+
+                for(const TreeEntry *entry : trees) {
+                    RunResult result = {};
+                    long peak_rss_kb = 0;
+                    std::string status;
+
+                    bool degenerate = !entry->balanced && size > degenerate_limit
+                                   && (order == KeyOrder::sorted || order == KeyOrder::reverse);
+                    if(degenerate) {
+                        status = "skipped (degenerate)";
+                    } else {
+                        run_isolated(*entry, w, result, peak_rss_kb, status);
+                    }
+
+                    Row load  = {entry->name, key_order_name(order), mix_name(mix), size, bulk_load ? "bulk" : "load",
+                                 result.load.ops, result.load.seconds, peak_rss_kb, status};
+                    Row mixed = {entry->name, key_order_name(order), mix_name(mix), size, "ops",
+                                 result.mixed.ops, result.mixed.seconds, peak_rss_kb, status};
+
+                    for(const Row &row : {load, mixed}) {
+                        printf("%-11s %-8s %-16s %10zu %-6s %10zu %10.3f %10.1f %12ld  %s\n",
+                               row.tree.c_str(), row.order.c_str(), row.mix.c_str(), row.size, row.phase.c_str(),
+                               row.ops, row.mops(), row.ns_per_op(), row.peak_rss_kb, row.status.c_str());
+                        rows.push_back(row);
+                    }
+                    fflush(stdout);
+                }
+            }
+        }
+    }
+
+    if(!csv_path.empty()) {
+        write_csv(csv_path, rows);
+    }
+
+    if(baseline_path.empty()) {
+        return 0;
+    }
+
+    std::map<std::string, double> baseline;
+    if(!read_baseline(baseline_path, baseline)) {
+        std::cerr << "cannot read baseline " << baseline_path << "\n";
+        return 2;
+    }
+
+    int regressions = 0;
+    for(const Row &row : rows) {
+        std::map<std::string, double>::iterator it = baseline.find(row.id());
+        if(row.status != "ok" || it == baseline.end() || it->second <= 0) {
+            continue;
+        }
+
+        double change = (row.ns_per_op() / it->second - 1.0) * 100.0;
+        if(change > tolerance) {
+            printf("REGRESSION %s: %.1f -> %.1f ns/op (+%.1f%%)\n", row.id().c_str(), it->second, row.ns_per_op(), change);
+            regressions++;
+        }
+    }
+
+    printf("%d regression(s) against %s\n", regressions, baseline_path.c_str());
+    return (regressions > 0) ? 1 : 0;
+}
@@ -0,0 +1,455 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "avl_tree.hpp"
+#include "binary_search_tree.hpp"
+#include "bplus_tree.hpp"
+#include "red_black_tree.hpp"
+
+// Order in which keys are generated for the load phase and picked for the
+// operation phase of a benchmark run
+enum class KeyOrder {
+    uniform, sorted, reverse, zipf
+};
+
+enum class OpType : uint8_t {
+    insert, search, remove, predecessor, successor
+};
+
+// Percentages of each operation type in the operation phase
+struct OperationMix {
+    unsigned insert;
+    unsigned search;
+    unsigned remove;
+    unsigned predecessor;
+    unsigned successor;
+};
+
+struct Operation {
+    OpType type;
+    int key;
+};
+
+struct Workload {
+    KeyOrder order;
+    OperationMix mix;
+    size_t size;        // keys inserted in the load phase
+    size_t ops;         // operations issued in the operation phase
+    double zipf_theta;
+    uint64_t seed;
+    bool bulk_load;     // load the keys sorted through build_from_sorted instead of insert
+    size_t batch;       // consecutive searches issued together through search_batch, 0 for one at a time
+};
+
+inline const char* key_order_name(KeyOrder order) {
+    switch(order) {
+        case KeyOrder::uniform: return "uniform";
+        case KeyOrder::sorted:  return "sorted";
+        case KeyOrder::reverse: return "reverse";
+        case KeyOrder::zipf:    return "zipf";
+    }
+    return "?";
+}
+
+inline bool parse_key_order(const std::string &name, KeyOrder &order) {
+    for(KeyOrder o : {KeyOrder::uniform, KeyOrder::sorted, KeyOrder::reverse, KeyOrder::zipf}) {
+        if(name == key_order_name(o)) {
+            order = o;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Parses "I:S:R" or "I:S:R:P:N" percentages, e.g. "20:70:10" or
+// "20:50:10:10:10", where P and N are predecessor and successor queries
+inline bool parse_mix(const std::string &text, OperationMix &mix) {
+    unsigned i, s, r, p = 0, n = 0;
+    char tail;
+    int fields = sscanf(text.c_str(), "%u:%u:%u:%u:%u%c", &i, &s, &r, &p, &n, &tail);
+    if((fields != 3 && fields != 5) || i + s + r + p + n != 100) {
+        return false;
+    }
+    mix = {i, s, r, p, n};
+    return true;
+}
+
+inline std::string mix_name(const OperationMix &mix) {
+    std::string name = std::to_string(mix.insert) + ":" + std::to_string(mix.search) + ":" + std::to_string(mix.remove);
+    if(mix.predecessor + mix.successor > 0) {
+        name += ":" + std::to_string(mix.predecessor) + ":" + std::to_string(mix.successor);
+    }
+    return name;
+}
+
+// Parses a count with an optional K/M/G suffix, e.g. "100K"
+inline bool parse_count(const std::string &text, size_t &count) {
+    char *end = nullptr;
+    unsigned long long value = strtoull(text.c_str(), &end, 10);
+    if(end == text.c_str()) {
+        return false;
+    }
+
+    switch(*end) {
+        case '\0':           break;
+        case 'k': case 'K': value *= 1000ULL;       end++; break;
+        case 'm': case 'M': value *= 1000000ULL;    end++; break;
+        case 'g': case 'G': value *= 1000000000ULL; end++; break;
+        default: return false;
+    }
+
+    count = value;
+    return *end == '\0';
+}
+
+// Zipfian ranks in [0, n) following Gray et al., "Quickly Generating
+// Billion-Record Synthetic Databases" (the generator used by YCSB)
+class ZipfGenerator {
+    private:
+        uint64_t n;
+        double theta;
+        double alpha;
+        double zetan;
+        double eta;
+
+        static double zeta(uint64_t n, double theta) {
+            double sum = 0;
+            for(uint64_t i = 1; i <= n; i++) {
+                sum += 1.0 / std::pow((double)i, theta);
+            }
+            return sum;
+        }
+
+    public:
+        ZipfGenerator(uint64_t n, double theta) : n(n), theta(theta) {
+            double zeta2 = zeta(2, theta);
+            alpha = 1.0 / (1.0 - theta);
+            zetan = zeta(n, theta);
+            eta   = (1.0 - std::pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / zetan);
+        }
+
+        template<class Rng>
+        uint64_t next(Rng &rng) {
+            double u  = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+            double uz = u * zetan;
+
+            if(uz < 1.0) {
+                return 0;
+            }
+            if(uz < 1.0 + std::pow(0.5, theta)) {
+                return 1;
+            }
+
+            uint64_t rank = (uint64_t)(n * std::pow(eta * u - eta + 1.0, alpha));
+            return (rank < n) ? rank : n - 1;
+        }
+};
+
+// Spreads zipf ranks over the key array so the hot keys are not neighbours
+inline size_t scramble_rank(uint64_t rank, size_t n) {
+    uint64_t h = rank * 0x9E3779B97F4A7C15ULL;
+    h ^= h >> 32;
+    return (size_t)(h % n);
+}
+
+// Keys inserted during the load phase
+inline std::vector<int> make_load_keys(const Workload &w, std::mt19937_64 &rng) {
+    std::vector<int> keys(w.size);
+
+    switch(w.order) {
+        case KeyOrder::uniform: {
+            std::uniform_int_distribution<int> dist(0, INT32_MAX);
+            for(size_t i = 0; i < w.size; i++) {
+                keys[i] = dist(rng);
+            }
+            break;
+        }
+        case KeyOrder::sorted:
+            for(size_t i = 0; i < w.size; i++) {
+                keys[i] = (int)i;
+            }
+            break;
+        case KeyOrder::reverse:
+            for(size_t i = 0; i < w.size; i++) {
+                keys[i] = (int)(w.size - 1 - i);
+            }
+            break;
+        case KeyOrder::zipf:
+            // Zipf skews the accesses, the keys themselves are distinct
+            for(size_t i = 0; i < w.size; i++) {
+                keys[i] = (int)i;
+            }
+            std::shuffle(keys.begin(), keys.end(), rng);
+            break;
+    }
+
+    return keys;
+}
+
+// Operations issued after the load phase. Searches, removes and neighbour
+// queries pick loaded keys following the key order, inserts continue the
+// load sequence
+inline std::vector<Operation> make_operations(const Workload &w, const std::vector<int> &keys, std::mt19937_64 &rng) {
+    std::vector<Operation> ops(w.ops);
+    std::uniform_int_distribution<unsigned> percent(0, 99);
+    std::uniform_int_distribution<int> any_key(0, INT32_MAX);
+    std::uniform_int_distribution<size_t> any_index(0, keys.empty() ? 0 : keys.size() - 1);
+    ZipfGenerator zipf(keys.empty() ? 1 : keys.size(), w.zipf_theta);
+
+    size_t n = keys.size();
+    long long next_sorted  = (long long)n;
+    long long next_reverse = -1;
+
+    for(size_t i = 0; i < w.ops; i++) {
+        unsigned p = percent(rng);
+        Operation &op = ops[i];
+        op.type = (p < w.mix.insert) ? OpType::insert
+                : (p < w.mix.insert + w.mix.search) ? OpType::search
+                : (p < w.mix.insert + w.mix.search + w.mix.remove) ? OpType::remove
+                : (p < 100 - w.mix.successor) ? OpType::predecessor
+                : OpType::successor;
+
+        if(op.type == OpType::insert) {
+            switch(w.order) {
+                case KeyOrder::uniform: op.key = any_key(rng);       break;
+                case KeyOrder::sorted:  op.key = (int)next_sorted++;  break;
+                case KeyOrder::reverse: op.key = (int)next_reverse--; break;
+                case KeyOrder::zipf:    op.key = keys[scramble_rank(zipf.next(rng), n)]; break;
+            }
+            continue;
+        }
+
+        if(n == 0) {
+            op.key = 0;
+            continue;
+        }
+
+        switch(w.order) {
+            case KeyOrder::uniform: op.key = keys[any_index(rng)];      break;
+            case KeyOrder::sorted:  op.key = keys[i % n];               break;
+            case KeyOrder::reverse: op.key = keys[i % n];               break;
+            case KeyOrder::zipf:    op.key = keys[scramble_rank(zipf.next(rng), n)]; break;
+        }
+    }
+
+    return ops;
+}
+
+// Splits a comma separated option value, dropping empty items
+inline std::vector<std::string> split_list(const std::string &text) {
+    std::vector<std::string> items;
+    std::stringstream stream(text);
+    std::string item;
+    while(std::getline(stream, item, ',')) {
+        if(!item.empty()) {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+// Option lists shared by tree_bench and latency_bench. Each one replaces
+// the defaults and fails on an empty list or a bad item
+
+inline bool parse_key_orders(const std::string &text, std::vector<KeyOrder> &orders) {
+    orders.clear();
+    for(const std::string &name : split_list(text)) {
+        KeyOrder order;
+        if(!parse_key_order(name, order)) {
+            return false;
+        }
+        orders.push_back(order);
+    }
+    return !orders.empty();
+}
+
+inline bool parse_mixes(const std::string &text, std::vector<OperationMix> &mixes) {
+    mixes.clear();
+    for(const std::string &item : split_list(text)) {
+        OperationMix mix;
+        if(!parse_mix(item, mix)) {
+            return false;
+        }
+        mixes.push_back(mix);
+    }
+    return !mixes.empty();
+}
+
+inline bool parse_sizes(const std::string &text, std::vector<size_t> &sizes) {
+    sizes.clear();
+    for(const std::string &item : split_list(text)) {
+        size_t size = 0;
+        if(!parse_count(item, size) || size == 0 || size > INT32_MAX) {
+            return false;
+        }
+        sizes.push_back(size);
+    }
+    return !sizes.empty();
+}
+
+typedef std::vector<std::pair<int, int>> SortedPairs;
+
+// Adapts each tree to the operations the benchmarks issue. The int trees
+// share one interface, missing keys come back as -1
+template<class Tree>
+struct TreeOps {
+    static void build(Tree &tree, const SortedPairs &pairs) { tree.build_from_sorted(pairs.data(), pairs.data() + pairs.size()); }
+    static void insert(Tree &tree, int key)      { tree.insert(key, key); }
+    static int  search(Tree &tree, int key)      { return tree.search(key); }
+    static void search_batch(Tree &tree, const int *keys, int *out, size_t n) { tree.search_batch(keys, out, n); }
+    static void remove(Tree &tree, int key)      { tree.remove(key); }
+    static int  predecessor(Tree &tree, int key) { return tree.get_predecessor(key); }
+    static int  successor(Tree &tree, int key)   { return tree.get_successor(key); }
+};
+
+// Maps with no int wrapper class, which answer with std::optional
+template<class Tree>
+struct OptionalTreeOps {
+    static void build(Tree &tree, const SortedPairs &pairs) { tree.build_from_sorted(pairs.begin(), pairs.end()); }
+    static void insert(Tree &tree, int key)      { tree.insert(key, key); }
+    static int  search(Tree &tree, int key)      { return tree.search(key).value_or(-1); }
+    static void search_batch(Tree &tree, const int *keys, int *out, size_t n) { tree.search_batch(keys, out, n, -1); }
+    static void remove(Tree &tree, int key)      { tree.remove(key); }
+    static int  predecessor(Tree &tree, int key) { return tree.get_predecessor(key).value_or(-1); }
+    static int  successor(Tree &tree, int key)   { return tree.get_successor(key).value_or(-1); }
+};
+
+template<class Key, class Value, class Compare, class BalancePolicy, class NodeLayout, class Stats>
+struct TreeOps<OrderedMap<Key, Value, Compare, BalancePolicy, NodeLayout, Stats>>
+    : OptionalTreeOps<OrderedMap<Key, Value, Compare, BalancePolicy, NodeLayout, Stats>> {};
+
+template<class Key, class Value, class Compare, size_t NodeBytes>
+struct TreeOps<BPlusMap<Key, Value, Compare, NodeBytes>>
+    : OptionalTreeOps<BPlusMap<Key, Value, Compare, NodeBytes>> {};
+
+// Same trees with one heap allocation per node, to measure the slab pool
+typedef OrderedMap<int, int, std::less<int>, RedBlackBalance, PointerLayout<HeapPool>> HeapRedBlackTree;
+typedef OrderedMap<int, int, std::less<int>, AVLBalance, PointerLayout<HeapPool>> HeapAVLTree;
+
+// Same trees with 32-bit index links
+typedef OrderedMap<int, int, std::less<int>, RedBlackBalance, CompactLayout> CompactRedBlackTree;
+typedef OrderedMap<int, int, std::less<int>, AVLBalance, CompactLayout> CompactAVLTree;
+
+// B+tree with 4 KiB page-sized nodes
+typedef BPlusMap<int, int, std::less<int>, 4096> PageBPlusTree;
+
+// The trees keep duplicate keys, so the standard library baseline is a multimap
+typedef std::multimap<int, int> StdMap;
+
+template<>
+struct TreeOps<StdMap> {
+    // Linear for sorted input
+    static void build(StdMap &tree, const SortedPairs &pairs) { tree = StdMap(pairs.begin(), pairs.end()); }
+
+    static void insert(StdMap &tree, int key) { tree.emplace(key, key); }
+
+    static int search(StdMap &tree, int key) {
+        StdMap::iterator it = tree.find(key);
+        return (it != tree.end()) ? it->second : -1;
+    }
+
+    static void search_batch(StdMap &tree, const int *keys, int *out, size_t n) {
+        for(size_t i = 0; i < n; i++) {
+            out[i] = search(tree, keys[i]);
+        }
+    }
+
+    static void remove(StdMap &tree, int key) {
+        StdMap::iterator it = tree.find(key);
+        if(it != tree.end()) {
+            tree.erase(it);
+        }
+    }
+
+    static int predecessor(StdMap &tree, int key) {
+        StdMap::iterator it = tree.find(key);
+        return (it != tree.end() && it != tree.begin()) ? std::prev(it)->second : -1;
+    }
+
+    static int successor(StdMap &tree, int key) {
+        StdMap::iterator it = tree.find(key);
+        return (it != tree.end() && std::next(it) != tree.end()) ? std::next(it)->second : -1;
+    }
+};
+
+template<class Tree>
+struct TreeTag {
+    typedef Tree type;
+};
+
+// Calls visit(name, balanced, TreeTag<Tree>()) for every tree the
+// benchmarks run, in the order they run and are listed in. Unbalanced
+// trees are skipped on large sorted inputs
+template<class Visit>
+void for_each_tree(Visit visit) {
+    visit("bst",         false, TreeTag<BinarySearchTree>());
+    visit("rb",          true,  TreeTag<RedBlackTree>());
+    visit("avl",         true,  TreeTag<AVLTree>());
+    visit("map",         true,  TreeTag<StdMap>());
+    visit("rb-ranked",   true,  TreeTag<RankedRedBlackTree>());
+    visit("avl-ranked",  true,  TreeTag<RankedAVLTree>());
+    visit("rb-heap",     true,  TreeTag<HeapRedBlackTree>());
+    visit("avl-heap",    true,  TreeTag<HeapAVLTree>());
+    visit("rb-compact",  true,  TreeTag<CompactRedBlackTree>());
+    visit("avl-compact", true,  TreeTag<CompactAVLTree>());
+    visit("bplus",       true,  TreeTag<BPlusTree>());
+    visit("bplus-page",  true,  TreeTag<PageBPlusTree>());
+}
+
+// The entries of table named in names, all of them when names is empty.
+// False after reporting an unknown name
+template<class Entry>
+bool select_trees(const std::vector<std::string> &names, const std::vector<Entry> &table, std::vector<const Entry*> &selected) {
+    selected.clear();
+    if(names.empty()) {
+        for(const Entry &entry : table) {
+            selected.push_back(&entry);
+        }
+        return true;
+    }
+
+    for(const std::string &name : names) {
+        const Entry *found = nullptr;
+        for(const Entry &entry : table) {
+            if(name == entry.name) {
+                found = &entry;
+            }
+        }
+        if(found == nullptr) {
+            std::cerr << "unknown tree: " << name << "\n";
+            return false;
+        }
+        selected.push_back(found);
+    }
+    return true;
+}
+
+// The names in table, comma separated and wrapped to the help text's
+// option column
+template<class Entry>
+std::string tree_list(const std::vector<Entry> &table) {
+    static const size_t INDENT = 23, WIDTH = 80;
+    std::string list, line(INDENT, ' ');
+    for(size_t i = 0; i < table.size(); i++) {
+        std::string item = std::string(table[i].name) + ((i + 1 < table.size()) ? "," : "");
+        if(line.size() > INDENT && line.size() + item.size() > WIDTH) {
+            list += line + "\n";
+            line.assign(INDENT, ' ');
+        }
+        line += item;
+    }
+    return list + line + "\n";
+}
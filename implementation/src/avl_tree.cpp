@@ -1,245 +1,194 @@
 #include <iostream>
+#include <vector>
 
 #include "avl_tree.hpp"
 
-AVLTree::AVLTree() {
-    root = nullptr;
-}
+// Missing keys and empty trees are reported as -1
 
-AVLTree::~AVLTree() {
-    rec_delete_tree(root);
+template<class BalancePolicy>
+int BasicAVLTree<BalancePolicy>::search(int key) {
+    return map.search(key).value_or(-1);
 }
 
-AVLTreeNode* AVLTree::search_node(int key) {
-    AVLTreeNode *tmp = root;
-    while(tmp != nullptr && tmp->key != key) {
-        tmp = (tmp->key > key) ? tmp->left : tmp->right;
-    }
-
-    if(tmp != nullptr && tmp->key == key) {
-        return tmp;
-    }
-
-    return nullptr;
+template<class BalancePolicy>
+bool BasicAVLTree<BalancePolicy>::contains(int key) {
+    return map.contains(key);
 }
 
-AVLTreeNode* AVLTree::get_min_node(AVLTreeNode *node) {
-    if(node == nullptr) {
-        return nullptr;
-    }
-
-    while(node->left != nullptr) {
-        node = node->left;
-    }
+template<class BalancePolicy>
+void BasicAVLTree<BalancePolicy>::search_batch(const int *keys, int *out, size_t n) {
+    map.search_batch(keys, out, n, -1);
+}
 
-    return node;
+template<class BalancePolicy>
+void BasicAVLTree<BalancePolicy>::insert(int data) {
+    insert(data, data);
 }
 
-AVLTreeNode* AVLTree::get_max_node(AVLTreeNode *node) {
-    if(node == nullptr) {
-        return nullptr;
-    }
+template<class BalancePolicy>
+void BasicAVLTree<BalancePolicy>::insert(int key, int data) {
+    map.insert(key, data);
+}
 
-    while(node->right != nullptr) {
-        node = node->right;
-    }
+// Replaces the tree with the (key, data) pairs in [begin, end), sorted by key
+template<class BalancePolicy>
+void BasicAVLTree<BalancePolicy>::build_from_sorted(const std::pair<int, int> *begin, const std::pair<int, int> *end) {
+    map.build_from_sorted(begin, end);
+}
 
-    return node;
+template<class BalancePolicy>
+void BasicAVLTree<BalancePolicy>::remove(int key) {
+    map.remove(key);
 }
 
-AVLTreeNode* AVLTree::get_predecessor_node(AVLTreeNode *node) {
-    if(node == nullptr) {
-        return nullptr;
-    }
+template<class BalancePolicy>
+int BasicAVLTree<BalancePolicy>::get_min() {
+    return map.get_min().value_or(-1);
+}
 
-    // Attempt to get the largest value in the left subtree
-    AVLTreeNode *tmp = get_max_node(node->left);
-    
-    // If tmp is nullptr, then node does not have a right subtree
-    // therefore, the next value will be a parent node
-    if(tmp == nullptr) {
-        tmp = node->parent;
-
-        // If tmp's left child is the current node, then the node is
-        // smaller than tmp, however it will be larger than tmp's parent
-        // So the predecessor must be higher up in the tree
-        while(tmp != nullptr && tmp->left == node) {
-            node = tmp;
-            tmp = tmp->parent;
-        }
-        
-        // By the end of the while loop, tmp will be the proper predecessor to the original input node
-    }
+template<class BalancePolicy>
+int BasicAVLTree<BalancePolicy>::get_max() {
+    return map.get_max().value_or(-1);
+}
 
-    return tmp;
+template<class BalancePolicy>
+int BasicAVLTree<BalancePolicy>::get_predecessor(int key) {
+    return map.get_predecessor(key).value_or(-1);
 }
 
-AVLTreeNode* AVLTree::get_successor_node(AVLTreeNode *node) {
-    if(node == nullptr) {
-        return nullptr;
-    }
+template<class BalancePolicy>
+int BasicAVLTree<BalancePolicy>::get_successor(int key) {
+    return map.get_successor(key).value_or(-1);
+}
 
-    // Attempt to get the smallest value in the right subtree
-    AVLTreeNode *tmp = get_min_node(node->right);
-    
-    // If tmp is nullptr, then node does not have a right subtree
-    // therefore, the next value will be a parent node
-    if(tmp == nullptr) {
-        tmp = node->parent;
-
-        // If tmp's right child is the current node, then the node is
-        // larger than tmp, however it will be less than tmp's parent
-        // So the successor must be higher up in the tree
-        while(tmp != nullptr && tmp->right == node) {
-            node = tmp;
-            tmp = tmp->parent;
-        }
-        
-        // By the end of the while loop, tmp will be the proper successor to the original input node
-    }
+// The bound queries take any key, not only keys in the tree
 
-    return tmp;
+// Data of the first key >= key
+template<class BalancePolicy>
+int BasicAVLTree<BalancePolicy>::lower_bound(int key) {
+    typename Map::const_iterator it = map.lower_bound(key);
+    return (it != map.end()) ? it.value() : -1;
 }
 
-void AVLTree::rec_print_in_order(AVLTreeNode *node) {
-    if(node->left != nullptr) { 
-        rec_print_in_order(node->left);
-    }
-
-    std::cout << node->data << " ";
+// Data of the first key > key
+template<class BalancePolicy>
+int BasicAVLTree<BalancePolicy>::upper_bound(int key) {
+    typename Map::const_iterator it = map.upper_bound(key);
+    return (it != map.end()) ? it.value() : -1;
+}
 
-    if(node->right != nullptr) {
-        rec_print_in_order(node->right);
-    }
+// Data of the last key <= key
+template<class BalancePolicy>
+int BasicAVLTree<BalancePolicy>::floor(int key) {
+    typename Map::const_iterator it = map.floor(key);
+    return (it != map.end()) ? it.value() : -1;
 }
 
-void AVLTree::rec_delete_tree(AVLTreeNode *node) {
-    if(node->left != nullptr) { 
-        rec_delete_tree(node->left);
-    }
+// Data of the first key >= key
+template<class BalancePolicy>
+int BasicAVLTree<BalancePolicy>::ceiling(int key) {
+    typename Map::const_iterator it = map.ceiling(key);
+    return (it != map.end()) ? it.value() : -1;
+}
 
-    delete node;
+template<class BalancePolicy>
+typename BasicAVLTree<BalancePolicy>::iterator BasicAVLTree<BalancePolicy>::begin() const {
+    return map.begin();
+}
 
-    if(node->right != nullptr) {
-        rec_delete_tree(node->right);
-    }
+template<class BalancePolicy>
+typename BasicAVLTree<BalancePolicy>::iterator BasicAVLTree<BalancePolicy>::end() const {
+    return map.end();
 }
 
-void AVLTree::transplant(AVLTreeNode *node1, AVLTreeNode *node2) {
-    if(node1->parent == nullptr) {
-        root = node2;
-    } else if(node1 == node1->parent->left) {
-        node1->parent->left = node2;
-    } else { // node1->parent->right == node1
-        node1->parent->right = node2;
-    }
+// Entries with keys in [lo, hi]
+template<class BalancePolicy>
+typename BasicAVLTree<BalancePolicy>::Map::Range BasicAVLTree<BalancePolicy>::range(int lo, int hi) const {
+    return map.range(lo, hi);
+}
 
-    if(node2 != nullptr) {
-        node2->parent = node1->parent;
+// Every (key, data) pair in key order
+template<class BalancePolicy>
+std::vector<std::pair<int, int>> BasicAVLTree<BalancePolicy>::entries() const {
+    std::vector<std::pair<int, int>> entries;
+    entries.reserve(map.size());
+    for(typename Map::const_iterator it = map.begin(); it != map.end(); ++it) {
+        entries.push_back({it.key(), it.value()});
     }
+    return entries;
 }
 
-void AVLTree::insert(int data) {
-    insert(data, data);
+// Immutable snapshot of the current entries for read-mostly phases
+template<class BalancePolicy>
+FrozenIndex BasicAVLTree<BalancePolicy>::freeze() const {
+    std::vector<std::pair<int, int>> entries = this->entries();
+    return FrozenIndex(entries.data(), entries.data() + entries.size());
 }
 
-void AVLTree::insert(int key, int data) {
-    AVLTreeNode *new_node = new AVLTreeNode;
-    new_node->key  = key;
-    new_node->data = data;
-    new_node->left = new_node->right = nullptr;
-
-    if(root != nullptr) {
-        AVLTreeNode *tmp = root;
-        while((tmp->left != nullptr && tmp->key > key) || (tmp->right != nullptr && tmp->key <= key)) {
-            tmp = (tmp->key > key) ? tmp->left : tmp->right;
-        }
-
-        new_node->parent = tmp;
-        if(tmp->key > key) {
-            tmp->left = new_node;
-        } else {
-            tmp->right = new_node;
-        }
-    } else {
-        new_node->parent = nullptr;
-        root = new_node;
-    }
+// Set operations by key on the shared work-stealing pool, other ends up empty
+template<class BalancePolicy>
+void BasicAVLTree<BalancePolicy>::set_union(BasicAVLTree &other) {
+    map.set_union(other.map, &WorkStealingPool::shared());
 }
 
-int AVLTree::search(int key) {
-    AVLTreeNode *node = search_node(key);
-    if(node != nullptr) {
-        return node->data;
-    }
-    return -1;
+template<class BalancePolicy>
+void BasicAVLTree<BalancePolicy>::set_intersection(BasicAVLTree &other) {
+    map.set_intersection(other.map, &WorkStealingPool::shared());
 }
 
-void AVLTree::remove(int key) {
-    AVLTreeNode *nodeToRemove = search_node(key);
-
-    if(nodeToRemove == nullptr) {
-        return;
-    }
+template<class BalancePolicy>
+void BasicAVLTree<BalancePolicy>::set_difference(BasicAVLTree &other) {
+    map.set_difference(other.map, &WorkStealingPool::shared());
+}
 
-    if(nodeToRemove->left == nullptr) {
-        transplant(nodeToRemove, nodeToRemove->right);
-    } else if (nodeToRemove->right == nullptr) {
-        transplant(nodeToRemove, nodeToRemove->left);
-    } else {
-        AVLTreeNode *nodeToReplace = get_min_node(nodeToRemove->right);
-
-        if(nodeToReplace->parent != nodeToRemove) {
-            transplant(nodeToReplace, nodeToReplace->right);
-            nodeToReplace->right = nodeToRemove->right;
-            nodeToReplace->right->parent = nodeToReplace;
-        }
-
-        transplant(nodeToRemove, nodeToReplace);
-        nodeToReplace->left = nodeToRemove->left;
-        nodeToReplace->left->parent = nodeToReplace;
-    }
+// Becomes left, then pivot, then right, which end up empty. O(log n) when
+// left's keys are not above pivot and right's are not below it
+template<class BalancePolicy>
+void BasicAVLTree<BalancePolicy>::join(BasicAVLTree &left, int pivot, BasicAVLTree &right) {
+    map.join(left.map, pivot, pivot, right.map);
+}
 
+// Counters are only kept when built with -DTREE_STATS, size is always
+// reported and the O(n) height when with_height is set
+template<class BalancePolicy>
+TreeStatsSnapshot BasicAVLTree<BalancePolicy>::stats(bool with_height) const {
+    return map.stats(with_height);
 }
 
-int AVLTree::get_max() {
-    if(root != nullptr) {
-        return get_max_node(root)->data;
-    }
+template<class BalancePolicy>
+void BasicAVLTree<BalancePolicy>::reset_stats() {
+    map.reset_stats();
+}
 
-    return -1;
+template<class BalancePolicy>
+void BasicAVLTree<BalancePolicy>::print_in_order() {
+    std::cout << "Printing AVL Tree inorder: ";
+    map.print_in_order(std::cout);
+    std::cout << std::endl;
 }
 
-int AVLTree::get_min() {
-    if(root != nullptr) {
-        return get_min_node(root)->data;
-    }
+// The two trees avl_tree.hpp names
+template class BasicAVLTree<AVLBalance>;
+template class BasicAVLTree<OrderStatistics<AVLBalance>>;
 
-    return -1;
+// Number of keys less than key
+size_t RankedAVLTree::rank(int key) {
+    return map.rank(key);
 }
 
-int AVLTree::get_predecessor(int key) {
-    AVLTreeNode *node = search_node(key);
-    if(node != nullptr) {
-        AVLTreeNode *predecessor_node = get_predecessor_node(node);
-
-        return (predecessor_node != nullptr) ? predecessor_node->data : -1;
-    }
-    return -1;
+// The k-th smallest key, counting from 0
+int RankedAVLTree::select(size_t k) {
+    Map::const_iterator it = map.select(k);
+    return (it != map.end()) ? it.key() : -1;
 }
 
-int AVLTree::get_successor(int key) {
-    AVLTreeNode *node = search_node(key);
-    if(node != nullptr) {
-        AVLTreeNode *successor_node = get_successor_node(node);
+// Number of keys in [lo, hi]
+size_t RankedAVLTree::count_range(int lo, int hi) {
+    return map.count_range(lo, hi);
+}
 
-        return (successor_node != nullptr) ? successor_node->data : -1;
-    }
-    return node->data;
+// Keeps the keys below key and moves the rest into upper, in O(log n)
+void RankedAVLTree::split(int key, RankedAVLTree &upper) {
+    map.split(key, upper.map);
 }
 
-void AVLTree::print_in_order() {
-    std::cout << "Printing BST inorder: ";
-    rec_print_in_order(root);
-    std::cout << std::endl;
-}
\ No newline at end of file
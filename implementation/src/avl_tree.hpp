@@ -1,38 +1,63 @@
 #pragma once
 
-struct AVLTreeNode {
-    int key;
-    int data;
-    AVLTreeNode *left;
-    AVLTreeNode *right;
-    AVLTreeNode *parent;
-    int height;
-};
+#include <utility>
+#include <vector>
+
+#include "frozen_index.hpp"
+#include "ordered_map.hpp"
 
-class AVLTree {
-    private:
-        AVLTreeNode *root;
-    
-        AVLTreeNode* search_node(int key);
-        AVLTreeNode* get_min_node(AVLTreeNode *node);
-        AVLTreeNode* get_max_node(AVLTreeNode *node);
-        AVLTreeNode* get_predecessor_node(AVLTreeNode *node);
-        AVLTreeNode* get_successor_node(AVLTreeNode *node);
-        void rec_print_in_order(AVLTreeNode *node);
-        void rec_delete_tree(AVLTreeNode *node);
-        void transplant(AVLTreeNode *node1, AVLTreeNode *node2);
-        
+// Int AVL tree over BalancePolicy, AVLBalance or the OrderStatistics
+// wrapper around it. Use AVLTree, or RankedAVLTree for the queries that
+// need subtree sizes
+template<class BalancePolicy>
+class BasicAVLTree {
     public:
-        AVLTree();
-        ~AVLTree();
+        typedef OrderedMap<int, int, std::less<int>, BalancePolicy, PointerLayout<>, IntTreeStats> Map;
+        typedef typename Map::const_iterator iterator;
+
+    protected:
+        Map map;
 
+    public:
         int  search(int key);
+        bool contains(int key);
+        void search_batch(const int *keys, int *out, size_t n);
         void insert(int data);
         void insert(int key, int data);
+        void build_from_sorted(const std::pair<int, int> *begin, const std::pair<int, int> *end);
         void remove(int key);
         int  get_min();
         int  get_max();
         int  get_predecessor(int key);
         int  get_successor(int key);
+        int  lower_bound(int key);
+        int  upper_bound(int key);
+        int  floor(int key);
+        int  ceiling(int key);
+        iterator begin() const;
+        iterator end() const;
+        typename Map::Range range(int lo, int hi) const;
+        std::vector<std::pair<int, int>> entries() const;
+        FrozenIndex freeze() const;
+        TreeStatsSnapshot stats(bool with_height = false) const;
+        void reset_stats();
+        void set_union(BasicAVLTree &other);
+        void set_intersection(BasicAVLTree &other);
+        void set_difference(BasicAVLTree &other);
+        void join(BasicAVLTree &left, int pivot, BasicAVLTree &right);
         void print_in_order();
-};
\ No newline at end of file
+};
+
+// Plain AVL tree, nodes hold no subtree sizes
+typedef BasicAVLTree<AVLBalance> AVLTree;
+
+// Keeps the size of every subtree in its node, 8 more bytes per node and a
+// walk up to the root on every insert and remove, for rank, select,
+// count_range and split in O(log n)
+class RankedAVLTree : public BasicAVLTree<OrderStatistics<AVLBalance>> {
+    public:
+        size_t rank(int key);
+        int    select(size_t k);
+        size_t count_range(int lo, int hi);
+        void   split(int key, RankedAVLTree &upper);
+};
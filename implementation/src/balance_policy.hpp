@@ -0,0 +1,698 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+
+// Balancing policies for OrderedMap. Each policy keeps its balance state in
+// the 2-bit node tag, may add other per-node fields in NodeData, and
+// supplies hooks that OrderedMap calls after every structural change:
+// - after_rotate(tree, node, target): target was rotated into node's place
+// - after_insert(tree, node): node was just linked in as a leaf
+// - after_remove(tree, node, parent, left_side, removed_tag): a node tagged
+//   removed_tag was spliced out, node (possibly nil) took its place as the
+//   left (left_side) or right child of parent
+// - after_build(tree, node, depth, max_depth, left_height, right_height):
+//   node's subtrees were built from sorted input, every level but the
+//   deepest (max_depth) is full and the subtrees have the given heights
+// - after_attach(tree, node): a join or split gave node new children
+// - after_join(tree, root): root is the root of a whole tree put together
+//   by joins and splits
+// Splits and joins also need:
+// - rank(tree, root): the balance measure of a subtree (black height,
+//   height), 0 for an empty one
+// - child_rank(tree, node, rank, left_side): the rank of node's left or
+//   right child, given node's
+// - join(tree, left, left_rank, pivot, right, right_rank, rank): links two
+//   detached subtrees, every key of left before pivot's and every key of
+//   right after it, into one balanced subtree, and returns its root and rank
+// Joins rebuild nodes only through tree.attach(left, node, right).
+// Nodes are reached through the tree's accessors (left, right, parent, tag,
+// data and their setters), so the same policy works for every node layout.
+// Rebalancing loops report each pass to tree.counters.
+
+enum NodeColor : unsigned char {
+    black, red
+};
+
+// Plain binary search tree, nodes stay wherever insertion puts them
+struct NoBalance {
+    struct NodeData {};
+
+    template<class Tree>
+    static void after_rotate(Tree &, typename Tree::NodeRef, typename Tree::NodeRef) {}
+
+    template<class Tree>
+    static void after_insert(Tree &, typename Tree::NodeRef) {}
+
+    template<class Tree>
+    static void after_remove(Tree &, typename Tree::NodeRef, typename Tree::NodeRef, bool, unsigned) {}
+
+    template<class Tree>
+    static void after_build(Tree &, typename Tree::NodeRef, int, int, int, int) {}
+
+    template<class Tree>
+    static void after_attach(Tree &, typename Tree::NodeRef) {}
+
+    template<class Tree>
+    static void after_join(Tree &, typename Tree::NodeRef) {}
+
+    template<class Tree>
+    static int rank(const Tree &, typename Tree::NodeRef) {
+        return 0;
+    }
+
+    template<class Tree>
+    static int child_rank(const Tree &, typename Tree::NodeRef, int, bool) {
+        return 0;
+    }
+
+    template<class Tree>
+    static typename Tree::NodeRef join(Tree &tree, typename Tree::NodeRef left, int, typename Tree::NodeRef pivot,
+                                       typename Tree::NodeRef right, int, int &rank) {
+        rank = 0;
+        return tree.attach(left, pivot, right);
+    }
+};
+
+// The node tag is the NodeColor
+struct RedBlackBalance {
+    struct NodeData {};
+
+    // Empty (nil) leaves count as black
+    template<class Tree>
+    static bool is_black(const Tree &tree, typename Tree::NodeRef node) {
+        return node == Tree::nil || tree.tag(node) == NodeColor::black;
+    }
+
+    template<class Tree>
+    static bool is_red(const Tree &tree, typename Tree::NodeRef node) {
+        return !is_black(tree, node);
+    }
+
+    template<class Tree>
+    static void set_color(Tree &tree, typename Tree::NodeRef node, NodeColor color) {
+        tree.set_tag(node, color);
+    }
+
+    template<class Tree>
+    static void after_rotate(Tree &, typename Tree::NodeRef, typename Tree::NodeRef) {}
+
+    // Every level above the deepest is full, so painting the deepest level
+    // red leaves each path with the same number of black nodes
+    template<class Tree>
+    static void after_build(Tree &tree, typename Tree::NodeRef node, int depth, int max_depth, int, int) {
+        set_color(tree, node, (depth == max_depth && depth > 0) ? NodeColor::red : NodeColor::black);
+    }
+
+    template<class Tree>
+    static void after_attach(Tree &, typename Tree::NodeRef) {}
+
+    // Insertion relies on a black root
+    template<class Tree>
+    static void after_join(Tree &tree, typename Tree::NodeRef root) {
+        set_color(tree, root, NodeColor::black);
+    }
+
+    // The rank is the black height: black nodes on every path from the
+    // subtree's root down to a leaf, the root included
+    template<class Tree>
+    static int rank(const Tree &tree, typename Tree::NodeRef node) {
+        int black_height = 0;
+        for(; node != Tree::nil; node = tree.left(node)) {
+            black_height += is_black(tree, node);
+        }
+        return black_height;
+    }
+
+    template<class Tree>
+    static int child_rank(const Tree &tree, typename Tree::NodeRef node, int rank, bool) {
+        return rank - is_black(tree, node);
+    }
+
+    // Walks down the right spine of left to a black node as high in black
+    // nodes as right and puts pivot, red, in its place with right beside it.
+    // A red pivot under a red parent is lifted by a rotation on the way back
+    // up, as in Blelloch, Ferizovic and Sun's join. The black height stays
+    // left_rank
+    template<class Tree>
+    static typename Tree::NodeRef join_right(Tree &tree, typename Tree::NodeRef left, int left_rank, typename Tree::NodeRef pivot,
+                                             typename Tree::NodeRef right, int right_rank) {
+        typedef typename Tree::NodeRef NodeRef;
+
+        if(is_black(tree, left) && left_rank == right_rank) {
+            set_color(tree, pivot, NodeColor::red);
+            return tree.attach(left, pivot, right);
+        }
+
+        NodeRef joined = join_right(tree, tree.right(left), child_rank(tree, left, left_rank, false), pivot, right, right_rank);
+        tree.attach(tree.left(left), left, joined);
+
+        if(is_black(tree, left) && is_red(tree, joined) && is_red(tree, tree.right(joined))) {
+            set_color(tree, tree.right(joined), NodeColor::black);
+            NodeRef moved = tree.left(joined);
+            NodeRef outer = tree.right(joined);
+            return tree.attach(tree.attach(tree.left(left), left, moved), joined, outer);
+        }
+        return left;
+    }
+
+    template<class Tree>
+    static typename Tree::NodeRef join_left(Tree &tree, typename Tree::NodeRef left, int left_rank, typename Tree::NodeRef pivot,
+                                            typename Tree::NodeRef right, int right_rank) {
+        typedef typename Tree::NodeRef NodeRef;
+
+        if(is_black(tree, right) && left_rank == right_rank) {
+            set_color(tree, pivot, NodeColor::red);
+            return tree.attach(left, pivot, right);
+        }
+
+        NodeRef joined = join_left(tree, left, left_rank, pivot, tree.left(right), child_rank(tree, right, right_rank, true));
+        tree.attach(joined, right, tree.right(right));
+
+        if(is_black(tree, right) && is_red(tree, joined) && is_red(tree, tree.left(joined))) {
+            set_color(tree, tree.left(joined), NodeColor::black);
+            NodeRef moved = tree.right(joined);
+            NodeRef outer = tree.left(joined);
+            return tree.attach(outer, joined, tree.attach(moved, right, tree.right(right)));
+        }
+        return right;
+    }
+
+    // The result's root is always black, so it is a valid tree on its own
+    template<class Tree>
+    static typename Tree::NodeRef join(Tree &tree, typename Tree::NodeRef left, int left_rank, typename Tree::NodeRef pivot,
+                                       typename Tree::NodeRef right, int right_rank, int &rank) {
+        typedef typename Tree::NodeRef NodeRef;
+
+        NodeRef root;
+        if(left_rank > right_rank) {
+            root = join_right(tree, left, left_rank, pivot, right, right_rank);
+            rank = left_rank;
+        } else if(right_rank > left_rank) {
+            root = join_left(tree, left, left_rank, pivot, right, right_rank);
+            rank = right_rank;
+        } else {
+            set_color(tree, pivot, NodeColor::black);
+            root = tree.attach(left, pivot, right);
+            rank = left_rank + 1;
+            return root;
+        }
+
+        if(is_red(tree, root)) {
+            set_color(tree, root, NodeColor::black);
+            rank++;
+        }
+        return root;
+    }
+
+    template<class Tree>
+    static void after_insert(Tree &tree, typename Tree::NodeRef node) {
+        typedef typename Tree::NodeRef NodeRef;
+
+        set_color(tree, node, NodeColor::red);
+
+        while(is_red(tree, tree.parent(node))) {
+            tree.counters.insert_fixup_step();
+
+            // A red parent is never the root, so the grandparent exists
+            NodeRef parent = tree.parent(node);
+            NodeRef grandparent = tree.parent(parent);
+
+            if(parent == tree.left(grandparent)) {
+                NodeRef tmp = tree.right(grandparent);
+
+                if(is_red(tree, tmp)) {
+                    set_color(tree, parent, NodeColor::black);
+                    set_color(tree, tmp, NodeColor::black);
+                    set_color(tree, grandparent, NodeColor::red);
+                    node = grandparent;
+                } else {
+                    if(node == tree.right(parent)) {
+                        node = parent;
+                        tree.left_rotate(node);
+                        parent = tree.parent(node);
+                    }
+
+                    set_color(tree, parent, NodeColor::black);
+                    set_color(tree, grandparent, NodeColor::red);
+                    tree.right_rotate(grandparent);
+                }
+            } else {
+                NodeRef tmp = tree.left(grandparent);
+
+                if(is_red(tree, tmp)) {
+                    set_color(tree, parent, NodeColor::black);
+                    set_color(tree, tmp, NodeColor::black);
+                    set_color(tree, grandparent, NodeColor::red);
+                    node = grandparent;
+                } else {
+                    if(node == tree.left(parent)) {
+                        node = parent;
+                        tree.right_rotate(node);
+                        parent = tree.parent(node);
+                    }
+
+                    set_color(tree, parent, NodeColor::black);
+                    set_color(tree, grandparent, NodeColor::red);
+                    tree.left_rotate(grandparent);
+                }
+            }
+        }
+
+        set_color(tree, tree.root, NodeColor::black);
+    }
+
+    template<class Tree>
+    static void after_remove(Tree &tree, typename Tree::NodeRef node, typename Tree::NodeRef parent, bool, unsigned removed_tag) {
+        typedef typename Tree::NodeRef NodeRef;
+
+        // Removing a red node never changes a black height
+        if(removed_tag == NodeColor::red) {
+            return;
+        }
+
+        while(node != tree.root && is_black(tree, node)) {
+            tree.counters.remove_fixup_step();
+
+            if(node == tree.left(parent)) {
+                NodeRef tmp = tree.right(parent);
+
+                if(is_red(tree, tmp)) {
+                    set_color(tree, tmp, NodeColor::black);
+                    set_color(tree, parent, NodeColor::red);
+                    tree.left_rotate(parent);
+                    tmp = tree.right(parent);
+                }
+                if(is_black(tree, tree.left(tmp)) && is_black(tree, tree.right(tmp))) {
+                    set_color(tree, tmp, NodeColor::red);
+                    node = parent;
+                    parent = tree.parent(node);
+                } else {
+                    if(is_black(tree, tree.right(tmp))) {
+                        set_color(tree, tree.left(tmp), NodeColor::black);
+                        set_color(tree, tmp, NodeColor::red);
+                        tree.right_rotate(tmp);
+                        tmp = tree.right(parent);
+                    }
+                    set_color(tree, tmp, (NodeColor)tree.tag(parent));
+                    set_color(tree, parent, NodeColor::black);
+                    set_color(tree, tree.right(tmp), NodeColor::black);
+                    tree.left_rotate(parent);
+                    node = tree.root;
+                }
+            } else {
+                NodeRef tmp = tree.left(parent);
+
+                if(is_red(tree, tmp)) {
+                    set_color(tree, tmp, NodeColor::black);
+                    set_color(tree, parent, NodeColor::red);
+                    tree.right_rotate(parent);
+                    tmp = tree.left(parent);
+                }
+                if(is_black(tree, tree.left(tmp)) && is_black(tree, tree.right(tmp))) {
+                    set_color(tree, tmp, NodeColor::red);
+                    node = parent;
+                    parent = tree.parent(node);
+                } else {
+                    if(is_black(tree, tree.left(tmp))) {
+                        set_color(tree, tree.right(tmp), NodeColor::black);
+                        set_color(tree, tmp, NodeColor::red);
+                        tree.left_rotate(tmp);
+                        tmp = tree.left(parent);
+                    }
+                    set_color(tree, tmp, (NodeColor)tree.tag(parent));
+                    set_color(tree, parent, NodeColor::black);
+                    set_color(tree, tree.left(tmp), NodeColor::black);
+                    tree.right_rotate(parent);
+                    node = tree.root;
+                }
+            }
+        }
+
+        if(node != Tree::nil) {
+            set_color(tree, node, NodeColor::black);
+        }
+    }
+};
+
+// The node tag is the balance factor, the right subtree's height minus the
+// left's, so no node stores its height
+struct AVLBalance {
+    struct NodeData {};
+
+    enum BalanceTag : unsigned {
+        balanced, left_heavy, right_heavy
+    };
+
+    template<class Tree>
+    static int balance(const Tree &tree, typename Tree::NodeRef node) {
+        unsigned tag = tree.tag(node);
+        return (tag == left_heavy) ? -1 : (tag == right_heavy) ? 1 : 0;
+    }
+
+    template<class Tree>
+    static void set_balance(Tree &tree, typename Tree::NodeRef node, int balance) {
+        tree.set_tag(node, (balance < 0) ? left_heavy : (balance > 0) ? right_heavy : balanced);
+    }
+
+    // Balance factors are set by rotate_heavy, which knows the whole case
+    template<class Tree>
+    static void after_rotate(Tree &, typename Tree::NodeRef, typename Tree::NodeRef) {}
+
+    template<class Tree>
+    static void after_build(Tree &tree, typename Tree::NodeRef node, int, int, int left_height, int right_height) {
+        set_balance(tree, node, right_height - left_height);
+    }
+
+    // node is two levels heavier on heavy_child's side. Rotates heavy_child
+    // (or its inner child for the double rotation) into node's place and
+    // returns the new root of the subtree
+    template<class Tree>
+    static typename Tree::NodeRef rotate_heavy(Tree &tree, typename Tree::NodeRef node, typename Tree::NodeRef heavy_child) {
+        typedef typename Tree::NodeRef NodeRef;
+
+        if(heavy_child == tree.right(node)) {
+            if(balance(tree, heavy_child) < 0) {
+                // Right-left case
+                NodeRef middle = tree.left(heavy_child);
+                int middle_balance = balance(tree, middle);
+                tree.right_rotate(heavy_child);
+                tree.left_rotate(node);
+                set_balance(tree, node, (middle_balance > 0) ? -1 : 0);
+                set_balance(tree, heavy_child, (middle_balance < 0) ? 1 : 0);
+                set_balance(tree, middle, 0);
+                return middle;
+            }
+
+            // Right-right case, heavy_child is only balanced after a removal
+            bool was_balanced = balance(tree, heavy_child) == 0;
+            tree.left_rotate(node);
+            set_balance(tree, node, was_balanced ? 1 : 0);
+            set_balance(tree, heavy_child, was_balanced ? -1 : 0);
+            return heavy_child;
+        }
+
+        if(balance(tree, heavy_child) > 0) {
+            // Left-right case
+            NodeRef middle = tree.right(heavy_child);
+            int middle_balance = balance(tree, middle);
+            tree.left_rotate(heavy_child);
+            tree.right_rotate(node);
+            set_balance(tree, node, (middle_balance < 0) ? 1 : 0);
+            set_balance(tree, heavy_child, (middle_balance > 0) ? -1 : 0);
+            set_balance(tree, middle, 0);
+            return middle;
+        }
+
+        // Left-left case
+        bool was_balanced = balance(tree, heavy_child) == 0;
+        tree.right_rotate(node);
+        set_balance(tree, node, was_balanced ? -1 : 0);
+        set_balance(tree, heavy_child, was_balanced ? 1 : 0);
+        return heavy_child;
+    }
+
+    template<class Tree>
+    static void after_attach(Tree &, typename Tree::NodeRef) {}
+
+    template<class Tree>
+    static void after_join(Tree &, typename Tree::NodeRef) {}
+
+    // The rank is the height, found by following the taller side down
+    template<class Tree>
+    static int rank(const Tree &tree, typename Tree::NodeRef node) {
+        int height = 0;
+        for(; node != Tree::nil; node = (balance(tree, node) < 0) ? tree.left(node) : tree.right(node)) {
+            height++;
+        }
+        return height;
+    }
+
+    template<class Tree>
+    static int child_rank(const Tree &tree, typename Tree::NodeRef node, int rank, bool left_side) {
+        int node_balance = balance(tree, node);
+        return rank - 1 - ((left_side ? node_balance > 0 : node_balance < 0) ? 1 : 0);
+    }
+
+    // Links left, node and right, which differ in height by at most one,
+    // and returns the height of the result
+    template<class Tree>
+    static int link(Tree &tree, typename Tree::NodeRef left, int left_height, typename Tree::NodeRef node,
+                    typename Tree::NodeRef right, int right_height) {
+        tree.attach(left, node, right);
+        set_balance(tree, node, right_height - left_height);
+        return 1 + std::max(left_height, right_height);
+    }
+
+    // Walks down the right spine of left to a node no more than one level
+    // taller than right and links pivot there, then rotates on the way back
+    // up wherever a node became two levels heavier on the right, as in
+    // Blelloch, Ferizovic and Sun's join. Heights are tracked on the way, no
+    // node stores one
+    template<class Tree>
+    static typename Tree::NodeRef join_right(Tree &tree, typename Tree::NodeRef left, int left_height, typename Tree::NodeRef pivot,
+                                             typename Tree::NodeRef right, int right_height, int &height) {
+        typedef typename Tree::NodeRef NodeRef;
+
+        NodeRef outer = tree.left(left);
+        NodeRef inner = tree.right(left);
+        int outer_height = child_rank(tree, left, left_height, true);
+        int inner_height = child_rank(tree, left, left_height, false);
+
+        if(inner_height <= right_height + 1) {
+            if(std::max(inner_height, right_height) + 1 <= outer_height + 1) {
+                int joined_height = link(tree, inner, inner_height, pivot, right, right_height);
+                height = link(tree, outer, outer_height, left, pivot, joined_height);
+                return left;
+            }
+
+            // pivot would sit two levels above outer, so inner's root, which
+            // is taller than right, goes on top
+            NodeRef middle = inner;
+            NodeRef middle_left = tree.left(middle);
+            NodeRef middle_right = tree.right(middle);
+            int middle_left_height = child_rank(tree, middle, inner_height, true);
+            int middle_right_height = child_rank(tree, middle, inner_height, false);
+
+            int lower_left = link(tree, outer, outer_height, left, middle_left, middle_left_height);
+            int lower_right = link(tree, middle_right, middle_right_height, pivot, right, right_height);
+            height = link(tree, left, lower_left, middle, pivot, lower_right);
+            return middle;
+        }
+
+        int joined_height;
+        NodeRef joined = join_right(tree, inner, inner_height, pivot, right, right_height, joined_height);
+        if(joined_height <= outer_height + 1) {
+            height = link(tree, outer, outer_height, left, joined, joined_height);
+            return left;
+        }
+
+        // One left rotation brings joined up
+        NodeRef moved = tree.left(joined);
+        NodeRef far = tree.right(joined);
+        int moved_height = child_rank(tree, joined, joined_height, true);
+        int far_height = child_rank(tree, joined, joined_height, false);
+        int lower = link(tree, outer, outer_height, left, moved, moved_height);
+        height = link(tree, left, lower, joined, far, far_height);
+        return joined;
+    }
+
+    // Mirror image of join_right
+    template<class Tree>
+    static typename Tree::NodeRef join_left(Tree &tree, typename Tree::NodeRef left, int left_height, typename Tree::NodeRef pivot,
+                                            typename Tree::NodeRef right, int right_height, int &height) {
+        typedef typename Tree::NodeRef NodeRef;
+
+        NodeRef outer = tree.right(right);
+        NodeRef inner = tree.left(right);
+        int outer_height = child_rank(tree, right, right_height, false);
+        int inner_height = child_rank(tree, right, right_height, true);
+
+        if(inner_height <= left_height + 1) {
+            if(std::max(inner_height, left_height) + 1 <= outer_height + 1) {
+                int joined_height = link(tree, left, left_height, pivot, inner, inner_height);
+                height = link(tree, pivot, joined_height, right, outer, outer_height);
+                return right;
+            }
+
+            NodeRef middle = inner;
+            NodeRef middle_left = tree.left(middle);
+            NodeRef middle_right = tree.right(middle);
+            int middle_left_height = child_rank(tree, middle, inner_height, true);
+            int middle_right_height = child_rank(tree, middle, inner_height, false);
+
+            int lower_right = link(tree, middle_right, middle_right_height, right, outer, outer_height);
+            int lower_left = link(tree, left, left_height, pivot, middle_left, middle_left_height);
+            height = link(tree, pivot, lower_left, middle, right, lower_right);
+            return middle;
+        }
+
+        int joined_height;
+        NodeRef joined = join_left(tree, left, left_height, pivot, inner, inner_height, joined_height);
+        if(joined_height <= outer_height + 1) {
+            height = link(tree, joined, joined_height, right, outer, outer_height);
+            return right;
+        }
+
+        NodeRef moved = tree.right(joined);
+        NodeRef far = tree.left(joined);
+        int moved_height = child_rank(tree, joined, joined_height, false);
+        int far_height = child_rank(tree, joined, joined_height, true);
+        int lower = link(tree, moved, moved_height, right, outer, outer_height);
+        height = link(tree, far, far_height, joined, right, lower);
+        return joined;
+    }
+
+    template<class Tree>
+    static typename Tree::NodeRef join(Tree &tree, typename Tree::NodeRef left, int left_rank, typename Tree::NodeRef pivot,
+                                       typename Tree::NodeRef right, int right_rank, int &rank) {
+        if(left_rank > right_rank + 1) {
+            return join_right(tree, left, left_rank, pivot, right, right_rank, rank);
+        }
+        if(right_rank > left_rank + 1) {
+            return join_left(tree, left, left_rank, pivot, right, right_rank, rank);
+        }
+        rank = link(tree, left, left_rank, pivot, right, right_rank);
+        return pivot;
+    }
+
+    // Walk up while the subtree below keeps growing. A rotation brings the
+    // subtree back to its old height, so it ends the walk
+    template<class Tree>
+    static void after_insert(Tree &tree, typename Tree::NodeRef child) {
+        for(typename Tree::NodeRef node = tree.parent(child); node != Tree::nil; child = node, node = tree.parent(node)) {
+            tree.counters.insert_fixup_step();
+            int grown_side = (child == tree.left(node)) ? -1 : 1;
+            int node_balance = balance(tree, node);
+
+            if(node_balance == 0) {
+                set_balance(tree, node, grown_side);
+            } else if(node_balance != grown_side) {
+                set_balance(tree, node, 0);
+                return;
+            } else {
+                rotate_heavy(tree, node, child);
+                return;
+            }
+        }
+    }
+
+    // Walk up while the subtree below keeps shrinking
+    template<class Tree>
+    static void after_remove(Tree &tree, typename Tree::NodeRef, typename Tree::NodeRef node, bool left_side, unsigned) {
+        typedef typename Tree::NodeRef NodeRef;
+
+        while(node != Tree::nil) {
+            tree.counters.remove_fixup_step();
+            NodeRef above = tree.parent(node);
+            bool node_is_left = above != Tree::nil && tree.left(above) == node;
+            int shrunk_side = left_side ? -1 : 1;
+            int node_balance = balance(tree, node);
+
+            if(node_balance == 0) {
+                // The other side is now taller, the height stays the same
+                set_balance(tree, node, -shrunk_side);
+                return;
+            }
+
+            if(node_balance == shrunk_side) {
+                set_balance(tree, node, 0);
+            } else {
+                NodeRef heavy_child = left_side ? tree.right(node) : tree.left(node);
+                bool heavy_was_balanced = balance(tree, heavy_child) == 0;
+                rotate_heavy(tree, node, heavy_child);
+
+                if(heavy_was_balanced) {
+                    return;
+                }
+            }
+
+            left_side = node_is_left;
+            node = above;
+        }
+    }
+};
+
+// Wraps Policy and keeps the size of every subtree in NodeData, so the tree
+// can answer rank and select queries in O(log n). Sizes are fixed up before
+// the wrapped policy's hooks run, and every rotation they make repairs the
+// sizes of the two nodes it moves
+template<class Policy>
+struct OrderStatistics {
+    typedef Policy Base;
+
+    struct NodeData : Policy::NodeData {
+        size_t size;
+    };
+
+    template<class Tree>
+    static size_t subtree_size(const Tree &tree, typename Tree::NodeRef node) {
+        return (node == Tree::nil) ? 0 : tree.data(node).size;
+    }
+
+    template<class Tree>
+    static void update_size(Tree &tree, typename Tree::NodeRef node) {
+        tree.data(node).size = subtree_size(tree, tree.left(node)) + subtree_size(tree, tree.right(node)) + 1;
+    }
+
+    // target took over node's whole subtree, node lost target's other side
+    template<class Tree>
+    static void after_rotate(Tree &tree, typename Tree::NodeRef node, typename Tree::NodeRef target) {
+        tree.data(target).size = tree.data(node).size;
+        update_size(tree, node);
+        Policy::after_rotate(tree, node, target);
+    }
+
+    template<class Tree>
+    static void after_insert(Tree &tree, typename Tree::NodeRef node) {
+        tree.data(node).size = 1;
+        for(typename Tree::NodeRef tmp = tree.parent(node); tmp != Tree::nil; tmp = tree.parent(tmp)) {
+            tree.data(tmp).size++;
+        }
+        Policy::after_insert(tree, node);
+    }
+
+    // Every subtree from parent up lost one node. A successor moved into the
+    // removed node's place took over its size and is on this path too
+    template<class Tree>
+    static void after_remove(Tree &tree, typename Tree::NodeRef node, typename Tree::NodeRef parent, bool left_side, unsigned removed_tag) {
+        for(typename Tree::NodeRef tmp = parent; tmp != Tree::nil; tmp = tree.parent(tmp)) {
+            tree.data(tmp).size--;
+        }
+        Policy::after_remove(tree, node, parent, left_side, removed_tag);
+    }
+
+    template<class Tree>
+    static void after_build(Tree &tree, typename Tree::NodeRef node, int depth, int max_depth, int left_height, int right_height) {
+        update_size(tree, node);
+        Policy::after_build(tree, node, depth, max_depth, left_height, right_height);
+    }
+
+    // Joins rebuild bottom-up, so the children's sizes are already right
+    template<class Tree>
+    static void after_attach(Tree &tree, typename Tree::NodeRef node) {
+        update_size(tree, node);
+        Policy::after_attach(tree, node);
+    }
+
+    template<class Tree>
+    static void after_join(Tree &tree, typename Tree::NodeRef root) {
+        Policy::after_join(tree, root);
+    }
+
+    template<class Tree>
+    static int rank(const Tree &tree, typename Tree::NodeRef node) {
+        return Policy::rank(tree, node);
+    }
+
+    template<class Tree>
+    static int child_rank(const Tree &tree, typename Tree::NodeRef node, int rank, bool left_side) {
+        return Policy::child_rank(tree, node, rank, left_side);
+    }
+
+    template<class Tree>
+    static typename Tree::NodeRef join(Tree &tree, typename Tree::NodeRef left, int left_rank, typename Tree::NodeRef pivot,
+                                       typename Tree::NodeRef right, int right_rank, int &rank) {
+        return Policy::join(tree, left, left_rank, pivot, right, right_rank, rank);
+    }
+};
@@ -1,245 +1,122 @@
 #include <iostream>
+#include <vector>
 
 #include "binary_search_tree.hpp"
 
-BinarySearchTree::BinarySearchTree() {
-    root = nullptr;
-}
+// Missing keys and empty trees are reported as -1
 
-BinarySearchTree::~BinarySearchTree() {
-    rec_delete_tree(root);
+int BinarySearchTree::search(int key) {
+    return map.search(key).value_or(-1);
 }
 
-BinaryTreeNode* BinarySearchTree::search_node(int key) {
-    BinaryTreeNode *tmp = root;
-    while(tmp != nullptr && tmp->key != key) {
-        tmp = (tmp->key > key) ? tmp->left : tmp->right;
-    }
-
-    if(tmp != nullptr && tmp->key == key) {
-        return tmp;
-    }
-
-    return nullptr;
+bool BinarySearchTree::contains(int key) {
+    return map.contains(key);
 }
 
-BinaryTreeNode* BinarySearchTree::get_min_node(BinaryTreeNode *node) {
-    if(node == nullptr) {
-        return nullptr;
-    }
-
-    while(node->left != nullptr) {
-        node = node->left;
-    }
-
-    return node;
+void BinarySearchTree::search_batch(const int *keys, int *out, size_t n) {
+    map.search_batch(keys, out, n, -1);
 }
 
-BinaryTreeNode* BinarySearchTree::get_max_node(BinaryTreeNode *node) {
-    if(node == nullptr) {
-        return nullptr;
-    }
-
-    while(node->right != nullptr) {
-        node = node->right;
-    }
-
-    return node;
+void BinarySearchTree::insert(int data) {
+    insert(data, data);
 }
 
-BinaryTreeNode* BinarySearchTree::get_predecessor_node(BinaryTreeNode *node) {
-    if(node == nullptr) {
-        return nullptr;
-    }
-
-    // Attempt to get the largest value in the left subtree
-    BinaryTreeNode *tmp = get_max_node(node->left);
-    
-    // If tmp is nullptr, then node does not have a right subtree
-    // therefore, the next value will be a parent node
-    if(tmp == nullptr) {
-        tmp = node->parent;
-
-        // If tmp's left child is the current node, then the node is
-        // smaller than tmp, however it will be larger than tmp's parent
-        // So the predecessor must be higher up in the tree
-        while(tmp != nullptr && tmp->left == node) {
-            node = tmp;
-            tmp = tmp->parent;
-        }
-        
-        // By the end of the while loop, tmp will be the proper predecessor to the original input node
-    }
-
-    return tmp;
+void BinarySearchTree::insert(int key, int data) {
+    map.insert(key, data);
 }
 
-BinaryTreeNode* BinarySearchTree::get_successor_node(BinaryTreeNode *node) {
-    if(node == nullptr) {
-        return nullptr;
-    }
-
-    // Attempt to get the smallest value in the right subtree
-    BinaryTreeNode *tmp = get_min_node(node->right);
-    
-    // If tmp is nullptr, then node does not have a right subtree
-    // therefore, the next value will be a parent node
-    if(tmp == nullptr) {
-        tmp = node->parent;
-
-        // If tmp's right child is the current node, then the node is
-        // larger than tmp, however it will be less than tmp's parent
-        // So the successor must be higher up in the tree
-        while(tmp != nullptr && tmp->right == node) {
-            node = tmp;
-            tmp = tmp->parent;
-        }
-        
-        // By the end of the while loop, tmp will be the proper successor to the original input node
-    }
-
-    return tmp;
+// Replaces the tree with the (key, data) pairs in [begin, end), sorted by key
+void BinarySearchTree::build_from_sorted(const std::pair<int, int> *begin, const std::pair<int, int> *end) {
+    map.build_from_sorted(begin, end);
 }
 
-void BinarySearchTree::rec_print_in_order(BinaryTreeNode *node) {
-    if(node->left != nullptr) { 
-        rec_print_in_order(node->left);
-    }
-
-    std::cout << node->data << " ";
+void BinarySearchTree::remove(int key) {
+    map.remove(key);
+}
 
-    if(node->right != nullptr) {
-        rec_print_in_order(node->right);
-    }
+int BinarySearchTree::get_min() {
+    return map.get_min().value_or(-1);
 }
 
-void BinarySearchTree::rec_delete_tree(BinaryTreeNode *node) {
-    if(node->left != nullptr) { 
-        rec_delete_tree(node->left);
-    }
+int BinarySearchTree::get_max() {
+    return map.get_max().value_or(-1);
+}
 
-    delete node;
+int BinarySearchTree::get_predecessor(int key) {
+    return map.get_predecessor(key).value_or(-1);
+}
 
-    if(node->right != nullptr) {
-        rec_delete_tree(node->right);
-    }
+int BinarySearchTree::get_successor(int key) {
+    return map.get_successor(key).value_or(-1);
 }
 
-void BinarySearchTree::transplant(BinaryTreeNode *node1, BinaryTreeNode *node2) {
-    if(node1->parent == nullptr) {
-        root = node2;
-    } else if(node1 == node1->parent->left) {
-        node1->parent->left = node2;
-    } else { // node1->parent->right == node1
-        node1->parent->right = node2;
-    }
+// The bound queries take any key, not only keys in the tree
 
-    if(node2 != nullptr) {
-        node2->parent = node1->parent;
-    }
+// Data of the first key >= key
+int BinarySearchTree::lower_bound(int key) {
+    Map::const_iterator it = map.lower_bound(key);
+    return (it != map.end()) ? it.value() : -1;
 }
 
-void BinarySearchTree::insert(int data) {
-    insert(data, data);
+// Data of the first key > key
+int BinarySearchTree::upper_bound(int key) {
+    Map::const_iterator it = map.upper_bound(key);
+    return (it != map.end()) ? it.value() : -1;
 }
 
-void BinarySearchTree::insert(int key, int data) {
-    BinaryTreeNode *new_node = new BinaryTreeNode;
-    new_node->key  = key;
-    new_node->data = data;
-    new_node->left = new_node->right = nullptr;
-
-    if(root != nullptr) {
-        BinaryTreeNode *tmp = root;
-        while((tmp->left != nullptr && tmp->key > key) || (tmp->right != nullptr && tmp->key <= key)) {
-            tmp = (tmp->key > key) ? tmp->left : tmp->right;
-        }
-
-        new_node->parent = tmp;
-        if(tmp->key > key) {
-            tmp->left = new_node;
-        } else {
-            tmp->right = new_node;
-        }
-    } else {
-        new_node->parent = nullptr;
-        root = new_node;
-    }
+// Data of the last key <= key
+int BinarySearchTree::floor(int key) {
+    Map::const_iterator it = map.floor(key);
+    return (it != map.end()) ? it.value() : -1;
 }
 
-int BinarySearchTree::search(int key) {
-    BinaryTreeNode *node = search_node(key);
-    if(node != nullptr) {
-        return node->data;
-    }
-    return -1;
+// Data of the first key >= key
+int BinarySearchTree::ceiling(int key) {
+    Map::const_iterator it = map.ceiling(key);
+    return (it != map.end()) ? it.value() : -1;
 }
 
-void BinarySearchTree::remove(int key) {
-    BinaryTreeNode *nodeToRemove = search_node(key);
-
-    if(nodeToRemove == nullptr) {
-        return;
-    }
-
-    if(nodeToRemove->left == nullptr) {
-        transplant(nodeToRemove, nodeToRemove->right);
-    } else if (nodeToRemove->right == nullptr) {
-        transplant(nodeToRemove, nodeToRemove->left);
-    } else {
-        BinaryTreeNode *nodeToReplace = get_min_node(nodeToRemove->right);
-
-        if(nodeToReplace->parent != nodeToRemove) {
-            transplant(nodeToReplace, nodeToReplace->right);
-            nodeToReplace->right = nodeToRemove->right;
-            nodeToReplace->right->parent = nodeToReplace;
-        }
-
-        transplant(nodeToRemove, nodeToReplace);
-        nodeToReplace->left = nodeToRemove->left;
-        nodeToReplace->left->parent = nodeToReplace;
-    }
-
+BinarySearchTree::iterator BinarySearchTree::begin() const {
+    return map.begin();
 }
 
-int BinarySearchTree::get_max() {
-    if(root != nullptr) {
-        return get_max_node(root)->data;
-    }
+BinarySearchTree::iterator BinarySearchTree::end() const {
+    return map.end();
+}
 
-    return -1;
+// Entries with keys in [lo, hi]
+BinarySearchTree::Map::Range BinarySearchTree::range(int lo, int hi) const {
+    return map.range(lo, hi);
 }
 
-int BinarySearchTree::get_min() {
-    if(root != nullptr) {
-        return get_min_node(root)->data;
+// Every (key, data) pair in key order
+std::vector<std::pair<int, int>> BinarySearchTree::entries() const {
+    std::vector<std::pair<int, int>> entries;
+    entries.reserve(map.size());
+    for(Map::const_iterator it = map.begin(); it != map.end(); ++it) {
+        entries.push_back({it.key(), it.value()});
     }
-
-    return -1;
+    return entries;
 }
 
-int BinarySearchTree::get_predecessor(int key) {
-    BinaryTreeNode *node = search_node(key);
-    if(node != nullptr) {
-        BinaryTreeNode *predecessor_node = get_predecessor_node(node);
-
-        return (predecessor_node != nullptr) ? predecessor_node->data : -1;
-    }
-    return -1;
+// Immutable snapshot of the current entries for read-mostly phases
+FrozenIndex BinarySearchTree::freeze() const {
+    std::vector<std::pair<int, int>> entries = this->entries();
+    return FrozenIndex(entries.data(), entries.data() + entries.size());
 }
 
-int BinarySearchTree::get_successor(int key) {
-    BinaryTreeNode *node = search_node(key);
-    if(node != nullptr) {
-        BinaryTreeNode *successor_node = get_successor_node(node);
+// Counters are only kept when built with -DTREE_STATS, size is always
+// reported and the O(n) height when with_height is set
+TreeStatsSnapshot BinarySearchTree::stats(bool with_height) const {
+    return map.stats(with_height);
+}
 
-        return (successor_node != nullptr) ? successor_node->data : -1;
-    }
-    return node->data;
+void BinarySearchTree::reset_stats() {
+    map.reset_stats();
 }
 
 void BinarySearchTree::print_in_order() {
     std::cout << "Printing BST inorder: ";
-    rec_print_in_order(root);
+    map.print_in_order(std::cout);
     std::cout << std::endl;
 }
\ No newline at end of file
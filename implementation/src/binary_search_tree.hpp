@@ -1,37 +1,41 @@
 #pragma once
 
-struct BinaryTreeNode {
-    int key;
-    int data;
-    BinaryTreeNode *left;
-    BinaryTreeNode *right;
-    BinaryTreeNode *parent;
-};
+#include <utility>
+#include <vector>
+
+#include "frozen_index.hpp"
+#include "ordered_map.hpp"
 
 class BinarySearchTree {
-    private:
-        BinaryTreeNode *root;
-    
-        BinaryTreeNode* search_node(int key);
-        BinaryTreeNode* get_min_node(BinaryTreeNode *node);
-        BinaryTreeNode* get_max_node(BinaryTreeNode *node);
-        BinaryTreeNode* get_predecessor_node(BinaryTreeNode *node);
-        BinaryTreeNode* get_successor_node(BinaryTreeNode *node);
-        void rec_print_in_order(BinaryTreeNode *node);
-        void rec_delete_tree(BinaryTreeNode *node);
-        void transplant(BinaryTreeNode *node1, BinaryTreeNode *node2);
-        
     public:
-        BinarySearchTree();
-        ~BinarySearchTree();
+        typedef OrderedMap<int, int, std::less<int>, NoBalance, PointerLayout<>, IntTreeStats> Map;
+        typedef Map::const_iterator iterator;
 
+    private:
+        Map map;
+
+    public:
         int  search(int key);
+        bool contains(int key);
+        void search_batch(const int *keys, int *out, size_t n);
         void insert(int data);
         void insert(int key, int data);
+        void build_from_sorted(const std::pair<int, int> *begin, const std::pair<int, int> *end);
         void remove(int key);
         int  get_min();
         int  get_max();
         int  get_predecessor(int key);
         int  get_successor(int key);
+        int  lower_bound(int key);
+        int  upper_bound(int key);
+        int  floor(int key);
+        int  ceiling(int key);
+        iterator begin() const;
+        iterator end() const;
+        Map::Range range(int lo, int hi) const;
+        std::vector<std::pair<int, int>> entries() const;
+        FrozenIndex freeze() const;
+        TreeStatsSnapshot stats(bool with_height = false) const;
+        void reset_stats();
         void print_in_order();
 };
\ No newline at end of file
@@ -0,0 +1,673 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "node_pool.hpp"
+
+// B+tree keyed by Key and ordered by Compare, with the same interface as
+// OrderedMap's core operations. Entries live only in the leaves, which are
+// linked both ways for ordered walks, and inner nodes hold separator keys.
+// Every node is at most NodeBytes long and cache-line aligned, so a node
+// costs a few adjacent cache-line fetches and a lookup touches one node per
+// level instead of one per binary tree level. Equal keys are allowed, a new
+// key goes after the ones already in the tree. Nodes are copied with plain
+// assignment and freed in bulk, so keys and values have to be trivially
+// copyable.
+template<class Key, class Value, class Compare = std::less<Key>, size_t NodeBytes = 256>
+class BPlusMap {
+    static_assert(std::is_trivially_copyable<Key>::value && std::is_trivially_copyable<Value>::value,
+                  "BPlusMap needs trivially copyable keys and values");
+
+    public:
+        static constexpr size_t CACHE_LINE = 64;
+
+        static_assert(NodeBytes % CACHE_LINE == 0, "nodes span whole cache lines");
+
+    private:
+        // Common header, leaf tells which of the two node types follows
+        struct Node {
+            uint16_t count; // entries in a leaf, separator keys in an inner node
+            bool leaf;
+        };
+
+        static constexpr size_t HEADER_SIZE = (sizeof(Node) + alignof(void*) - 1) / alignof(void*) * alignof(void*);
+
+    public:
+        // Entries per leaf and separator keys per inner node, leaving room
+        // for the header, links and alignment padding
+        static constexpr size_t LEAF_CAPACITY  = (NodeBytes - HEADER_SIZE - 2 * sizeof(void*) - alignof(Value))
+                                               / (sizeof(Key) + sizeof(Value));
+        static constexpr size_t INNER_CAPACITY = (NodeBytes - HEADER_SIZE - sizeof(void*) - alignof(Key))
+                                               / (sizeof(Key) + sizeof(void*));
+
+        static_assert(LEAF_CAPACITY >= 4 && INNER_CAPACITY >= 4, "NodeBytes is too small for these keys and values");
+        static_assert(LEAF_CAPACITY <= UINT16_MAX && INNER_CAPACITY <= UINT16_MAX, "node counts are 16-bit");
+
+    private:
+        // Nodes other than the root stay at least half full
+        static constexpr size_t LEAF_MIN  = LEAF_CAPACITY / 2;
+        static constexpr size_t INNER_MIN = INNER_CAPACITY / 2;
+
+        struct alignas(CACHE_LINE) Leaf : Node {
+            Leaf *prev;
+            Leaf *next;
+            Key   keys[LEAF_CAPACITY];
+            Value values[LEAF_CAPACITY];
+        };
+
+        // children[i] holds keys between keys[i - 1] and keys[i], both ends
+        // inclusive since equal keys can straddle a split
+        struct alignas(CACHE_LINE) Inner : Node {
+            Node *children[INNER_CAPACITY + 1];
+            Key   keys[INNER_CAPACITY];
+        };
+
+        static_assert(sizeof(Leaf) <= NodeBytes && sizeof(Inner) <= NodeBytes, "node layout overflows NodeBytes");
+
+        // Entry index inside a leaf, leaf is nullptr past the last entry
+        struct Position {
+            Leaf  *leaf;
+            size_t index;
+        };
+
+        SlabPool<Leaf>  leaves;
+        SlabPool<Inner> inners;
+        Node   *root;
+        size_t entry_count;
+        Compare compare;
+
+        static Leaf* as_leaf(Node *node)   { return static_cast<Leaf*>(node); }
+        static Inner* as_inner(Node *node) { return static_cast<Inner*>(node); }
+
+        Leaf* new_leaf() {
+            Leaf *leaf = new (leaves.allocate()) Leaf;
+            leaf->count = 0;
+            leaf->leaf = true;
+            leaf->prev = leaf->next = nullptr;
+            return leaf;
+        }
+
+        Inner* new_inner() {
+            Inner *inner = new (inners.allocate()) Inner;
+            inner->count = 0;
+            inner->leaf = false;
+            return inner;
+        }
+
+        // Index of the first key in keys[0..count) not less than key
+        size_t lower_index(const Key *keys, size_t count, const Key &key) const {
+            return std::lower_bound(keys, keys + count, key, compare) - keys;
+        }
+
+        // Index of the first key in keys[0..count) greater than key
+        size_t upper_index(const Key *keys, size_t count, const Key &key) const {
+            return std::upper_bound(keys, keys + count, key, compare) - keys;
+        }
+
+        // The first entry with a key not less than key. A leaf can end just
+        // before a run of equal keys starts in the next one, so the answer
+        // may be the next leaf's first entry
+        Position lower_position(const Key &key) const {
+            if(root == nullptr) {
+                return {nullptr, 0};
+            }
+
+            Node *node = root;
+            while(!node->leaf) {
+                Inner *inner = as_inner(node);
+                node = inner->children[lower_index(inner->keys, inner->count, key)];
+            }
+
+            Leaf *leaf = as_leaf(node);
+            size_t index = lower_index(leaf->keys, leaf->count, key);
+            if(index == leaf->count) {
+                return {leaf->next, 0};
+            }
+            return {leaf, index};
+        }
+
+        Position find_position(const Key &key) const {
+            Position pos = lower_position(key);
+            if(pos.leaf != nullptr && !compare(key, pos.leaf->keys[pos.index])) {
+                return pos;
+            }
+            return {nullptr, 0};
+        }
+
+        static Position prev_position(Position pos) {
+            if(pos.index > 0) {
+                return {pos.leaf, pos.index - 1};
+            }
+            Leaf *prev = pos.leaf->prev;
+            return (prev != nullptr) ? Position{prev, (size_t)prev->count - 1} : Position{nullptr, 0};
+        }
+
+        static Position next_position(Position pos) {
+            if(pos.index + 1 < pos.leaf->count) {
+                return {pos.leaf, pos.index + 1};
+            }
+            return {pos.leaf->next, 0};
+        }
+
+        Leaf* first_leaf() const {
+            Node *node = root;
+            while(node != nullptr && !node->leaf) {
+                node = as_inner(node)->children[0];
+            }
+            return as_leaf(node);
+        }
+
+        Leaf* last_leaf() const {
+            Node *node = root;
+            while(node != nullptr && !node->leaf) {
+                node = as_inner(node)->children[node->count];
+            }
+            return as_leaf(node);
+        }
+
+        // A node that split hands its new right sibling and the separator
+        // between the two back to its parent
+        struct Split {
+            Node *right;
+            Key   separator;
+        };
+
+        bool insert_into(Node *node, const Key &key, const Value &value, Split &split) {
+            if(node->leaf) {
+                return insert_into_leaf(as_leaf(node), key, value, split);
+            }
+
+            Inner *inner = as_inner(node);
+            size_t child = upper_index(inner->keys, inner->count, key);
+
+            Split below;
+            if(!insert_into(inner->children[child], key, value, below)) {
+                return false;
+            }
+
+            // Gather all keys and children, then keep them here or split in two
+            Key   keys[INNER_CAPACITY + 1];
+            Node *children[INNER_CAPACITY + 2];
+            size_t count = inner->count;
+
+            std::copy(inner->keys, inner->keys + child, keys);
+            keys[child] = below.separator;
+            std::copy(inner->keys + child, inner->keys + count, keys + child + 1);
+
+            std::copy(inner->children, inner->children + child + 1, children);
+            children[child + 1] = below.right;
+            std::copy(inner->children + child + 1, inner->children + count + 1, children + child + 2);
+            count++;
+
+            if(count <= INNER_CAPACITY) {
+                std::copy(keys, keys + count, inner->keys);
+                std::copy(children, children + count + 1, inner->children);
+                inner->count = (uint16_t)count;
+                return false;
+            }
+
+            // The middle key moves up, it stays in neither half
+            size_t left_count = count / 2;
+            Inner *right = new_inner();
+
+            std::copy(keys, keys + left_count, inner->keys);
+            std::copy(children, children + left_count + 1, inner->children);
+            inner->count = (uint16_t)left_count;
+
+            std::copy(keys + left_count + 1, keys + count, right->keys);
+            std::copy(children + left_count + 1, children + count + 1, right->children);
+            right->count = (uint16_t)(count - left_count - 1);
+
+            split = {right, keys[left_count]};
+            return true;
+        }
+
+        bool insert_into_leaf(Leaf *leaf, const Key &key, const Value &value, Split &split) {
+            size_t index = upper_index(leaf->keys, leaf->count, key);
+
+            if(leaf->count < LEAF_CAPACITY) {
+                std::copy_backward(leaf->keys + index, leaf->keys + leaf->count, leaf->keys + leaf->count + 1);
+                std::copy_backward(leaf->values + index, leaf->values + leaf->count, leaf->values + leaf->count + 1);
+                leaf->keys[index] = key;
+                leaf->values[index] = value;
+                leaf->count++;
+                return false;
+            }
+
+            Key   keys[LEAF_CAPACITY + 1];
+            Value values[LEAF_CAPACITY + 1];
+            size_t count = leaf->count;
+
+            std::copy(leaf->keys, leaf->keys + index, keys);
+            keys[index] = key;
+            std::copy(leaf->keys + index, leaf->keys + count, keys + index + 1);
+
+            std::copy(leaf->values, leaf->values + index, values);
+            values[index] = value;
+            std::copy(leaf->values + index, leaf->values + count, values + index + 1);
+            count++;
+
+            size_t left_count = count / 2;
+            Leaf *right = new_leaf();
+
+            std::copy(keys, keys + left_count, leaf->keys);
+            std::copy(values, values + left_count, leaf->values);
+            leaf->count = (uint16_t)left_count;
+
+            std::copy(keys + left_count, keys + count, right->keys);
+            std::copy(values + left_count, values + count, right->values);
+            right->count = (uint16_t)(count - left_count);
+
+            right->prev = leaf;
+            right->next = leaf->next;
+            if(leaf->next != nullptr) {
+                leaf->next->prev = right;
+            }
+            leaf->next = right;
+
+            split = {right, right->keys[0]};
+            return true;
+        }
+
+        // Removes the first entry with key from node's subtree. Returns false
+        // when the subtree holds no such key
+        bool remove_from(Node *node, const Key &key) {
+            if(node->leaf) {
+                Leaf *leaf = as_leaf(node);
+                size_t index = lower_index(leaf->keys, leaf->count, key);
+                if(index == leaf->count || compare(key, leaf->keys[index])) {
+                    return false;
+                }
+
+                std::copy(leaf->keys + index + 1, leaf->keys + leaf->count, leaf->keys + index);
+                std::copy(leaf->values + index + 1, leaf->values + leaf->count, leaf->values + index);
+                leaf->count--;
+                return true;
+            }
+
+            Inner *inner = as_inner(node);
+            size_t child = lower_index(inner->keys, inner->count, key);
+
+            // When children[child] only holds smaller keys, the run of equal
+            // keys can only start in the next child, behind a separator equal to key
+            if(!remove_from(inner->children[child], key)) {
+                if(child == inner->count || compare(key, inner->keys[child])) {
+                    return false;
+                }
+                child++;
+                if(!remove_from(inner->children[child], key)) {
+                    return false;
+                }
+            }
+
+            fix_underflow(inner, child);
+            return true;
+        }
+
+        // Refills children[child] of parent from a sibling, or merges it
+        // with one, when it dropped below half full
+        void fix_underflow(Inner *parent, size_t child) {
+            Node *node = parent->children[child];
+            size_t min = node->leaf ? LEAF_MIN : INNER_MIN;
+            if(node->count >= min) {
+                return;
+            }
+
+            Node *left = (child > 0) ? parent->children[child - 1] : nullptr;
+            Node *right = (child < parent->count) ? parent->children[child + 1] : nullptr;
+
+            if(left != nullptr && left->count > min) {
+                if(node->leaf) {
+                    borrow_from_left(as_leaf(left), as_leaf(node), parent->keys[child - 1]);
+                } else {
+                    borrow_from_left(as_inner(left), as_inner(node), parent->keys[child - 1]);
+                }
+            } else if(right != nullptr && right->count > min) {
+                if(node->leaf) {
+                    borrow_from_right(as_leaf(node), as_leaf(right), parent->keys[child]);
+                } else {
+                    borrow_from_right(as_inner(node), as_inner(right), parent->keys[child]);
+                }
+            } else {
+                // Merge into the left one of the pair and drop the separator
+                size_t separator = (left != nullptr) ? child - 1 : child;
+                Node *merged_left = parent->children[separator];
+                Node *merged_right = parent->children[separator + 1];
+
+                if(node->leaf) {
+                    merge(as_leaf(merged_left), as_leaf(merged_right));
+                } else {
+                    merge(as_inner(merged_left), as_inner(merged_right), parent->keys[separator]);
+                }
+
+                std::copy(parent->keys + separator + 1, parent->keys + parent->count, parent->keys + separator);
+                std::copy(parent->children + separator + 2, parent->children + parent->count + 1, parent->children + separator + 1);
+                parent->count--;
+            }
+        }
+
+        void borrow_from_left(Leaf *left, Leaf *node, Key &separator) {
+            std::copy_backward(node->keys, node->keys + node->count, node->keys + node->count + 1);
+            std::copy_backward(node->values, node->values + node->count, node->values + node->count + 1);
+            left->count--;
+            node->keys[0] = left->keys[left->count];
+            node->values[0] = left->values[left->count];
+            node->count++;
+            separator = node->keys[0];
+        }
+
+        void borrow_from_right(Leaf *node, Leaf *right, Key &separator) {
+            node->keys[node->count] = right->keys[0];
+            node->values[node->count] = right->values[0];
+            node->count++;
+            std::copy(right->keys + 1, right->keys + right->count, right->keys);
+            std::copy(right->values + 1, right->values + right->count, right->values);
+            right->count--;
+            separator = right->keys[0];
+        }
+
+        // Inner nodes rotate through the parent's separator
+        void borrow_from_left(Inner *left, Inner *node, Key &separator) {
+            std::copy_backward(node->keys, node->keys + node->count, node->keys + node->count + 1);
+            std::copy_backward(node->children, node->children + node->count + 1, node->children + node->count + 2);
+            node->keys[0] = separator;
+            node->children[0] = left->children[left->count];
+            node->count++;
+            separator = left->keys[left->count - 1];
+            left->count--;
+        }
+
+        void borrow_from_right(Inner *node, Inner *right, Key &separator) {
+            node->keys[node->count] = separator;
+            node->children[node->count + 1] = right->children[0];
+            node->count++;
+            separator = right->keys[0];
+            std::copy(right->keys + 1, right->keys + right->count, right->keys);
+            std::copy(right->children + 1, right->children + right->count + 1, right->children);
+            right->count--;
+        }
+
+        void merge(Leaf *left, Leaf *right) {
+            std::copy(right->keys, right->keys + right->count, left->keys + left->count);
+            std::copy(right->values, right->values + right->count, left->values + left->count);
+            left->count += right->count;
+
+            left->next = right->next;
+            if(right->next != nullptr) {
+                right->next->prev = left;
+            }
+            leaves.deallocate(right);
+        }
+
+        void merge(Inner *left, Inner *right, const Key &separator) {
+            left->keys[left->count] = separator;
+            std::copy(right->keys, right->keys + right->count, left->keys + left->count + 1);
+            std::copy(right->children, right->children + right->count + 1, left->children + left->count + 1);
+            left->count += right->count + 1;
+            inners.deallocate(right);
+        }
+
+        // Splits count items into the fewest groups of at most capacity,
+        // as evenly as possible, which keeps every group at least half full
+        static std::vector<size_t> group_sizes(size_t count, size_t capacity) {
+            size_t groups = (count + capacity - 1) / capacity;
+            std::vector<size_t> sizes(groups, count / groups);
+            for(size_t i = 0; i < count % groups; i++) {
+                sizes[i]++;
+            }
+            return sizes;
+        }
+
+    public:
+        explicit BPlusMap(const Compare &compare = Compare()) : root(nullptr), entry_count(0), compare(compare) {}
+
+        BPlusMap(const BPlusMap &) = delete;
+        BPlusMap& operator=(const BPlusMap &) = delete;
+
+        size_t size() const {
+            return entry_count;
+        }
+
+        bool empty() const {
+            return entry_count == 0;
+        }
+
+        // Nodes hold trivially copyable data, so the pools free them in bulk
+        void clear() {
+            leaves.release();
+            inners.release();
+            root = nullptr;
+            entry_count = 0;
+        }
+
+        // Replaces the contents with the (key, value) pairs in [first, last),
+        // which should be sorted by key. Sorted input is packed into nearly
+        // full leaves and the inner levels are built on top of them in O(n);
+        // input that is not sorted falls back to inserting one pair at a time
+        template<class Iterator>
+        void build_from_sorted(Iterator first, Iterator last) {
+            clear();
+
+            bool sorted = std::is_sorted(first, last, [this](const auto &a, const auto &b) {
+                return compare(a.first, b.first);
+            });
+            if(!sorted) {
+                for(; first != last; ++first) {
+                    insert(first->first, first->second);
+                }
+                return;
+            }
+
+            size_t count = std::distance(first, last);
+            if(count == 0) {
+                return;
+            }
+
+            // level holds one tree level left to right, low_keys the smallest
+            // key under each of its nodes
+            std::vector<Node*> level;
+            std::vector<Key> low_keys;
+            Leaf *prev = nullptr;
+
+            for(size_t leaf_size : group_sizes(count, LEAF_CAPACITY)) {
+                Leaf *leaf = new_leaf();
+                for(size_t i = 0; i < leaf_size; i++, ++first) {
+                    leaf->keys[i] = first->first;
+                    leaf->values[i] = first->second;
+                }
+                leaf->count = (uint16_t)leaf_size;
+
+                leaf->prev = prev;
+                if(prev != nullptr) {
+                    prev->next = leaf;
+                }
+                prev = leaf;
+
+                level.push_back(leaf);
+                low_keys.push_back(leaf->keys[0]);
+            }
+
+            while(level.size() > 1) {
+                std::vector<Node*> parents;
+                std::vector<Key> parent_low_keys;
+                size_t next = 0;
+
+                for(size_t children : group_sizes(level.size(), INNER_CAPACITY + 1)) {
+                    Inner *inner = new_inner();
+                    for(size_t i = 0; i < children; i++) {
+                        inner->children[i] = level[next + i];
+                        if(i > 0) {
+                            inner->keys[i - 1] = low_keys[next + i];
+                        }
+                    }
+                    inner->count = (uint16_t)(children - 1);
+
+                    parents.push_back(inner);
+                    parent_low_keys.push_back(low_keys[next]);
+                    next += children;
+                }
+
+                level.swap(parents);
+                low_keys.swap(parent_low_keys);
+            }
+
+            root = level[0];
+            entry_count = count;
+        }
+
+        bool contains(const Key &key) const {
+            return find_position(key).leaf != nullptr;
+        }
+
+        std::optional<Value> search(const Key &key) const {
+            Position pos = find_position(key);
+            if(pos.leaf != nullptr) {
+                return pos.leaf->values[pos.index];
+            }
+            return std::nullopt;
+        }
+
+        // A lookup already reads whole nodes per level, so a batch simply
+        // runs one lookup after another. Returns the number of keys found
+        size_t search_batch(const Key *keys, Value *out, size_t n, const Value &missing) const {
+            size_t found = 0;
+            for(size_t i = 0; i < n; i++) {
+                Position pos = find_position(keys[i]);
+                if(pos.leaf != nullptr) {
+                    out[i] = pos.leaf->values[pos.index];
+                    found++;
+                } else {
+                    out[i] = missing;
+                }
+            }
+            return found;
+        }
+
+        void insert(const Key &key, const Value &value) {
+            if(root == nullptr) {
+                root = new_leaf();
+            }
+
+            Split split;
+            if(insert_into(root, key, value, split)) {
+                Inner *new_root = new_inner();
+                new_root->children[0] = root;
+                new_root->children[1] = split.right;
+                new_root->keys[0] = split.separator;
+                new_root->count = 1;
+                root = new_root;
+            }
+
+            entry_count++;
+        }
+
+        // Removes the first entry with key, returns false when there is none
+        bool remove(const Key &key) {
+            if(root == nullptr || !remove_from(root, key)) {
+                return false;
+            }
+
+            entry_count--;
+
+            // The root is exempt from the half full rule, but shrinks the
+            // tree by a level once it is down to a single child
+            if(root->leaf) {
+                if(root->count == 0) {
+                    leaves.deallocate(root);
+                    root = nullptr;
+                }
+            } else if(root->count == 0) {
+                Node *old_root = root;
+                root = as_inner(root)->children[0];
+                inners.deallocate(old_root);
+            }
+
+            return true;
+        }
+
+        std::optional<Value> get_min() const {
+            Leaf *leaf = first_leaf();
+            if(leaf != nullptr) {
+                return leaf->values[0];
+            }
+            return std::nullopt;
+        }
+
+        std::optional<Value> get_max() const {
+            Leaf *leaf = last_leaf();
+            if(leaf != nullptr) {
+                return leaf->values[leaf->count - 1];
+            }
+            return std::nullopt;
+        }
+
+        // Value of the entry just before the first entry with key, which has
+        // to be in the map
+        std::optional<Value> get_predecessor(const Key &key) const {
+            Position pos = find_position(key);
+            if(pos.leaf == nullptr) {
+                return std::nullopt;
+            }
+
+            pos = prev_position(pos);
+            if(pos.leaf != nullptr) {
+                return pos.leaf->values[pos.index];
+            }
+            return std::nullopt;
+        }
+
+        // Value of the entry just after the first entry with key, which has
+        // to be in the map
+        std::optional<Value> get_successor(const Key &key) const {
+            Position pos = find_position(key);
+            if(pos.leaf == nullptr) {
+                return std::nullopt;
+            }
+
+            pos = next_position(pos);
+            if(pos.leaf != nullptr) {
+                return pos.leaf->values[pos.index];
+            }
+            return std::nullopt;
+        }
+
+        // Calls visit(key, value) for every entry in key order
+        template<class Visit>
+        void for_each(Visit visit) const {
+            for(Leaf *leaf = first_leaf(); leaf != nullptr; leaf = leaf->next) {
+                for(size_t i = 0; i < leaf->count; i++) {
+                    visit(leaf->keys[i], leaf->values[i]);
+                }
+            }
+        }
+
+        // Calls visit(key, value) for every entry with a key in [lo, hi], in
+        // key order, walking the leaf chain from the first one
+        template<class Visit>
+        void range(const Key &lo, const Key &hi, Visit visit) const {
+            for(Position pos = lower_position(lo); pos.leaf != nullptr; pos = next_position(pos)) {
+                if(compare(hi, pos.leaf->keys[pos.index])) {
+                    return;
+                }
+                visit(pos.leaf->keys[pos.index], pos.leaf->values[pos.index]);
+            }
+        }
+
+        // Walks the leaf chain
+        void print_in_order(std::ostream &out) const {
+            for(Leaf *leaf = first_leaf(); leaf != nullptr; leaf = leaf->next) {
+                for(size_t i = 0; i < leaf->count; i++) {
+                    out << leaf->values[i] << " ";
+                }
+            }
+        }
+};
@@ -0,0 +1,64 @@
+#include <iostream>
+
+#include "bplus_tree.hpp"
+
+// Missing keys and empty trees are reported as -1
+
+int BPlusTree::search(int key) {
+    return map.search(key).value_or(-1);
+}
+
+bool BPlusTree::contains(int key) {
+    return map.contains(key);
+}
+
+void BPlusTree::search_batch(const int *keys, int *out, size_t n) {
+    map.search_batch(keys, out, n, -1);
+}
+
+void BPlusTree::insert(int data) {
+    insert(data, data);
+}
+
+void BPlusTree::insert(int key, int data) {
+    map.insert(key, data);
+}
+
+// Replaces the tree with the (key, data) pairs in [begin, end), sorted by key
+void BPlusTree::build_from_sorted(const std::pair<int, int> *begin, const std::pair<int, int> *end) {
+    map.build_from_sorted(begin, end);
+}
+
+void BPlusTree::remove(int key) {
+    map.remove(key);
+}
+
+int BPlusTree::get_min() {
+    return map.get_min().value_or(-1);
+}
+
+int BPlusTree::get_max() {
+    return map.get_max().value_or(-1);
+}
+
+int BPlusTree::get_predecessor(int key) {
+    return map.get_predecessor(key).value_or(-1);
+}
+
+int BPlusTree::get_successor(int key) {
+    return map.get_successor(key).value_or(-1);
+}
+
+// Every (key, data) pair in key order
+std::vector<std::pair<int, int>> BPlusTree::entries() const {
+    std::vector<std::pair<int, int>> entries;
+    entries.reserve(map.size());
+    map.for_each([&entries](int key, int data) { entries.push_back({key, data}); });
+    return entries;
+}
+
+void BPlusTree::print_in_order() {
+    std::cout << "Printing B+ Tree inorder: ";
+    map.print_in_order(std::cout);
+    std::cout << std::endl;
+}
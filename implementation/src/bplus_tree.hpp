@@ -0,0 +1,35 @@
+#pragma once
+
+#include <utility>
+#include <vector>
+
+#include "bplus_map.hpp"
+
+class BPlusTree {
+    public:
+        typedef BPlusMap<int, int> Map;
+
+    private:
+        Map map;
+
+    public:
+        int  search(int key);
+        bool contains(int key);
+        void search_batch(const int *keys, int *out, size_t n);
+        void insert(int data);
+        void insert(int key, int data);
+        void build_from_sorted(const std::pair<int, int> *begin, const std::pair<int, int> *end);
+        void remove(int key);
+        int  get_min();
+        int  get_max();
+        int  get_predecessor(int key);
+        int  get_successor(int key);
+        std::vector<std::pair<int, int>> entries() const;
+        void print_in_order();
+
+        // Calls visit(key, data) for every entry with a key in [lo, hi], in key order
+        template<class Visit>
+        void range(int lo, int hi, Visit visit) const {
+            map.range(lo, hi, visit);
+        }
+};
@@ -0,0 +1,188 @@
+#include <thread>
+
+#include "concurrent_red_black_tree.hpp"
+
+// Missing keys and empty trees are reported as -1
+
+typedef ConcurrentRedBlackTree::Map Map;
+typedef ConcurrentRedBlackTree::NodeRef NodeRef;
+
+// Moves a reader from node to its child on one side. The link is read again
+// after the child's version, and node is validated last, so the child
+// still hung below node, with that version, while node still held every key
+// the reader is looking for. A child moved down in between no longer holds
+// them all. False when the reader has to start over
+static bool step(const Map::Storage &storage, NodeRef &node, uint32_t &version, bool go_left) {
+    NodeRef child = go_left ? storage.left(node) : storage.right(node);
+    uint32_t child_version = 0;
+    if(child != Map::nil && !storage.stable(child, child_version)) {
+        return false;
+    }
+    if(child != Map::nil && child != (go_left ? storage.left(node) : storage.right(node))) {
+        return false;
+    }
+    if(!storage.validate(node, version)) {
+        return false;
+    }
+
+    node = child;
+    version = child_version;
+    return true;
+}
+
+// The node a descent starts from. root is only published when a write
+// ends, so a rotation at the top may have moved the published root down,
+// with the new root above it. False when the reader has to start over
+static bool enter(const Map::Storage &storage, NodeRef &node, uint32_t &version) {
+    while(node != Map::nil && storage.parent(node) != Map::nil) {
+        node = storage.parent(node);
+    }
+    if(node == Map::nil) {
+        return true;
+    }
+    return storage.stable(node, version) && storage.parent(node) == Map::nil;
+}
+
+ConcurrentRedBlackTree::ConcurrentRedBlackTree() : root(Map::nil), entry_count(0) {}
+
+void ConcurrentRedBlackTree::end_write() {
+    root.store(map.root_node(), std::memory_order_release);
+    entry_count.store(map.size(), std::memory_order_relaxed);
+    map.node_storage().reclaim();
+}
+
+// Runs descent(storage, node, version, result) from the root until it
+// completes. descent returns false when a step failed validation
+template<class Descent>
+int ConcurrentRedBlackTree::read(Descent descent) const {
+    const Map::Storage &storage = map.node_storage();
+    size_t slot = storage.reader_enter();
+
+    int result;
+    for(;;) {
+        result = -1;
+        NodeRef node = root.load(std::memory_order_acquire);
+        uint32_t version = 0;
+        if(enter(storage, node, version) && descent(storage, node, version, result)) {
+            break;
+        }
+        // The writer is moving nodes on this path, let it finish
+        std::this_thread::yield();
+    }
+
+    storage.reader_leave(slot);
+    return result;
+}
+
+int ConcurrentRedBlackTree::search(int key) const {
+    return read([key](const Map::Storage &storage, NodeRef node, uint32_t version, int &result) {
+        while(node != Map::nil) {
+            int node_key = storage.key(node);
+            if(node_key == key) {
+                result = storage.value(node);
+                break;
+            }
+            if(!step(storage, node, version, key < node_key)) {
+                return false;
+            }
+        }
+        return true;
+    });
+}
+
+int ConcurrentRedBlackTree::get_min() const {
+    return read([](const Map::Storage &storage, NodeRef node, uint32_t version, int &result) {
+        while(node != Map::nil) {
+            result = storage.value(node);
+            if(!step(storage, node, version, true)) {
+                return false;
+            }
+        }
+        return true;
+    });
+}
+
+int ConcurrentRedBlackTree::get_max() const {
+    return read([](const Map::Storage &storage, NodeRef node, uint32_t version, int &result) {
+        while(node != Map::nil) {
+            result = storage.value(node);
+            if(!step(storage, node, version, false)) {
+                return false;
+            }
+        }
+        return true;
+    });
+}
+
+// Readers only move down, so the neighbours of key are found in the same
+// descent that finds key itself: the last node passed on the other side
+
+int ConcurrentRedBlackTree::get_predecessor(int key) const {
+    return read([key](const Map::Storage &storage, NodeRef node, uint32_t version, int &result) {
+        NodeRef below = Map::nil;
+        bool found = false;
+
+        while(node != Map::nil) {
+            int node_key = storage.key(node);
+            bool go_left = !(node_key < key);
+            if(go_left) {
+                found = found || node_key == key;
+            } else {
+                below = node;
+            }
+            if(!step(storage, node, version, go_left)) {
+                return false;
+            }
+        }
+
+        if(found && below != Map::nil) {
+            result = storage.value(below);
+        }
+        return true;
+    });
+}
+
+int ConcurrentRedBlackTree::get_successor(int key) const {
+    return read([key](const Map::Storage &storage, NodeRef node, uint32_t version, int &result) {
+        NodeRef above = Map::nil;
+        bool found = false;
+
+        while(node != Map::nil) {
+            int node_key = storage.key(node);
+            bool go_left = key < node_key;
+            if(go_left) {
+                above = node;
+            } else {
+                found = found || node_key == key;
+            }
+            if(!step(storage, node, version, go_left)) {
+                return false;
+            }
+        }
+
+        if(found && above != Map::nil) {
+            result = storage.value(above);
+        }
+        return true;
+    });
+}
+
+size_t ConcurrentRedBlackTree::size() const {
+    return entry_count.load(std::memory_order_relaxed);
+}
+
+void ConcurrentRedBlackTree::insert(int data) {
+    insert(data, data);
+}
+
+void ConcurrentRedBlackTree::insert(int key, int data) {
+    std::lock_guard<std::mutex> lock(writer);
+    map.insert(key, data);
+    end_write();
+}
+
+void ConcurrentRedBlackTree::remove(int key) {
+    std::lock_guard<std::mutex> lock(writer);
+    map.remove(key);
+    end_write();
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+#include "ordered_map.hpp"
+
+// Red-black tree for many reader threads and one writer at a time. Readers
+// take no locks: they walk the atomic links under epoch protection and check
+// every step hand over hand against the version of the node they came from
+// (see ConcurrentLayout), so a reader only starts over when the writer moved
+// or removed a node on its own path, not on every write. Nodes removed by
+// the writer are freed through epoch-based reclamation, so a reader never
+// touches freed memory. Writers are serialized by a mutex.
+class ConcurrentRedBlackTree {
+    public:
+        typedef OrderedMap<int, int, std::less<int>, RedBlackBalance, ConcurrentLayout> Map;
+        typedef Map::NodeRef NodeRef;
+
+    private:
+        Map map;
+        std::mutex writer;
+        std::atomic<NodeRef> root;       // published at the end of every write
+        std::atomic<size_t> entry_count;
+
+        void end_write();
+
+        template<class Descent>
+        int read(Descent descent) const;
+
+    public:
+        ConcurrentRedBlackTree();
+
+        // Lock-free, safe alongside a writer
+        int  search(int key) const;
+        int  get_min() const;
+        int  get_max() const;
+        int  get_predecessor(int key) const;
+        int  get_successor(int key) const;
+        size_t size() const;
+
+        // Serialized with each other
+        void insert(int data);
+        void insert(int key, int data);
+        void remove(int key);
+};
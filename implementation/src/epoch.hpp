@@ -0,0 +1,83 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <thread>
+
+// Epoch-based reclamation for structures whose readers take no locks.
+// A reader holds a slot stamped with the global epoch for as long as it may
+// touch shared nodes. A node unlinked by the writer is retired in the
+// current epoch and freed once the global epoch is two ahead of it: the
+// epoch only advances after every active reader has caught up with it, so
+// by then no reader that could have reached the node is left.
+class EpochDomain {
+    public:
+        static constexpr size_t READER_SLOTS = 256;
+
+    private:
+        static constexpr uint64_t IDLE = UINT64_MAX;
+
+        struct alignas(64) Slot {
+            std::atomic<uint64_t> epoch;
+        };
+
+        std::atomic<uint64_t> global_epoch;
+        mutable Slot slots[READER_SLOTS];
+
+    public:
+        EpochDomain() : global_epoch(0) {
+            for(Slot &slot : slots) {
+                slot.epoch.store(IDLE, std::memory_order_relaxed);
+            }
+        }
+
+        EpochDomain(const EpochDomain &) = delete;
+        EpochDomain& operator=(const EpochDomain &) = delete;
+
+        // Claims a free slot, starting from one picked by the thread id so
+        // concurrent readers rarely collide, and returns it for leave()
+        size_t enter() const {
+            size_t slot = std::hash<std::thread::id>()(std::this_thread::get_id()) % READER_SLOTS;
+
+            for(;; slot = (slot + 1) % READER_SLOTS) {
+                uint64_t expected = IDLE;
+                uint64_t epoch = global_epoch.load();
+                if(!slots[slot].epoch.compare_exchange_strong(expected, epoch)) {
+                    continue;
+                }
+
+                // The writer may have advanced before it could see this slot
+                for(uint64_t now = global_epoch.load(); now != epoch; now = global_epoch.load()) {
+                    epoch = now;
+                    slots[slot].epoch.store(epoch);
+                }
+                return slot;
+            }
+        }
+
+        void leave(size_t slot) const {
+            slots[slot].epoch.store(IDLE, std::memory_order_release);
+        }
+
+        uint64_t current() const {
+            return global_epoch.load();
+        }
+
+        // Writer side. Advances the global epoch when no active reader is
+        // behind it and returns the epoch now in effect; nodes retired at
+        // least two epochs before it can be freed
+        uint64_t try_advance() {
+            uint64_t epoch = global_epoch.load();
+            for(const Slot &slot : slots) {
+                uint64_t reader = slot.epoch.load();
+                if(reader != IDLE && reader != epoch) {
+                    return epoch;
+                }
+            }
+
+            global_epoch.store(epoch + 1);
+            return epoch + 1;
+        }
+};
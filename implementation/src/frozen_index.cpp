@@ -0,0 +1,442 @@
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <new>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "frozen_index.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FROZEN_INDEX_X86 1
+#endif
+
+// Layout: level 0 holds the sorted keys padded with INT_MAX to whole blocks.
+// Block b of a level above has FANOUT children, blocks b * FANOUT + i of
+// the level below, and its key j is the smallest key under child j + 1.
+// Ranking the probe in a block (keys less than it) picks the child, and in
+// level 0 the rank gives the lower bound directly. Padding keys are never
+// less than a probe, so a lookup never steps into a missing child.
+//
+// The image starts with a header of HEADER_BYTES, followed by the levels'
+// keys (a whole number of blocks, so the values stay block aligned) and then
+// key_count values. Images are written in the byte order of the machine
+// and rejected on a machine of the other order.
+
+static const size_t KEY_ALIGN = 64;
+static const size_t HEADER_BYTES = 64;
+
+static const char IMAGE_MAGIC[8] = {'F', 'R', 'Z', 'I', 'N', 'D', 'E', 'X'};
+static const uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+struct ImageHeader {
+    char     magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t block_keys;
+    uint32_t reserved;
+    uint64_t key_count;
+    uint64_t key_slots;       // keys of every level, padding included
+    uint64_t data_checksum;   // over everything after the header
+    uint64_t header_checksum; // over the fields above
+};
+
+static_assert(sizeof(ImageHeader) <= HEADER_BYTES, "the image header outgrew its space");
+
+// FNV-1a, continued from hash
+static uint64_t checksum(const void *data, size_t bytes, uint64_t hash = 14695981039346656037ULL) {
+    const unsigned char *byte = static_cast<const unsigned char*>(data);
+    for(size_t i = 0; i < bytes; i++) {
+        hash = (hash ^ byte[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+static uint64_t header_checksum(const ImageHeader &header) {
+    return checksum(&header, offsetof(ImageHeader, header_checksum));
+}
+
+static size_t block_count(size_t keys) {
+    return (keys + FrozenIndex::BLOCK_KEYS - 1) / FrozenIndex::BLOCK_KEYS;
+}
+
+// Level sizes in keys, leaves first, up to a single root block
+static std::vector<size_t> level_sizes(size_t key_count) {
+    std::vector<size_t> level_keys = {block_count(key_count) * FrozenIndex::BLOCK_KEYS};
+    while(level_keys.back() > FrozenIndex::BLOCK_KEYS) {
+        size_t children = block_count(level_keys.back());
+        level_keys.push_back((children + FrozenIndex::FANOUT - 1) / FrozenIndex::FANOUT * FrozenIndex::BLOCK_KEYS);
+    }
+    return level_keys;
+}
+
+// Start of each level in offsets, returns the total key slots
+static size_t level_offsets(const std::vector<size_t> &level_keys, std::vector<size_t> &offsets) {
+    size_t total = 0;
+    offsets.clear();
+    for(size_t level_size : level_keys) {
+        offsets.push_back(total);
+        total += level_size;
+    }
+    return total;
+}
+
+static size_t rank_scalar(const int *block, int key) {
+    size_t rank = 0;
+    for(size_t i = 0; i < FrozenIndex::BLOCK_KEYS; i++) {
+        rank += block[i] < key;
+    }
+    return rank;
+}
+
+#ifdef FROZEN_INDEX_X86
+__attribute__((target("sse4.2,popcnt")))
+static inline size_t rank_sse42(const int *block, __m128i probe) {
+    const __m128i *lanes = reinterpret_cast<const __m128i*>(block);
+    __m128i less0 = _mm_cmpgt_epi32(probe, _mm_load_si128(lanes));
+    __m128i less1 = _mm_cmpgt_epi32(probe, _mm_load_si128(lanes + 1));
+    __m128i less2 = _mm_cmpgt_epi32(probe, _mm_load_si128(lanes + 2));
+    __m128i less3 = _mm_cmpgt_epi32(probe, _mm_load_si128(lanes + 3));
+
+    // Narrow the 16 masks to one byte each
+    __m128i packed = _mm_packs_epi16(_mm_packs_epi32(less0, less1), _mm_packs_epi32(less2, less3));
+    return __builtin_popcount(_mm_movemask_epi8(packed));
+}
+
+__attribute__((target("avx2,popcnt")))
+static inline size_t rank_avx2(const int *block, __m256i probe) {
+    const __m256i *lanes = reinterpret_cast<const __m256i*>(block);
+    __m256i less0 = _mm256_cmpgt_epi32(probe, _mm256_load_si256(lanes));
+    __m256i less1 = _mm256_cmpgt_epi32(probe, _mm256_load_si256(lanes + 1));
+
+    // Each mask becomes two bytes, the lane order does not matter to a count
+    __m256i packed = _mm256_packs_epi32(less0, less1);
+    return __builtin_popcount((unsigned)_mm256_movemask_epi8(packed)) / 2;
+}
+#endif
+
+const char* search_kernel_name(SearchKernel kernel) {
+    switch(kernel) {
+        case SearchKernel::scalar: return "scalar";
+        case SearchKernel::sse42:  return "sse4.2";
+        case SearchKernel::avx2:   return "avx2";
+    }
+    return "unknown";
+}
+
+FrozenIndex::FrozenIndex() : FrozenIndex(nullptr, nullptr) {}
+
+FrozenIndex::FrozenIndex(const std::pair<int, int> *begin, const std::pair<int, int> *end)
+    : image(nullptr), image_bytes(0), mapped(false), key_count(end - begin), kernel(best_kernel()) {
+    std::vector<size_t> level_keys = level_sizes(key_count);
+    size_t total = level_offsets(level_keys, offsets);
+
+    image_bytes = HEADER_BYTES + (total + key_count) * sizeof(int);
+    image = static_cast<unsigned char*>(::operator new(image_bytes, std::align_val_t(KEY_ALIGN)));
+    int *key_slots = reinterpret_cast<int*>(image + HEADER_BYTES);
+    int *value_slots = key_slots + total;
+    keys = key_slots;
+    values = value_slots;
+
+    for(size_t i = 0; i < key_count; i++) {
+        key_slots[i] = begin[i].first;
+        value_slots[i] = begin[i].second;
+    }
+    for(size_t i = key_count; i < level_keys[0]; i++) {
+        key_slots[i] = INT_MAX;
+    }
+
+    // Leftmost leaf block under block b of level h is b * FANOUT^h
+    size_t span = 1;
+    for(size_t h = 1; h < level_keys.size(); h++) {
+        span *= FANOUT;
+        for(size_t i = 0; i < level_keys[h]; i++) {
+            size_t block = i / BLOCK_KEYS;
+            size_t child = block * FANOUT + i % BLOCK_KEYS + 1;
+            size_t first_key = child * (span / FANOUT) * BLOCK_KEYS;
+            key_slots[offsets[h] + i] = (first_key < key_count) ? key_slots[first_key] : INT_MAX;
+        }
+    }
+
+    ImageHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, IMAGE_MAGIC, sizeof(header.magic));
+    header.version = IMAGE_VERSION;
+    header.byte_order = BYTE_ORDER_MARK;
+    header.block_keys = BLOCK_KEYS;
+    header.key_count = key_count;
+    header.key_slots = total;
+    header.data_checksum = checksum(image + HEADER_BYTES, image_bytes - HEADER_BYTES);
+    header.header_checksum = header_checksum(header);
+
+    memset(image, 0, HEADER_BYTES);
+    memcpy(image, &header, sizeof(header));
+}
+
+FrozenIndex::~FrozenIndex() {
+    release();
+}
+
+void FrozenIndex::release() {
+    if(mapped) {
+        munmap(image, image_bytes);
+    } else {
+        ::operator delete(image, std::align_val_t(KEY_ALIGN));
+    }
+    image = nullptr;
+    image_bytes = 0;
+    mapped = false;
+    keys = values = nullptr;
+    offsets.clear();
+    key_count = 0;
+}
+
+FrozenIndex::FrozenIndex(FrozenIndex &&other) noexcept
+    : image(other.image), image_bytes(other.image_bytes), mapped(other.mapped), keys(other.keys), values(other.values),
+      offsets(std::move(other.offsets)), key_count(other.key_count), kernel(other.kernel) {
+    other.image = nullptr;
+    other.mapped = false;
+    other.release();
+}
+
+FrozenIndex& FrozenIndex::operator=(FrozenIndex &&other) noexcept {
+    if(this != &other) {
+        release();
+        image = other.image;
+        image_bytes = other.image_bytes;
+        mapped = other.mapped;
+        keys = other.keys;
+        values = other.values;
+        offsets = std::move(other.offsets);
+        key_count = other.key_count;
+        kernel = other.kernel;
+
+        other.image = nullptr;
+        other.mapped = false;
+        other.release();
+    }
+    return *this;
+}
+
+static bool write_all(int fd, const void *data, size_t bytes) {
+    const char *next = static_cast<const char*>(data);
+    while(bytes > 0) {
+        ssize_t written = write(fd, next, bytes);
+        if(written < 0) {
+            return false;
+        }
+        next += written;
+        bytes -= written;
+    }
+    return true;
+}
+
+// Makes a rename in path's directory durable
+static bool sync_directory(const std::string &path) {
+    std::string::size_type slash = path.rfind('/');
+    std::string directory = (slash == std::string::npos) ? "." : path.substr(0, slash + (slash == 0));
+    int fd = ::open(directory.c_str(), O_RDONLY);
+    if(fd < 0) {
+        return false;
+    }
+    bool synced = fsync(fd) == 0;
+    close(fd);
+    return synced;
+}
+
+// The image goes to a temporary file that is renamed over path once it is
+// on disk, so a crash leaves the old file or the new one, and indexes that
+// have the old file mapped keep reading it
+bool FrozenIndex::save(const std::string &path) const {
+    if(image == nullptr) {
+        return false;
+    }
+
+    std::string temporary = path + ".tmp";
+    int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0) {
+        return false;
+    }
+
+    bool written = write_all(fd, image, image_bytes) && fsync(fd) == 0;
+    written = (close(fd) == 0) && written;
+    if(!written) {
+        unlink(temporary.c_str());
+        return false;
+    }
+    return rename(temporary.c_str(), path.c_str()) == 0 && sync_directory(path);
+}
+
+bool FrozenIndex::open(const std::string &path, bool verify_data) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if(fd < 0) {
+        return false;
+    }
+
+    struct stat info;
+    if(fstat(fd, &info) != 0 || (size_t)info.st_size < HEADER_BYTES) {
+        close(fd);
+        return false;
+    }
+
+    size_t bytes = info.st_size;
+    void *memory = mmap(nullptr, bytes, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(memory == MAP_FAILED) {
+        return false;
+    }
+
+    // The header says how large the rest should be, the file has to agree
+    ImageHeader header;
+    memcpy(&header, memory, sizeof(header));
+    std::vector<size_t> image_offsets;
+    bool valid = memcmp(header.magic, IMAGE_MAGIC, sizeof(header.magic)) == 0 &&
+                 header.version == IMAGE_VERSION &&
+                 header.byte_order == BYTE_ORDER_MARK &&
+                 header.block_keys == BLOCK_KEYS &&
+                 header.header_checksum == header_checksum(header) &&
+                 header.key_count <= (bytes - HEADER_BYTES) / sizeof(int) &&
+                 header.key_slots == level_offsets(level_sizes(header.key_count), image_offsets) &&
+                 bytes == HEADER_BYTES + (header.key_slots + header.key_count) * sizeof(int);
+    if(valid && verify_data) {
+        valid = header.data_checksum == checksum(static_cast<unsigned char*>(memory) + HEADER_BYTES, bytes - HEADER_BYTES);
+    }
+    if(!valid) {
+        munmap(memory, bytes);
+        return false;
+    }
+
+    release();
+    image = static_cast<unsigned char*>(memory);
+    image_bytes = bytes;
+    mapped = true;
+    keys = reinterpret_cast<const int*>(image + HEADER_BYTES);
+    values = keys + header.key_slots;
+    offsets = std::move(image_offsets);
+    key_count = header.key_count;
+    return true;
+}
+
+bool FrozenIndex::is_mapped() const {
+    return mapped;
+}
+
+bool FrozenIndex::kernel_supported(SearchKernel kernel) {
+    switch(kernel) {
+        case SearchKernel::scalar:
+            return true;
+#ifdef FROZEN_INDEX_X86
+        case SearchKernel::sse42:
+            return __builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt");
+        case SearchKernel::avx2:
+            return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+#endif
+        default:
+            return false;
+    }
+}
+
+SearchKernel FrozenIndex::best_kernel() {
+    if(kernel_supported(SearchKernel::avx2)) {
+        return SearchKernel::avx2;
+    }
+    if(kernel_supported(SearchKernel::sse42)) {
+        return SearchKernel::sse42;
+    }
+    return SearchKernel::scalar;
+}
+
+SearchKernel FrozenIndex::get_kernel() const {
+    return kernel;
+}
+
+bool FrozenIndex::set_kernel(SearchKernel kernel) {
+    if(!kernel_supported(kernel)) {
+        return false;
+    }
+    this->kernel = kernel;
+    return true;
+}
+
+size_t FrozenIndex::size() const {
+    return key_count;
+}
+
+// Each level turns block start k into the start of the chosen child block,
+// (k / BLOCK_KEYS * FANOUT + rank) * BLOCK_KEYS
+
+size_t FrozenIndex::lower_bound_scalar(int key) const {
+    size_t k = 0;
+    for(size_t h = offsets.size() - 1; h > 0; h--) {
+        k = k * FANOUT + rank_scalar(keys + offsets[h] + k, key) * BLOCK_KEYS;
+    }
+    return k + rank_scalar(keys + k, key);
+}
+
+#ifdef FROZEN_INDEX_X86
+__attribute__((target("sse4.2,popcnt")))
+size_t FrozenIndex::lower_bound_sse42(int key) const {
+    __m128i probe = _mm_set1_epi32(key);
+    size_t k = 0;
+    for(size_t h = offsets.size() - 1; h > 0; h--) {
+        k = k * FANOUT + rank_sse42(keys + offsets[h] + k, probe) * BLOCK_KEYS;
+    }
+    return k + rank_sse42(keys + k, probe);
+}
+
+__attribute__((target("avx2,popcnt")))
+size_t FrozenIndex::lower_bound_avx2(int key) const {
+    __m256i probe = _mm256_set1_epi32(key);
+    size_t k = 0;
+    for(size_t h = offsets.size() - 1; h > 0; h--) {
+        k = k * FANOUT + rank_avx2(keys + offsets[h] + k, probe) * BLOCK_KEYS;
+    }
+    return k + rank_avx2(keys + k, probe);
+}
+#else
+size_t FrozenIndex::lower_bound_sse42(int key) const {
+    return lower_bound_scalar(key);
+}
+
+size_t FrozenIndex::lower_bound_avx2(int key) const {
+    return lower_bound_scalar(key);
+}
+#endif
+
+size_t FrozenIndex::lower_bound_index(int key) const {
+    if(key_count == 0) {
+        return 0;
+    }
+
+    switch(kernel) {
+        case SearchKernel::avx2:  return lower_bound_avx2(key);
+        case SearchKernel::sse42: return lower_bound_sse42(key);
+        default:                  return lower_bound_scalar(key);
+    }
+}
+
+size_t FrozenIndex::find_index(int key) const {
+    size_t index = lower_bound_index(key);
+    return (index < key_count && keys[index] == key) ? index : key_count;
+}
+
+int FrozenIndex::search(int key) const {
+    size_t index = find_index(key);
+    return (index < key_count) ? values[index] : -1;
+}
+
+// With equal keys, the neighbours are taken around the first one
+
+int FrozenIndex::get_predecessor(int key) const {
+    size_t index = find_index(key);
+    return (index < key_count && index > 0) ? values[index - 1] : -1;
+}
+
+int FrozenIndex::get_successor(int key) const {
+    size_t index = find_index(key);
+    return (index + 1 < key_count) ? values[index + 1] : -1;
+}
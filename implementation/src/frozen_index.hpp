@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Ways FrozenIndex can rank a probe against a block of keys
+enum class SearchKernel {
+    scalar, sse42, avx2
+};
+
+const char* search_kernel_name(SearchKernel kernel);
+
+// Immutable, pointer-free search index over int keys, built from sorted
+// (key, value) pairs, usually by a tree's freeze(). The keys are laid out as
+// a static B+tree of 16-key blocks, each one 64-byte cache line, with every
+// level stored contiguously so a child's position is computed rather than
+// loaded. A lookup counts the keys below the probe in one block per level
+// with SIMD compares, a movemask and a popcount, so it takes no
+// data-dependent branch. The best kernel the CPU supports is picked when
+// the index is built.
+//
+// The index lives in one position-independent image: a header, the keys of
+// every level and the values, with no pointers in between. save() writes
+// the image to a file as it is, and open() maps such a file read-only, so
+// reopening an index costs no pass over its entries and processes that open
+// the same file share its pages in the page cache.
+class FrozenIndex {
+    public:
+        static constexpr size_t BLOCK_KEYS = 16;
+        static constexpr size_t FANOUT = BLOCK_KEYS + 1;
+
+        // Bumped whenever the image layout changes, open() rejects other versions
+        static constexpr uint32_t IMAGE_VERSION = 1;
+
+    private:
+        unsigned char *image;        // heap memory, or a file mapping when mapped
+        size_t image_bytes;
+        bool mapped;
+        const int *keys;             // every level, the sorted keys first
+        const int *values;           // in key order
+        std::vector<size_t> offsets; // start of each level in keys, leaves first
+        size_t key_count;
+        SearchKernel kernel;
+
+        void release();
+
+        // Index of the first key not less than key, key_count if there is none
+        size_t lower_bound_index(int key) const;
+        size_t lower_bound_scalar(int key) const;
+        size_t lower_bound_sse42(int key) const;
+        size_t lower_bound_avx2(int key) const;
+
+        // Index of key when it is present, key_count otherwise
+        size_t find_index(int key) const;
+
+    public:
+        FrozenIndex();
+        FrozenIndex(const std::pair<int, int> *begin, const std::pair<int, int> *end);
+        ~FrozenIndex();
+
+        FrozenIndex(FrozenIndex &&other) noexcept;
+        FrozenIndex& operator=(FrozenIndex &&other) noexcept;
+        FrozenIndex(const FrozenIndex &) = delete;
+        FrozenIndex& operator=(const FrozenIndex &) = delete;
+
+        static bool kernel_supported(SearchKernel kernel);
+        static SearchKernel best_kernel();
+
+        SearchKernel get_kernel() const;
+        bool set_kernel(SearchKernel kernel); // false, and no change, when the CPU lacks it
+
+        size_t size() const;
+
+        // Writes the image to path through a temporary file renamed over
+        // it, false when the file cannot be written
+        bool save(const std::string &path) const;
+
+        // Replaces the index with the image saved in path, mapped read-only.
+        // Only the header is checked unless verify_data is set, which reads
+        // the whole file to compare its checksum. False, and no change, when
+        // the file cannot be mapped or is not an image of this version
+        bool open(const std::string &path, bool verify_data = false);
+
+        bool is_mapped() const;
+
+        // Missing keys are reported as -1, like the trees
+        int search(int key) const;
+        int get_predecessor(int key) const;
+        int get_successor(int key) const;
+
+        // Calls visit(key, value) for every entry with a key in [lo, hi], in key order
+        template<class Visit>
+        void range(int lo, int hi, Visit visit) const {
+            if(hi < lo) {
+                return;
+            }
+            for(size_t i = lower_bound_index(lo); i < key_count && keys[i] <= hi; i++) {
+                visit(keys[i], values[i]);
+            }
+        }
+};
@@ -0,0 +1,540 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "avl_tree.hpp"
+#include "binary_search_tree.hpp"
+#include "bplus_tree.hpp"
+#include "red_black_tree.hpp"
+
+// When LoggedTree forces its log to disk
+enum class SyncPolicy {
+    none,  // groups are written, flushing them to disk is left to the OS
+    group, // every group is fsynced once written
+    always // every record is written and fsynced before insert or remove returns
+};
+
+// Write-ahead log around an int tree (BinarySearchTree, RedBlackTree,
+// AVLTree or BPlusTree). insert and remove append a 16-byte binary record to
+// a buffer that is written a group at a time, so many records share one
+// write and, under SyncPolicy::group, one fsync. commit() makes every record
+// so far durable whatever the policy.
+//
+// checkpoint() writes the whole tree to a checkpoint file and starts the log
+// over, which bounds recovery to loading one checkpoint and replaying the
+// records logged since. It takes time in the size of the tree, so inserts
+// never run it: checkpoint_due() turns true once checkpoint_records records
+// are in the log, and the caller picks a moment where the pause does no
+// harm. The checkpoint and the log carry a generation number, so a crash
+// between writing the checkpoint and resetting the log never replays
+// records the checkpoint already holds.
+//
+// open() recovers the tree: it reads the checkpoint and the log in large
+// sequential chunks, and the checkpoint, together with a run of inserts in
+// key order right after it, is loaded through build_from_sorted rather than
+// inserted. A crash in the middle of a write can only damage the records of
+// that last write, so a run of bad records that reaches the end of the log
+// and is no longer than one write (the log header records how many records
+// a write can hold) is cut off. A bad record anywhere else, or a header or
+// checkpoint that fails its checksum, fails the open instead of losing the
+// records after it.
+//
+// With equal keys, a replayed remove may take a different entry with that
+// key than the original remove did, since the trees remove whichever one
+// their search reaches first. The keys and the count of each key are exact.
+//
+// One thread at a time, like the trees.
+template<class Tree>
+class LoggedTree {
+    public:
+        static constexpr size_t DEFAULT_GROUP_RECORDS = 4096; // 64 KiB per write
+        static constexpr size_t DEFAULT_CHECKPOINT_RECORDS = 1 << 22;
+
+        // Records read per chunk during recovery, 1 MiB
+        static constexpr size_t REPLAY_CHUNK_RECORDS = 1 << 16;
+
+    private:
+        static constexpr uint32_t FILE_VERSION = 2;
+
+        enum Operation : uint32_t {
+            INSERT = 1,
+            REMOVE = 2
+        };
+
+        struct Record {
+            int32_t  key;
+            int32_t  value;
+            uint32_t operation;
+            uint32_t check; // tells a whole record from a torn or stale one
+        };
+
+        // Starts both the log and the checkpoint
+        struct FileHeader {
+            char     magic[8];
+            uint32_t version;
+            uint32_t write_records; // most records one write appends to a log, 0 in a checkpoint
+            uint64_t generation;
+            uint64_t count;         // entries in a checkpoint, 0 in a log
+            uint64_t checksum;      // of the fields above, then a checkpoint's entries
+        };
+
+        static constexpr char LOG_MAGIC[8] = {'T', 'R', 'E', 'E', 'L', 'O', 'G', '1'};
+        static constexpr char CHECKPOINT_MAGIC[8] = {'T', 'R', 'E', 'E', 'C', 'K', 'P', '1'};
+
+        Tree tree;
+        std::string path;
+        int log_fd;
+        SyncPolicy policy;
+        size_t group_records;
+        size_t log_write_records;   // as in the log's header
+        size_t checkpoint_records;
+        uint64_t generation;
+        size_t records_since_checkpoint;
+        std::vector<Record> pending; // not yet written
+        bool failed;                 // a write or fsync failed, the log is no longer trusted
+
+        // FNV-1a, continued from hash
+        static uint64_t checksum(const void *data, size_t bytes, uint64_t hash = 14695981039346656037ULL) {
+            const unsigned char *byte = static_cast<const unsigned char*>(data);
+            for(size_t i = 0; i < bytes; i++) {
+                hash = (hash ^ byte[i]) * 1099511628211ULL;
+            }
+            return hash;
+        }
+
+        // A 64-bit finalizer over the record's fields, cheap enough to run on
+        // every insert. The generation is mixed in, so a record from an
+        // older log never passes
+        static uint32_t record_check(const Record &record, uint64_t generation) {
+            uint64_t hash = ((uint64_t)(uint32_t)record.key << 32 | (uint32_t)record.value) ^
+                            (generation * 4 + record.operation) * 0x9E3779B97F4A7C15ULL;
+            hash = (hash ^ (hash >> 33)) * 0xFF51AFD7ED558CCDULL;
+            hash = (hash ^ (hash >> 33)) * 0xC4CEB9FE1A85EC53ULL;
+            return (uint32_t)(hash ^ (hash >> 33));
+        }
+
+        static FileHeader make_header(const char (&magic)[8], uint64_t generation) {
+            FileHeader header;
+            memset(&header, 0, sizeof(header));
+            memcpy(header.magic, magic, sizeof(header.magic));
+            header.version = FILE_VERSION;
+            header.generation = generation;
+            return header;
+        }
+
+        // Checksum of a header's fields before the checksum itself
+        static uint64_t header_checksum(const FileHeader &header) {
+            return checksum(&header, offsetof(FileHeader, checksum));
+        }
+
+        static bool valid_header(const FileHeader &header, const char (&magic)[8]) {
+            return memcmp(header.magic, magic, sizeof(header.magic)) == 0 && header.version == FILE_VERSION;
+        }
+
+        static bool valid_log_header(const FileHeader &header) {
+            return valid_header(header, LOG_MAGIC) && header.checksum == header_checksum(header);
+        }
+
+        static bool write_all(int fd, const void *data, size_t bytes) {
+            const char *next = static_cast<const char*>(data);
+            while(bytes > 0) {
+                ssize_t written = ::write(fd, next, bytes);
+                if(written < 0) {
+                    return false;
+                }
+                next += written;
+                bytes -= written;
+            }
+            return true;
+        }
+
+        // Reads up to bytes, fewer only at the end of the file
+        static ssize_t read_all(int fd, void *data, size_t bytes) {
+            char *next = static_cast<char*>(data);
+            size_t total = 0;
+            while(total < bytes) {
+                ssize_t count = ::read(fd, next + total, bytes - total);
+                if(count < 0) {
+                    return -1;
+                }
+                if(count == 0) {
+                    break;
+                }
+                total += count;
+            }
+            return total;
+        }
+
+        std::string log_path() const        { return path + ".log"; }
+        std::string checkpoint_path() const { return path + ".checkpoint"; }
+
+        // Reads the checkpoint into entries. A missing checkpoint is
+        // generation 0 with no entries, a damaged one fails. The count is
+        // checked against the file size before anything is allocated for it
+        bool read_checkpoint(std::vector<std::pair<int, int>> &entries, uint64_t &checkpoint_generation) {
+            entries.clear();
+            checkpoint_generation = 0;
+
+            int fd = ::open(checkpoint_path().c_str(), O_RDONLY);
+            if(fd < 0) {
+                return true;
+            }
+
+            FileHeader header;
+            struct stat status;
+            bool valid = read_all(fd, &header, sizeof(header)) == (ssize_t)sizeof(header) && valid_header(header, CHECKPOINT_MAGIC) &&
+                         fstat(fd, &status) == 0 && status.st_size >= (off_t)sizeof(header) &&
+                         header.count == ((uint64_t)status.st_size - sizeof(header)) / (2 * sizeof(int32_t)) &&
+                         (status.st_size - sizeof(header)) % (2 * sizeof(int32_t)) == 0;
+            if(valid) {
+                std::vector<int32_t> chunk(2 * REPLAY_CHUNK_RECORDS);
+                uint64_t hash = header_checksum(header);
+                size_t left = header.count;
+                entries.reserve(left);
+                while(valid && left > 0) {
+                    size_t count = std::min(left, REPLAY_CHUNK_RECORDS);
+                    size_t bytes = count * 2 * sizeof(int32_t);
+                    valid = read_all(fd, chunk.data(), bytes) == (ssize_t)bytes;
+                    hash = checksum(chunk.data(), bytes, hash);
+                    for(size_t i = 0; valid && i < count; i++) {
+                        entries.push_back({chunk[2 * i], chunk[2 * i + 1]});
+                    }
+                    left -= count;
+                }
+                valid = valid && hash == header.checksum;
+            }
+            close(fd);
+
+            checkpoint_generation = header.generation;
+            return valid;
+        }
+
+        bool write_checkpoint(const std::vector<std::pair<int, int>> &entries, uint64_t checkpoint_generation) {
+            std::string temporary = checkpoint_path() + ".tmp";
+            int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if(fd < 0) {
+                return false;
+            }
+
+            std::vector<int32_t> flat;
+            flat.reserve(2 * entries.size());
+            for(const std::pair<int, int> &entry : entries) {
+                flat.push_back(entry.first);
+                flat.push_back(entry.second);
+            }
+
+            FileHeader header = make_header(CHECKPOINT_MAGIC, checkpoint_generation);
+            header.count = entries.size();
+            header.checksum = checksum(flat.data(), flat.size() * sizeof(int32_t), header_checksum(header));
+
+            bool written = write_all(fd, &header, sizeof(header)) && write_all(fd, flat.data(), flat.size() * sizeof(int32_t)) &&
+                           fsync(fd) == 0;
+            written = (close(fd) == 0) && written;
+
+            // The rename swaps the checkpoint in whole, a crash leaves the old one
+            return written && rename(temporary.c_str(), checkpoint_path().c_str()) == 0 && sync_directory();
+        }
+
+        // Makes a rename in the log's directory durable
+        bool sync_directory() const {
+            std::string::size_type slash = path.rfind('/');
+            std::string directory = (slash == std::string::npos) ? "." : path.substr(0, slash + (slash == 0));
+            int fd = ::open(directory.c_str(), O_RDONLY);
+            if(fd < 0) {
+                return false;
+            }
+            bool synced = fsync(fd) == 0;
+            close(fd);
+            return synced;
+        }
+
+        // Most records one flush writes under the current policy
+        size_t write_records() const {
+            return (policy == SyncPolicy::always) ? 1 : group_records;
+        }
+
+        FileHeader make_log_header(uint64_t log_generation) const {
+            FileHeader header = make_header(LOG_MAGIC, log_generation);
+            header.write_records = (uint32_t)log_write_records;
+            header.checksum = header_checksum(header);
+            return header;
+        }
+
+        // Empties the log and starts it at generation
+        bool reset_log(uint64_t log_generation) {
+            log_write_records = write_records();
+            FileHeader header = make_log_header(log_generation);
+            return ftruncate(log_fd, 0) == 0 && lseek(log_fd, 0, SEEK_SET) == 0 && write_all(log_fd, &header, sizeof(header)) &&
+                   fsync(log_fd) == 0;
+        }
+
+        // Raises the write size in the header of a log that is reopened with
+        // larger groups, before any of them is written
+        bool widen_log_writes() {
+            if(write_records() <= log_write_records) {
+                return true;
+            }
+            log_write_records = write_records();
+            FileHeader header = make_log_header(generation);
+            return pwrite(log_fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header) && fsync(log_fd) == 0;
+        }
+
+        void apply(const Record &record) {
+            if(record.operation == INSERT) {
+                tree.insert(record.key, record.value);
+            } else {
+                tree.remove(record.key);
+            }
+        }
+
+        bool whole(const Record &record) const {
+            return record.check == record_check(record, generation) && (record.operation == INSERT || record.operation == REMOVE);
+        }
+
+        // Applies the log after the checkpoint's entries. While the records
+        // are inserts in key order they are appended to entries, which go
+        // into the tree in one build_from_sorted. Bad records are a torn
+        // last write only when no whole record follows them and they fit in
+        // one write, then the log is cut off before them. Otherwise the log
+        // is damaged and replay fails
+        bool replay(std::vector<std::pair<int, int>> &entries) {
+            bool bulk = true;
+            off_t end = sizeof(FileHeader);
+            size_t bad = 0; // records from the first bad one on, a partial record counts as one
+            std::vector<Record> chunk(REPLAY_CHUNK_RECORDS);
+
+            for(;;) {
+                ssize_t bytes = read_all(log_fd, chunk.data(), chunk.size() * sizeof(Record));
+                if(bytes < 0) {
+                    return false;
+                }
+
+                size_t count = bytes / sizeof(Record);
+                for(size_t i = 0; i < count; i++) {
+                    const Record &record = chunk[i];
+                    if(!whole(record)) {
+                        bad++;
+                        continue;
+                    }
+                    if(bad > 0) {
+                        return false; // a whole record after a bad one
+                    }
+
+                    end += sizeof(Record);
+                    records_since_checkpoint++;
+                    if(bulk && record.operation == INSERT && (entries.empty() || entries.back().first <= record.key)) {
+                        entries.push_back({record.key, record.value});
+                        continue;
+                    }
+                    if(bulk) {
+                        tree.build_from_sorted(entries.data(), entries.data() + entries.size());
+                        bulk = false;
+                    }
+                    apply(record);
+                }
+
+                if((size_t)bytes < chunk.size() * sizeof(Record)) {
+                    bad += (bytes % sizeof(Record) != 0);
+                    break;
+                }
+            }
+
+            if(bad > std::max<size_t>(log_write_records, 1)) {
+                return false;
+            }
+            if(bulk) {
+                tree.build_from_sorted(entries.data(), entries.data() + entries.size());
+            }
+            return bad == 0 || ftruncate(log_fd, end) == 0;
+        }
+
+        // Writes the pending records, and fsyncs them when sync is set
+        bool flush(bool sync) {
+            if(log_fd < 0 || failed) {
+                return false;
+            }
+
+            if(!pending.empty()) {
+                failed = !write_all(log_fd, pending.data(), pending.size() * sizeof(Record));
+                pending.clear();
+            }
+            if(sync && !failed) {
+                failed = fdatasync(log_fd) != 0;
+            }
+            return !failed;
+        }
+
+        // Queues a record, writing the group when it is full. False when no
+        // log is open or a write or fsync failed, now or earlier
+        bool append(Operation operation, int key, int value) {
+            if(log_fd < 0 || failed) {
+                return false;
+            }
+
+            Record record = {key, value, operation, 0};
+            record.check = record_check(record, generation);
+            pending.push_back(record);
+
+            if(policy == SyncPolicy::always) {
+                flush(true);
+            } else if(pending.size() >= group_records) {
+                flush(policy == SyncPolicy::group);
+            }
+            records_since_checkpoint++;
+            return !failed;
+        }
+
+    public:
+        LoggedTree() : log_fd(-1), policy(SyncPolicy::group), group_records(DEFAULT_GROUP_RECORDS), log_write_records(0),
+                       checkpoint_records(DEFAULT_CHECKPOINT_RECORDS), generation(0), records_since_checkpoint(0), failed(false) {}
+
+        ~LoggedTree() {
+            close_log();
+        }
+
+        LoggedTree(const LoggedTree &) = delete;
+        LoggedTree& operator=(const LoggedTree &) = delete;
+
+        // Recovers the tree from path.checkpoint and path.log, creating them
+        // when they do not exist, and logs every write from then on. False
+        // when the files cannot be read or written or are damaged anywhere
+        // but a torn last write at the end of the log. checkpoint_records
+        // only sets when checkpoint_due() turns true
+        bool open(const std::string &path, SyncPolicy policy = SyncPolicy::group, size_t group_records = DEFAULT_GROUP_RECORDS,
+                  size_t checkpoint_records = DEFAULT_CHECKPOINT_RECORDS) {
+            close_log();
+            this->path = path;
+            this->policy = policy;
+            this->group_records = std::max<size_t>(group_records, 1);
+            this->checkpoint_records = std::max<size_t>(checkpoint_records, 1);
+            records_since_checkpoint = 0;
+            failed = false;
+
+            std::vector<std::pair<int, int>> entries;
+            uint64_t checkpoint_generation;
+            if(!read_checkpoint(entries, checkpoint_generation)) {
+                return false;
+            }
+            generation = checkpoint_generation;
+
+            log_fd = ::open(log_path().c_str(), O_RDWR | O_CREAT, 0644);
+            if(log_fd < 0) {
+                return false;
+            }
+
+            FileHeader header;
+            ssize_t bytes = read_all(log_fd, &header, sizeof(header));
+            bool ok;
+            if(bytes == 0 || (bytes == (ssize_t)sizeof(header) && valid_log_header(header) && header.generation < generation)) {
+                // A new log, or one the checkpoint already holds
+                tree.build_from_sorted(entries.data(), entries.data() + entries.size());
+                ok = reset_log(generation);
+            } else if(bytes == (ssize_t)sizeof(header) && valid_log_header(header) && header.generation == generation) {
+                log_write_records = header.write_records;
+                ok = replay(entries) && widen_log_writes();
+            } else {
+                ok = false;
+            }
+
+            // Appends go after the last whole record
+            if(!ok || lseek(log_fd, 0, SEEK_END) < 0) {
+                close(log_fd);
+                log_fd = -1;
+                return false;
+            }
+            return true;
+        }
+
+        // Writes what is pending and closes the log. Writes after this are
+        // no longer logged
+        void close_log() {
+            if(log_fd >= 0) {
+                flush(policy != SyncPolicy::none);
+                close(log_fd);
+                log_fd = -1;
+            }
+        }
+
+        // Makes every record so far durable. False when a write or fsync
+        // failed, now or earlier
+        bool commit() {
+            return flush(true);
+        }
+
+        // Writes the whole tree to a new checkpoint and empties the log. Takes
+        // time in the size of the tree, see checkpoint_due()
+        bool checkpoint() {
+            if(!commit()) {
+                return false;
+            }
+
+            records_since_checkpoint = 0;
+            failed = !write_checkpoint(tree.entries(), generation + 1) || !reset_log(generation + 1);
+            if(!failed) {
+                generation++;
+            }
+            return !failed;
+        }
+
+        // Records the last recovery replayed plus those logged since, which
+        // is what the next recovery would replay
+        size_t log_records() const {
+            return records_since_checkpoint;
+        }
+
+        // True once the log holds checkpoint_records records. Nothing
+        // checkpoints on its own, the caller runs checkpoint() when a pause
+        // suits it
+        bool checkpoint_due() const {
+            return records_since_checkpoint >= checkpoint_records;
+        }
+
+        // The tree changes either way. False when the write could not be
+        // logged: no log is open, or a write or fsync failed, now or
+        // earlier. Under SyncPolicy::always true means the record is on
+        // disk, under the others that it is queued
+        bool insert(int data) {
+            return insert(data, data);
+        }
+
+        bool insert(int key, int data) {
+            tree.insert(key, data);
+            return append(INSERT, key, data);
+        }
+
+        // A key that is not in the tree is not logged either
+        bool remove(int key) {
+            if(!tree.contains(key)) {
+                return log_fd >= 0 && !failed;
+            }
+            tree.remove(key);
+            return append(REMOVE, key, 0);
+        }
+
+        // Reads go straight to the tree
+        int search(int key)          { return tree.search(key); }
+        int get_min()                { return tree.get_min(); }
+        int get_max()                { return tree.get_max(); }
+        int get_predecessor(int key) { return tree.get_predecessor(key); }
+        int get_successor(int key)   { return tree.get_successor(key); }
+
+        std::vector<std::pair<int, int>> entries() const {
+            return tree.entries();
+        }
+};
+
+typedef LoggedTree<BinarySearchTree> LoggedBinarySearchTree;
+typedef LoggedTree<RedBlackTree> LoggedRedBlackTree;
+typedef LoggedTree<AVLTree> LoggedAVLTree;
+typedef LoggedTree<BPlusTree> LoggedBPlusTree;
@@ -0,0 +1,365 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "epoch.hpp"
+#include "node_pool.hpp"
+
+// Node layouts decide how OrderedMap stores and links its nodes. A layout's
+// Storage<Key, Value, NodeData> defines a NodeRef handle with a nil value,
+// creates and destroys nodes, reads and writes the links, key, value and
+// NodeData of a node, and can prefetch a node into the cache. Every node
+// also carries a 2-bit tag for the balancing policy (red-black color, AVL
+// balance factor), packed into the spare bits of its parent link and 0 for
+// a new node. OrderedMap and the balancing policies only touch nodes
+// through these accessors. A layout with shares_nodes lets one tree take
+// over another tree's nodes, which set operations and joins rely on.
+// create(key, args...) builds the value in the node from args, so values
+// can be move-only or built in place. begin_move(node) and end_move(node)
+// bracket any change that takes keys from below node, a rotation moving it
+// down or a successor leaving its subtree, and begin_move alone the removal
+// of node, for a layout whose readers check each step against the node they
+// came from; the other layouts ignore them.
+
+// Nodes linked by pointers, each one allocated from NodePool
+template<template<class> class NodePool = SlabPool>
+struct PointerLayout {
+    template<class Key, class Value, class NodeData>
+    class Storage {
+        public:
+            struct Node : NodeData {
+                Node *left;
+                Node *right;
+                uintptr_t parent_and_tag; // nodes are at least 4-byte aligned, the tag uses the low 2 bits
+                Key   key;
+                Value value;
+
+                template<class... Args>
+                Node(const Key &key, Args &&...args)
+                    : NodeData(), left(nullptr), right(nullptr), parent_and_tag(0), key(key), value(std::forward<Args>(args)...) {}
+            };
+
+            static_assert(alignof(Node) >= 4, "the low 2 bits of a node address hold the tag");
+
+            typedef Node* NodeRef;
+            static constexpr NodeRef nil = nullptr;
+            static constexpr uintptr_t TAG_MASK = 3;
+
+            // Freeing the pool also frees every node, without walking the tree
+            static constexpr bool bulk_release = NodePool<Node>::bulk_release && std::is_trivially_destructible<Node>::value;
+
+            // Nodes can move to another Storage of the same type, see share_with
+            static constexpr bool shares_nodes = true;
+
+        private:
+            NodePool<Node> pool;
+
+        public:
+            template<class... Args>
+            NodeRef create(const Key &key, Args &&...args) {
+                return new (pool.allocate()) Node(key, std::forward<Args>(args)...);
+            }
+
+            void destroy(NodeRef node) {
+                node->~Node();
+                pool.deallocate(node);
+            }
+
+            void release() {
+                pool.release();
+            }
+
+            // Lets other take over nodes created here, which then stay valid
+            // until both have released them
+            void share_with(Storage &other) {
+                pool.share_with(other.pool);
+            }
+
+            // Gives other the memory of every node, for a Storage whose nodes
+            // have all been taken over by other
+            void hand_over(Storage &other) {
+                pool.hand_over(other.pool);
+            }
+
+            size_t slab_count() const {
+                return pool.slab_count();
+            }
+
+            void reserve(size_t) {}
+
+            void begin_move(NodeRef) {}
+            void end_move(NodeRef) {}
+
+            void prefetch(NodeRef node) const { __builtin_prefetch(node); }
+
+            NodeRef left(NodeRef node) const   { return node->left; }
+            NodeRef right(NodeRef node) const  { return node->right; }
+            NodeRef parent(NodeRef node) const { return reinterpret_cast<NodeRef>(node->parent_and_tag & ~TAG_MASK); }
+            unsigned tag(NodeRef node) const   { return (unsigned)(node->parent_and_tag & TAG_MASK); }
+
+            void set_left(NodeRef node, NodeRef child)  { node->left = child; }
+            void set_right(NodeRef node, NodeRef child) { node->right = child; }
+
+            void set_parent(NodeRef node, NodeRef parent) {
+                node->parent_and_tag = reinterpret_cast<uintptr_t>(parent) | (node->parent_and_tag & TAG_MASK);
+            }
+
+            void set_tag(NodeRef node, unsigned tag) {
+                node->parent_and_tag = (node->parent_and_tag & ~TAG_MASK) | tag;
+            }
+
+            const Key& key(NodeRef node) const { return node->key; }
+            Value& value(NodeRef node) const   { return node->value; }
+            NodeData& data(NodeRef node) const { return *node; }
+    };
+};
+
+// Nodes kept in one contiguous array and linked by 32-bit indices, which
+// roughly halves the size of a node holding small keys and values. The tag
+// takes the top 2 bits of the parent index, so up to 2^30 - 1 nodes fit.
+// The array grows by copying, so keys and values have to be trivially
+// copyable, and removed slots are reused through a free list before the
+// array grows.
+struct CompactLayout {
+    template<class Key, class Value, class NodeData>
+    class Storage {
+        static_assert(std::is_trivially_copyable<Key>::value && std::is_trivially_copyable<Value>::value,
+                      "CompactLayout needs trivially copyable keys and values");
+
+        public:
+            typedef uint32_t NodeRef;
+            static constexpr uint32_t INDEX_MASK = 0x3FFFFFFF;
+            static constexpr uint32_t TAG_SHIFT = 30;
+            static constexpr NodeRef nil = INDEX_MASK;
+
+            struct Node : NodeData {
+                NodeRef  left;
+                NodeRef  right;
+                uint32_t parent_and_tag; // tag in the top 2 bits, parent index below
+                Key   key;
+                Value value;
+
+                template<class... Args>
+                Node(const Key &key, Args &&...args)
+                    : NodeData(), left(nil), right(nil), parent_and_tag(nil), key(key), value(std::forward<Args>(args)...) {}
+            };
+
+            static constexpr bool bulk_release = true;
+
+            // Indices only mean something in their own array
+            static constexpr bool shares_nodes = false;
+
+        private:
+            std::vector<Node> nodes;
+            NodeRef free_list; // removed slots, chained through their left index
+
+        public:
+            Storage() : free_list(nil) {}
+
+            template<class... Args>
+            NodeRef create(const Key &key, Args &&...args) {
+                if(free_list != nil) {
+                    NodeRef node = free_list;
+                    free_list = nodes[node].left;
+                    nodes[node] = Node(key, std::forward<Args>(args)...);
+                    return node;
+                }
+
+                if(nodes.size() >= nil) {
+                    throw std::length_error("CompactLayout holds at most 2^30 - 1 nodes");
+                }
+
+                nodes.emplace_back(key, std::forward<Args>(args)...);
+                return (NodeRef)(nodes.size() - 1);
+            }
+
+            void destroy(NodeRef node) {
+                nodes[node].left = free_list;
+                free_list = node;
+            }
+
+            void release() {
+                std::vector<Node>().swap(nodes);
+                free_list = nil;
+            }
+
+            void reserve(size_t count) {
+                nodes.reserve(count);
+            }
+
+            void begin_move(NodeRef) {}
+            void end_move(NodeRef) {}
+
+            void prefetch(NodeRef node) const { __builtin_prefetch(&nodes[node]); }
+
+            NodeRef left(NodeRef node) const   { return nodes[node].left; }
+            NodeRef right(NodeRef node) const  { return nodes[node].right; }
+            NodeRef parent(NodeRef node) const { return nodes[node].parent_and_tag & INDEX_MASK; }
+            unsigned tag(NodeRef node) const   { return nodes[node].parent_and_tag >> TAG_SHIFT; }
+
+            void set_left(NodeRef node, NodeRef child)  { nodes[node].left = child; }
+            void set_right(NodeRef node, NodeRef child) { nodes[node].right = child; }
+
+            void set_parent(NodeRef node, NodeRef parent) {
+                nodes[node].parent_and_tag = parent | (nodes[node].parent_and_tag & ~INDEX_MASK);
+            }
+
+            void set_tag(NodeRef node, unsigned tag) {
+                nodes[node].parent_and_tag = (nodes[node].parent_and_tag & INDEX_MASK) | ((uint32_t)tag << TAG_SHIFT);
+            }
+
+            const Key& key(NodeRef node) const     { return nodes[node].key; }
+            Value& value(NodeRef node)             { return nodes[node].value; }
+            const Value& value(NodeRef node) const { return nodes[node].value; }
+            NodeData& data(NodeRef node)             { return nodes[node]; }
+            const NodeData& data(NodeRef node) const { return nodes[node]; }
+    };
+};
+
+// Pointer-linked nodes that lock-free readers can walk while a single writer
+// changes the tree. Links are atomics stored with release and loaded with
+// acquire ordering, so a reader that reaches a node sees it fully built;
+// keys and values never change once a node is linked in. destroy() only
+// retires a node, reclaim() frees the retired nodes no reader can still be
+// looking at, tracked by an EpochDomain that readers enter and leave.
+// release() frees everything at once and needs all readers gone.
+//
+// Every node has a version, odd while the writer moves the node down in a
+// rotation or moves a successor out of its subtree, and odd for good once
+// the node is removed. Only those changes take keys away from below a
+// node, so a reader that read a child link and then finds the node's
+// version unchanged (validate) knows the child still leads to every key it
+// was after.
+struct ConcurrentLayout {
+    template<class Key, class Value, class NodeData>
+    class Storage {
+        public:
+            struct Node : NodeData {
+                std::atomic<Node*> left;
+                std::atomic<Node*> right;
+                std::atomic<uintptr_t> parent_and_tag; // tag in the low 2 bits, as in PointerLayout
+                std::atomic<uint32_t> version;
+                Key   key;
+                Value value;
+
+                template<class... Args>
+                Node(const Key &key, Args &&...args)
+                    : NodeData(), left(nullptr), right(nullptr), parent_and_tag(0), version(0), key(key),
+                      value(std::forward<Args>(args)...) {}
+            };
+
+            static_assert(alignof(Node) >= 4, "the low 2 bits of a node address hold the tag");
+
+            typedef Node* NodeRef;
+            static constexpr NodeRef nil = nullptr;
+            static constexpr uintptr_t TAG_MASK = 3;
+
+            static constexpr bool bulk_release = std::is_trivially_destructible<Node>::value;
+            static constexpr bool shares_nodes = false;
+
+            // Retired nodes wait for a batch before the reader slots are scanned
+            static constexpr size_t RECLAIM_BATCH = 64;
+
+        private:
+            SlabPool<Node> pool;
+            EpochDomain epochs;
+            std::vector<std::pair<uint64_t, NodeRef>> retired; // retiring epoch and node, oldest first
+
+        public:
+            template<class... Args>
+            NodeRef create(const Key &key, Args &&...args) {
+                return new (pool.allocate()) Node(key, std::forward<Args>(args)...);
+            }
+
+            void destroy(NodeRef node) {
+                retired.push_back({epochs.current(), node});
+            }
+
+            // Writer side, frees the retired nodes that have become unreachable
+            // for every reader
+            void reclaim() {
+                if(retired.size() < RECLAIM_BATCH) {
+                    return;
+                }
+
+                uint64_t epoch = epochs.try_advance();
+                size_t freed = 0;
+                while(freed < retired.size() && retired[freed].first + 2 <= epoch) {
+                    retired[freed].second->~Node();
+                    pool.deallocate(retired[freed].second);
+                    freed++;
+                }
+                retired.erase(retired.begin(), retired.begin() + freed);
+            }
+
+            void release() {
+                for(const std::pair<uint64_t, NodeRef> &entry : retired) {
+                    entry.second->~Node();
+                }
+                retired.clear();
+                pool.release();
+            }
+
+            void reserve(size_t) {}
+
+            // Writer side, as in a sequence lock: the odd version is stored
+            // before any link the move changes
+            void begin_move(NodeRef node) {
+                node->version.store(node->version.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_release);
+            }
+
+            void end_move(NodeRef node) {
+                node->version.store(node->version.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+            }
+
+            void prefetch(NodeRef node) const { __builtin_prefetch(node); }
+
+            // Reader side, a reader holds its slot while it touches nodes
+            size_t reader_enter() const      { return epochs.enter(); }
+            void reader_leave(size_t slot) const { epochs.leave(slot); }
+
+            // False while node is being moved or after it was removed
+            bool stable(NodeRef node, uint32_t &version) const {
+                version = node->version.load(std::memory_order_acquire);
+                return (version & 1) == 0;
+            }
+
+            // Whether node is unchanged since stable() returned version, for
+            // everything read from it in between
+            bool validate(NodeRef node, uint32_t version) const {
+                std::atomic_thread_fence(std::memory_order_acquire);
+                return node->version.load(std::memory_order_relaxed) == version;
+            }
+
+            NodeRef left(NodeRef node) const   { return node->left.load(std::memory_order_acquire); }
+            NodeRef right(NodeRef node) const  { return node->right.load(std::memory_order_acquire); }
+            NodeRef parent(NodeRef node) const { return reinterpret_cast<NodeRef>(node->parent_and_tag.load(std::memory_order_acquire) & ~TAG_MASK); }
+            unsigned tag(NodeRef node) const   { return (unsigned)(node->parent_and_tag.load(std::memory_order_relaxed) & TAG_MASK); }
+
+            void set_left(NodeRef node, NodeRef child)  { node->left.store(child, std::memory_order_release); }
+            void set_right(NodeRef node, NodeRef child) { node->right.store(child, std::memory_order_release); }
+
+            // Only the writer stores, so reading back its own tag needs no ordering
+            void set_parent(NodeRef node, NodeRef parent) {
+                uintptr_t tag = node->parent_and_tag.load(std::memory_order_relaxed) & TAG_MASK;
+                node->parent_and_tag.store(reinterpret_cast<uintptr_t>(parent) | tag, std::memory_order_release);
+            }
+
+            void set_tag(NodeRef node, unsigned tag) {
+                uintptr_t parent = node->parent_and_tag.load(std::memory_order_relaxed) & ~TAG_MASK;
+                node->parent_and_tag.store(parent | tag, std::memory_order_release);
+            }
+
+            const Key& key(NodeRef node) const { return node->key; }
+            Value& value(NodeRef node) const   { return node->value; }
+            NodeData& data(NodeRef node) const { return *node; }
+    };
+};
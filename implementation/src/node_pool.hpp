@@ -0,0 +1,183 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <unordered_set>
+
+// Node pools hand OrderedMap raw memory for one node at a time.
+// A pool with bulk_release frees every chunk it ever handed out in release(),
+// so a tree of trivially destructible nodes never has to be walked to be freed.
+// share_with(other) lets other hold chunks of this pool, for trees that take
+// over another tree's nodes: the memory stays valid until both pools have
+// released it. hand_over(other) is for a tree that gives away all of its
+// nodes: other takes the memory and the free chunks, and this pool keeps
+// only what it still allocates from.
+
+// Carves fixed-size chunks out of slabs that double in size as the tree
+// grows. Freed chunks are kept on an intrusive free list and handed out
+// again before new slab space is touched, and release() frees the whole pool
+// in O(number of slabs). Slabs are reference counted so pools can share them,
+// and a pool holds each slab once however often it is shared back and forth.
+template<class T>
+class SlabPool {
+    private:
+        union Chunk {
+            Chunk *next; // only meaningful while the chunk is on the free list
+            alignas(T) unsigned char storage[sizeof(T)];
+        };
+
+        struct Slab {
+            std::atomic<size_t> owners;
+        };
+
+        static constexpr size_t FIRST_SLAB_CHUNKS = 32;
+        static constexpr size_t MAX_SLAB_CHUNKS = 65536;
+        static constexpr size_t CHUNK_ALIGN = alignof(Chunk) > alignof(Slab) ? alignof(Chunk) : alignof(Slab);
+        static constexpr size_t HEADER_SIZE = (sizeof(Slab) + CHUNK_ALIGN - 1) / CHUNK_ALIGN * CHUNK_ALIGN;
+
+        std::unordered_set<Slab*> slabs;
+        Chunk *free_list;
+        Chunk *free_tail; // lets hand_over splice the free list in O(1)
+        Chunk *next_unused; // bump pointer into the newest slab
+        Chunk *slab_end;
+        Slab  *newest;      // the slab next_unused points into
+        size_t next_slab_chunks;
+
+        void add_slab() {
+            size_t bytes = HEADER_SIZE + next_slab_chunks * sizeof(Chunk);
+            Slab *slab = static_cast<Slab*>(::operator new(bytes, std::align_val_t(CHUNK_ALIGN)));
+            new (&slab->owners) std::atomic<size_t>(1);
+            slabs.insert(slab);
+            newest = slab;
+
+            next_unused = reinterpret_cast<Chunk*>(reinterpret_cast<unsigned char*>(slab) + HEADER_SIZE);
+            slab_end = next_unused + next_slab_chunks;
+
+            if(next_slab_chunks < MAX_SLAB_CHUNKS) {
+                next_slab_chunks *= 2;
+            }
+        }
+
+    public:
+        static constexpr bool bulk_release = true;
+
+        SlabPool() : free_list(nullptr), free_tail(nullptr), next_unused(nullptr), slab_end(nullptr), newest(nullptr),
+                     next_slab_chunks(FIRST_SLAB_CHUNKS) {}
+
+        ~SlabPool() {
+            release();
+        }
+
+        SlabPool(const SlabPool &) = delete;
+        SlabPool& operator=(const SlabPool &) = delete;
+
+        void* allocate() {
+            if(free_list != nullptr) {
+                Chunk *chunk = free_list;
+                free_list = chunk->next;
+                if(free_list == nullptr) {
+                    free_tail = nullptr;
+                }
+                return chunk;
+            }
+
+            if(next_unused == slab_end) {
+                add_slab();
+            }
+
+            return next_unused++;
+        }
+
+        void deallocate(void *memory) {
+            Chunk *chunk = static_cast<Chunk*>(memory);
+            chunk->next = free_list;
+            free_list = chunk;
+            if(free_tail == nullptr) {
+                free_tail = chunk;
+            }
+        }
+
+        // Frees every slab no other pool shares, all chunks handed out become
+        // invalid for this pool
+        void release() {
+            for(Slab *slab : slabs) {
+                if(slab->owners.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                    ::operator delete(slab, std::align_val_t(CHUNK_ALIGN));
+                }
+            }
+            slabs.clear();
+
+            free_list = free_tail = nullptr;
+            next_unused = slab_end = nullptr;
+            newest = nullptr;
+            next_slab_chunks = FIRST_SLAB_CHUNKS;
+        }
+
+        // other keeps every slab of this pool alive too, slabs it already
+        // holds are skipped. Chunks are not handed out twice: other only
+        // allocates from its own free list and newest slab
+        void share_with(SlabPool &other) {
+            for(Slab *slab : slabs) {
+                if(other.slabs.insert(slab).second) {
+                    slab->owners.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+        }
+
+        // For a pool none of whose chunks are in use any more: other takes
+        // over the slabs and the free chunks, so what other frees later is
+        // not pinned here. This pool keeps the unused part of its newest slab
+        void hand_over(SlabPool &other) {
+            if(free_list != nullptr) {
+                free_tail->next = other.free_list;
+                if(other.free_list == nullptr) {
+                    other.free_tail = free_tail;
+                }
+                other.free_list = free_list;
+                free_list = free_tail = nullptr;
+            }
+
+            for(Slab *slab : slabs) {
+                bool kept = slab == newest;
+                bool added = other.slabs.insert(slab).second;
+                if(kept && added) {
+                    slab->owners.fetch_add(1, std::memory_order_relaxed);
+                } else if(!kept && !added) {
+                    slab->owners.fetch_sub(1, std::memory_order_relaxed); // other still holds it
+                }
+            }
+            slabs.clear();
+            if(newest != nullptr) {
+                slabs.insert(newest);
+            }
+        }
+
+        size_t slab_count() const {
+            return slabs.size();
+        }
+};
+
+// One global heap allocation per node, nodes have to be freed one by one
+template<class T>
+class HeapPool {
+    public:
+        static constexpr bool bulk_release = false;
+
+        void* allocate() {
+            return ::operator new(sizeof(T), std::align_val_t(alignof(T)));
+        }
+
+        void deallocate(void *memory) {
+            ::operator delete(memory, std::align_val_t(alignof(T)));
+        }
+
+        void release() {}
+
+        void share_with(HeapPool &) {}
+        void hand_over(HeapPool &) {}
+
+        size_t slab_count() const {
+            return 0;
+        }
+};
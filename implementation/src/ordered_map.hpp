@@ -0,0 +1,1299 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "balance_policy.hpp"
+#include "node_layout.hpp"
+#include "tree_stats.hpp"
+#include "work_stealing_pool.hpp"
+
+// A policy that wraps another one (Base) lets the inner policy's hooks reach
+// the tree as well
+template<class Policy, class = void>
+struct InnerPolicy {
+    typedef Policy type;
+};
+
+template<class Policy>
+struct InnerPolicy<Policy, std::void_t<typename Policy::Base>> {
+    typedef typename Policy::Base type;
+};
+
+// Comparators with an is_transparent member, such as std::less<>, compare
+// keys of other types against the tree's keys without converting them
+template<class Compare, class = void>
+struct IsTransparent : std::false_type {};
+
+template<class Compare>
+struct IsTransparent<Compare, std::void_t<typename Compare::is_transparent>> : std::true_type {};
+
+// Binary search tree keyed by Key, ordered by Compare and kept balanced by
+// BalancePolicy (NoBalance, RedBlackBalance or AVLBalance, optionally wrapped
+// in OrderStatistics for rank and select queries). Equal keys are
+// allowed, a new key goes after the ones already in the tree. NodeLayout
+// stores the nodes: PointerLayout<NodePool> links them by pointers,
+// CompactLayout keeps them in one array linked by 32-bit indices, and
+// ConcurrentLayout uses atomic links for lock-free readers. Stats is
+// NoStats or TreeStats, the counters behind stats().
+//
+// Values live in the nodes. emplace builds one in place and find returns a
+// pointer to it, so values can be large or move-only. The queries that
+// return std::optional<Value> copy the value and need it copyable.
+template<class Key, class Value, class Compare = std::less<Key>, class BalancePolicy = RedBlackBalance,
+         class NodeLayout = PointerLayout<>, class Stats = NoStats>
+class OrderedMap {
+    public:
+        typedef typename BalancePolicy::NodeData NodeData;
+        typedef typename NodeLayout::template Storage<Key, Value, NodeData> Storage;
+        typedef typename Storage::NodeRef NodeRef;
+
+        static constexpr NodeRef nil = Storage::nil;
+
+        // Lookups search_batch keeps in flight at once
+        static constexpr size_t SEARCH_BATCH_LANES = 16;
+
+    private:
+        friend BalancePolicy;
+        friend typename InnerPolicy<BalancePolicy>::type;
+
+        Storage storage;
+        NodeRef root;
+        size_t node_count;
+        Compare compare;
+        [[no_unique_address]] Stats counters;
+
+        NodeRef left(NodeRef node) const   { return storage.left(node); }
+        NodeRef right(NodeRef node) const  { return storage.right(node); }
+        NodeRef parent(NodeRef node) const { return storage.parent(node); }
+        unsigned tag(NodeRef node) const   { return storage.tag(node); }
+
+        void set_left(NodeRef node, NodeRef child)    { storage.set_left(node, child); }
+        void set_right(NodeRef node, NodeRef child)   { storage.set_right(node, child); }
+        void set_parent(NodeRef node, NodeRef parent) { storage.set_parent(node, parent); }
+        void set_tag(NodeRef node, unsigned tag)      { storage.set_tag(node, tag); }
+
+        const Key& key(NodeRef node) const     { return storage.key(node); }
+        Value& value(NodeRef node)             { return storage.value(node); }
+        const Value& value(NodeRef node) const { return storage.value(node); }
+        NodeData& data(NodeRef node)             { return storage.data(node); }
+        const NodeData& data(NodeRef node) const { return storage.data(node); }
+
+        // Heterogeneous lookups pass keys of other types (K), which need a
+        // transparent Compare
+        template<class K>
+        NodeRef search_node(const K &key) const {
+            size_t depth = 0, comparisons = 0;
+            NodeRef tmp = root;
+            while(tmp != nil) {
+                depth++;
+                comparisons++;
+                if(compare(key, this->key(tmp))) {
+                    tmp = left(tmp);
+                    continue;
+                }
+
+                comparisons++;
+                if(compare(this->key(tmp), key)) {
+                    tmp = right(tmp);
+                } else {
+                    break;
+                }
+            }
+
+            counters.lookup(depth, comparisons);
+            return tmp;
+        }
+
+        // First node whose key is not less than key, nil if there is none
+        NodeRef lower_bound_node(const Key &key) const {
+            NodeRef bound = nil;
+            size_t depth = 0;
+            for(NodeRef tmp = root; tmp != nil; depth++) {
+                if(compare(this->key(tmp), key)) {
+                    tmp = right(tmp);
+                } else {
+                    bound = tmp;
+                    tmp = left(tmp);
+                }
+            }
+
+            // One comparison per level
+            counters.lookup(depth, depth);
+            return bound;
+        }
+
+        // First node whose key is greater than key, nil if there is none
+        NodeRef upper_bound_node(const Key &key) const {
+            NodeRef bound = nil;
+            size_t depth = 0;
+            for(NodeRef tmp = root; tmp != nil; depth++) {
+                if(compare(key, this->key(tmp))) {
+                    bound = tmp;
+                    tmp = left(tmp);
+                } else {
+                    tmp = right(tmp);
+                }
+            }
+
+            counters.lookup(depth, depth);
+            return bound;
+        }
+
+        // Last node whose key is not greater than key, nil if there is none
+        NodeRef floor_node(const Key &key) const {
+            NodeRef bound = nil;
+            size_t depth = 0;
+            for(NodeRef tmp = root; tmp != nil; depth++) {
+                if(compare(key, this->key(tmp))) {
+                    tmp = left(tmp);
+                } else {
+                    bound = tmp;
+                    tmp = right(tmp);
+                }
+            }
+
+            counters.lookup(depth, depth);
+            return bound;
+        }
+
+        NodeRef get_min_node(NodeRef node) const {
+            if(node == nil) {
+                return nil;
+            }
+
+            while(left(node) != nil) {
+                node = left(node);
+            }
+
+            return node;
+        }
+
+        NodeRef get_max_node(NodeRef node) const {
+            if(node == nil) {
+                return nil;
+            }
+
+            while(right(node) != nil) {
+                node = right(node);
+            }
+
+            return node;
+        }
+
+        NodeRef get_predecessor_node(NodeRef node) const {
+            if(node == nil) {
+                return nil;
+            }
+
+            // Attempt to get the largest value in the left subtree
+            NodeRef tmp = get_max_node(left(node));
+
+            // If tmp is nil, then node does not have a left subtree
+            // therefore, the next value will be a parent node
+            if(tmp == nil) {
+                tmp = parent(node);
+
+                // If tmp's left child is the current node, then the node is
+                // smaller than tmp, however it will be larger than tmp's parent
+                // So the predecessor must be higher up in the tree
+                while(tmp != nil && left(tmp) == node) {
+                    node = tmp;
+                    tmp = parent(tmp);
+                }
+
+                // By the end of the while loop, tmp will be the proper predecessor to the original input node
+            }
+
+            return tmp;
+        }
+
+        NodeRef get_successor_node(NodeRef node) const {
+            if(node == nil) {
+                return nil;
+            }
+
+            // Attempt to get the smallest value in the right subtree
+            NodeRef tmp = get_min_node(right(node));
+
+            // If tmp is nil, then node does not have a right subtree
+            // therefore, the next value will be a parent node
+            if(tmp == nil) {
+                tmp = parent(node);
+
+                // If tmp's right child is the current node, then the node is
+                // larger than tmp, however it will be less than tmp's parent
+                // So the successor must be higher up in the tree
+                while(tmp != nil && right(tmp) == node) {
+                    node = tmp;
+                    tmp = parent(tmp);
+                }
+
+                // By the end of the while loop, tmp will be the proper successor to the original input node
+            }
+
+            return tmp;
+        }
+
+        // Frees every node under top without recursion or an explicit stack:
+        // descend to a leaf, free it, unlink it from its parent and continue
+        // from there. Each edge is walked down and up once, so the cost is
+        // O(n) for any tree shape, including the depth-n chain sorted input
+        // gives a BST. Returns the number of nodes freed
+        size_t destroy_subtree(NodeRef top) {
+            if(top == nil) {
+                return 0;
+            }
+
+            size_t count = 0;
+            set_parent(top, nil);
+            NodeRef node = top;
+            while(node != nil) {
+                if(left(node) != nil) {
+                    node = left(node);
+                } else if(right(node) != nil) {
+                    node = right(node);
+                } else {
+                    NodeRef up = parent(node);
+                    if(up != nil) {
+                        if(left(up) == node) {
+                            set_left(up, nil);
+                        } else {
+                            set_right(up, nil);
+                        }
+                    }
+
+                    storage.destroy(node);
+                    count++;
+                    node = up;
+                }
+            }
+            return count;
+        }
+
+        void delete_tree() {
+            destroy_subtree(root);
+        }
+
+        // Number of entries with keys not greater than key, needs OrderStatistics
+        size_t count_not_greater(const Key &key) const {
+            size_t count = 0;
+            for(NodeRef tmp = root; tmp != nil;) {
+                if(compare(key, this->key(tmp))) {
+                    tmp = left(tmp);
+                } else {
+                    count += BalancePolicy::subtree_size(*this, left(tmp)) + 1;
+                    tmp = right(tmp);
+                }
+            }
+
+            return count;
+        }
+
+        void transplant(NodeRef node1, NodeRef node2) {
+            NodeRef node1_parent = parent(node1);
+
+            if(node1_parent == nil) {
+                root = node2;
+            } else if(node1 == left(node1_parent)) {
+                set_left(node1_parent, node2);
+            } else { // right(node1_parent) == node1
+                set_right(node1_parent, node2);
+            }
+
+            if(node2 != nil) {
+                set_parent(node2, node1_parent);
+            }
+        }
+
+        void left_rotate(NodeRef node) {
+            // target will take node's place in the rotation process
+            // - target's left will contain node (and by extention node's subtrees)
+            // - node's right will take target's left subtree
+            // - target's right will remain as is
+            NodeRef target = right(node);
+            NodeRef target_left = left(target);
+            storage.begin_move(node);
+            set_right(node, target_left);
+
+            if(target_left != nil) {
+                set_parent(target_left, node);
+            }
+
+            // target holds node before it takes node's place, so no key is
+            // ever out of reach from the root
+            set_left(target, node);
+            transplant(node, target);
+            set_parent(node, target);
+            storage.end_move(node);
+
+            counters.rotation();
+            BalancePolicy::after_rotate(*this, node, target);
+        }
+
+        void right_rotate(NodeRef node) {
+            // target will take node's place in the rotation process
+            // - target's right will contain node (and by extention node's subtrees)
+            // - node's left will take target's right subtree
+            // - target's left will remain as is
+            NodeRef target = left(node);
+            NodeRef target_right = right(target);
+            storage.begin_move(node);
+            set_left(node, target_right);
+
+            if(target_right != nil) {
+                set_parent(target_right, node);
+            }
+
+            // target holds node before it takes node's place, so no key is
+            // ever out of reach from the root
+            set_right(target, node);
+            transplant(node, target);
+            set_parent(node, target);
+            storage.end_move(node);
+
+            counters.rotation();
+            BalancePolicy::after_rotate(*this, node, target);
+        }
+
+        // Subtree root with its rank for the balancing policy's joins. Joins and
+        // splits work on detached subtrees: the root's parent link is stale
+        // until the subtree is attached somewhere or becomes the tree
+        struct Subtree {
+            NodeRef root;
+            int rank;
+        };
+
+        enum class SetOperation {
+            set_union, set_intersection, set_difference
+        };
+
+        // Forks below this many levels of a set operation's recursion, on
+        // top of enough levels to give every worker a piece
+        static constexpr int EXTRA_PARALLEL_DEPTH = 4;
+
+        NodeRef attach(NodeRef left_child, NodeRef node, NodeRef right_child) {
+            set_left(node, left_child);
+            set_right(node, right_child);
+            set_parent(node, nil);
+            if(left_child != nil) {
+                set_parent(left_child, node);
+            }
+            if(right_child != nil) {
+                set_parent(right_child, node);
+            }
+            BalancePolicy::after_attach(*this, node);
+            return node;
+        }
+
+        Subtree left_subtree(Subtree tree) const {
+            return {left(tree.root), BalancePolicy::child_rank(*this, tree.root, tree.rank, true)};
+        }
+
+        Subtree right_subtree(Subtree tree) const {
+            return {right(tree.root), BalancePolicy::child_rank(*this, tree.root, tree.rank, false)};
+        }
+
+        Subtree join_subtrees(Subtree left_tree, NodeRef pivot, Subtree right_tree) {
+            int rank;
+            NodeRef joined = BalancePolicy::join(*this, left_tree.root, left_tree.rank, pivot, right_tree.root, right_tree.rank, rank);
+            return {joined, rank};
+        }
+
+        // Splits tree into the keys before key and the rest. With inclusive,
+        // keys equal to key go to the first part as well. O(log n): one join
+        // per level, and the joins' costs add up to the height
+        void split_subtree(Subtree tree, const Key &key, bool inclusive, Subtree &before, Subtree &after) {
+            if(tree.root == nil) {
+                before = after = {nil, 0};
+                return;
+            }
+
+            NodeRef node = tree.root;
+            bool node_before = inclusive ? !compare(key, this->key(node)) : compare(this->key(node), key);
+            if(node_before) {
+                Subtree rest;
+                split_subtree(right_subtree(tree), key, inclusive, rest, after);
+                before = join_subtrees(left_subtree(tree), node, rest);
+            } else {
+                Subtree rest;
+                split_subtree(left_subtree(tree), key, inclusive, before, rest);
+                after = join_subtrees(rest, node, right_subtree(tree));
+            }
+        }
+
+        // Takes the last node out of tree, which must not be empty
+        Subtree split_last(Subtree tree, NodeRef &last) {
+            if(right(tree.root) == nil) {
+                last = tree.root;
+                return left_subtree(tree);
+            }
+
+            Subtree rest = split_last(right_subtree(tree), last);
+            return join_subtrees(left_subtree(tree), tree.root, rest);
+        }
+
+        // Join of two subtrees without a pivot in between
+        Subtree concatenate(Subtree left_tree, Subtree right_tree) {
+            if(left_tree.root == nil) {
+                return right_tree;
+            }
+            if(right_tree.root == nil) {
+                return left_tree;
+            }
+
+            NodeRef last;
+            Subtree rest = split_last(left_tree, last);
+            return join_subtrees(rest, last, right_tree);
+        }
+
+        // Join-based set operation of Blelloch, Ferizovic and Sun: split
+        // theirs around the root of ours, combine the two sides
+        // independently and join the results around the root again, or
+        // without it. Unused nodes are collected in garbage. The two sides
+        // touch disjoint nodes, so they run in parallel on pool for the top
+        // parallel_depth levels
+        Subtree combine(SetOperation operation, Subtree ours, Subtree theirs, std::vector<NodeRef> &garbage,
+                        WorkStealingPool *pool, int parallel_depth) {
+            if(ours.root == nil) {
+                if(operation == SetOperation::set_union) {
+                    return theirs;
+                }
+                garbage.push_back(theirs.root);
+                return {nil, 0};
+            }
+            if(theirs.root == nil) {
+                if(operation == SetOperation::set_intersection) {
+                    garbage.push_back(ours.root);
+                    return {nil, 0};
+                }
+                return ours;
+            }
+
+            NodeRef node = ours.root;
+            Subtree before, equal, after, rest;
+            split_subtree(theirs, key(node), false, before, rest);
+            split_subtree(rest, key(node), true, equal, after);
+
+            bool found = equal.root != nil;
+            if(found) {
+                garbage.push_back(equal.root);
+            }
+
+            Subtree ours_left = left_subtree(ours);
+            Subtree ours_right = right_subtree(ours);
+
+            // Entries of ours with node's key may sit on either side of it.
+            // The halves below no longer see that key in theirs, so these
+            // entries are split off to share node's fate
+            Subtree equal_left = {nil, 0}, equal_right = {nil, 0};
+            if(operation != SetOperation::set_union && found) {
+                split_subtree(ours_left, key(node), false, ours_left, equal_left);
+                split_subtree(ours_right, key(node), true, equal_right, ours_right);
+            }
+
+            Subtree combined_left, combined_right;
+            if(pool != nullptr && parallel_depth > 0) {
+                std::vector<NodeRef> right_garbage;
+                pool->invoke(
+                    [&]() { combined_left = combine(operation, ours_left, before, garbage, pool, parallel_depth - 1); },
+                    [&]() { combined_right = combine(operation, ours_right, after, right_garbage, pool, parallel_depth - 1); });
+                garbage.insert(garbage.end(), right_garbage.begin(), right_garbage.end());
+            } else {
+                combined_left = combine(operation, ours_left, before, garbage, nullptr, 0);
+                combined_right = combine(operation, ours_right, after, garbage, nullptr, 0);
+            }
+
+            bool keep = (operation == SetOperation::set_union) || ((operation == SetOperation::set_intersection) == found);
+            if(keep) {
+                return join_subtrees(concatenate(combined_left, equal_left), node, concatenate(equal_right, combined_right));
+            }
+
+            for(NodeRef equal_root : {equal_left.root, equal_right.root}) {
+                if(equal_root != nil) {
+                    garbage.push_back(equal_root);
+                }
+            }
+            set_left(node, nil);
+            set_right(node, nil);
+            garbage.push_back(node);
+            return concatenate(combined_left, combined_right);
+        }
+
+        // Detaches every node of tree as one subtree, leaving tree empty. When
+        // tree is another map its node memory moves here with the nodes
+        Subtree take_nodes(OrderedMap &tree, size_t &count) {
+            if(&tree != this) {
+                tree.storage.hand_over(storage);
+            }
+
+            Subtree taken = {tree.root, BalancePolicy::rank(tree, tree.root)};
+            count = tree.node_count;
+            tree.root = nil;
+            tree.node_count = 0;
+            return taken;
+        }
+
+        // Makes a detached subtree of count nodes the whole tree
+        void adopt(Subtree tree, size_t count) {
+            root = tree.root;
+            if(root != nil) {
+                set_parent(root, nil);
+                BalancePolicy::after_join(*this, root);
+            }
+            node_count = count;
+        }
+
+        // join() for keys out of order: takes over left_tree, then inserts
+        // the pivot and entries
+        void join_with_inserts(OrderedMap &left_tree, const Key &key, const Value &value,
+                               const std::vector<std::pair<Key, Value>> &entries) {
+            if(this != &left_tree) {
+                clear();
+                size_t count;
+                Subtree taken = take_nodes(left_tree, count);
+                adopt(taken, count);
+            }
+
+            insert(key, value);
+            for(const std::pair<Key, Value> &entry : entries) {
+                insert(entry.first, entry.second);
+            }
+        }
+
+        // Replaces this tree with the result of the set operation and leaves
+        // other empty, reusing the nodes of both
+        void apply(SetOperation operation, OrderedMap &other, WorkStealingPool *pool) {
+            static_assert(Storage::shares_nodes, "set operations move nodes between trees, which this node layout cannot do");
+
+            if(this == &other) {
+                if(operation == SetOperation::set_difference) {
+                    clear();
+                }
+                return;
+            }
+
+            size_t our_count, their_count;
+            Subtree ours = take_nodes(*this, our_count);
+            Subtree theirs = take_nodes(other, their_count);
+            size_t total = our_count + their_count;
+
+            int parallel_depth = 0;
+            if(pool != nullptr) {
+                while(((size_t)1 << parallel_depth) < pool->size()) {
+                    parallel_depth++;
+                }
+                parallel_depth += EXTRA_PARALLEL_DEPTH;
+            }
+
+            std::vector<NodeRef> garbage;
+            Subtree result;
+            if(pool != nullptr) {
+                pool->run([&]() { result = combine(operation, ours, theirs, garbage, pool, parallel_depth); });
+            } else {
+                result = combine(operation, ours, theirs, garbage, nullptr, 0);
+            }
+
+            for(NodeRef node : garbage) {
+                total -= destroy_subtree(node);
+            }
+
+            adopt(result, total);
+        }
+
+        // Builds a balanced subtree from the next count elements of a sorted
+        // sequence, consuming them in order. Subtree sizes differ by at most
+        // one, so only the deepest level can have gaps
+        template<class Iterator>
+        NodeRef build_subtree(Iterator &next, size_t count, int depth, int max_depth, int &height) {
+            if(count == 0) {
+                height = 0;
+                return nil;
+            }
+
+            int left_height, right_height;
+            size_t left_count = (count - 1) / 2;
+
+            NodeRef left_child = build_subtree(next, left_count, depth + 1, max_depth, left_height);
+            NodeRef node = storage.create(next->first, next->second);
+            ++next;
+            NodeRef right_child = build_subtree(next, count - 1 - left_count, depth + 1, max_depth, right_height);
+
+            set_left(node, left_child);
+            set_right(node, right_child);
+            if(left_child != nil) {
+                set_parent(left_child, node);
+            }
+            if(right_child != nil) {
+                set_parent(right_child, node);
+            }
+            BalancePolicy::after_build(*this, node, depth, max_depth, left_height, right_height);
+
+            height = 1 + std::max(left_height, right_height);
+            return node;
+        }
+
+    public:
+        // Bidirectional iterator over the entries in key order. Dereferencing
+        // gives a pair of references to the node's key and value. Steps follow
+        // the parent links, so a full scan is O(n). Inserting or removing
+        // other entries leaves the iterator valid
+        class const_iterator {
+            public:
+                typedef std::bidirectional_iterator_tag iterator_category;
+                typedef std::pair<const Key&, const Value&> value_type;
+                typedef std::ptrdiff_t difference_type;
+                typedef value_type reference;
+
+                // Keeps the pair alive for operator->
+                struct pointer {
+                    value_type entry;
+                    const value_type* operator->() const { return &entry; }
+                };
+
+            private:
+                friend class OrderedMap;
+
+                const OrderedMap *tree;
+                NodeRef node;
+
+                const_iterator(const OrderedMap *tree, NodeRef node) : tree(tree), node(node) {}
+
+            public:
+                const_iterator() : tree(nullptr), node(nil) {}
+
+                const Key& key() const     { return tree->key(node); }
+                const Value& value() const { return tree->value(node); }
+
+                reference operator*() const { return reference(key(), value()); }
+                pointer operator->() const  { return pointer{**this}; }
+
+                const_iterator& operator++() {
+                    node = tree->get_successor_node(node);
+                    return *this;
+                }
+
+                // Stepping back from end() reaches the largest entry
+                const_iterator& operator--() {
+                    node = (node == nil) ? tree->get_max_node(tree->root) : tree->get_predecessor_node(node);
+                    return *this;
+                }
+
+                const_iterator operator++(int) {
+                    const_iterator old = *this;
+                    ++*this;
+                    return old;
+                }
+
+                const_iterator operator--(int) {
+                    const_iterator old = *this;
+                    --*this;
+                    return old;
+                }
+
+                bool operator==(const const_iterator &other) const { return node == other.node; }
+                bool operator!=(const const_iterator &other) const { return node != other.node; }
+        };
+
+        typedef const_iterator iterator;
+
+        // The entries of a range() scan, usable in a range-based for loop
+        class Range {
+            private:
+                const_iterator first;
+                const_iterator last;
+
+            public:
+                Range(const_iterator first, const_iterator last) : first(first), last(last) {}
+
+                const_iterator begin() const { return first; }
+                const_iterator end() const   { return last; }
+        };
+
+        explicit OrderedMap(const Compare &compare = Compare())
+            : root(nil), node_count(0), compare(compare) {}
+
+        ~OrderedMap() {
+            clear();
+        }
+
+        OrderedMap(const OrderedMap &) = delete;
+        OrderedMap& operator=(const OrderedMap &) = delete;
+
+        // Layout-specific services, such as reclamation in ConcurrentLayout, and
+        // the root for wrappers that publish it to their own readers
+        Storage& node_storage()             { return storage; }
+        const Storage& node_storage() const { return storage; }
+        NodeRef root_node() const           { return root; }
+
+        size_t size() const {
+            return node_count;
+        }
+
+        bool empty() const {
+            return node_count == 0;
+        }
+
+        // Nodes on the longest root-to-leaf path, 0 for an empty tree. O(n),
+        // with an explicit stack so a degenerate tree cannot overflow the
+        // call stack
+        int height() const {
+            int height = 0;
+            std::vector<std::pair<NodeRef, int>> pending;
+            if(root != nil) {
+                pending.push_back({root, 1});
+            }
+            while(!pending.empty()) {
+                auto [node, depth] = pending.back();
+                pending.pop_back();
+                height = std::max(height, depth);
+                if(left(node) != nil) {
+                    pending.push_back({left(node), depth + 1});
+                }
+                if(right(node) != nil) {
+                    pending.push_back({right(node), depth + 1});
+                }
+            }
+            return height;
+        }
+
+        // The Stats counters with the current size. The height takes an
+        // O(n) walk, so it is only filled in when with_height is set. With
+        // NoStats only size and height are filled in
+        TreeStatsSnapshot stats(bool with_height = false) const {
+            TreeStatsSnapshot snapshot;
+            counters.snapshot(snapshot);
+            snapshot.size = node_count;
+            snapshot.height = with_height ? height() : 0;
+            return snapshot;
+        }
+
+        void reset_stats() {
+            counters.reset();
+        }
+
+        // Slabs the node pool holds, for layouts that allocate from slabs.
+        // Trees that split and join share slabs, each one is counted once
+        size_t slab_count() const {
+            return storage.slab_count();
+        }
+
+        // Makes room for count nodes up front where the layout can use it
+        void reserve(size_t count) {
+            storage.reserve(count);
+        }
+
+        void clear() {
+            // Nodes the storage frees in bulk are dropped without a walk
+            if(!Storage::bulk_release) {
+                delete_tree();
+            }
+
+            storage.release();
+            root = nil;
+            node_count = 0;
+        }
+
+        // Replaces the contents with the (key, value) pairs in [first, last),
+        // which should be sorted by key. Sorted input becomes a perfectly
+        // balanced tree in O(n) with no comparisons or rebalancing; input that
+        // is not sorted falls back to inserting one pair at a time
+        template<class Iterator>
+        void build_from_sorted(Iterator first, Iterator last) {
+            clear();
+
+            bool sorted = std::is_sorted(first, last, [this](const auto &a, const auto &b) {
+                return compare(a.first, b.first);
+            });
+            if(!sorted) {
+                for(; first != last; ++first) {
+                    insert(first->first, first->second);
+                }
+                return;
+            }
+
+            size_t count = std::distance(first, last);
+            if(count == 0) {
+                return;
+            }
+
+            int max_depth = 0;
+            while((count >> (max_depth + 1)) != 0) {
+                max_depth++;
+            }
+
+            int height;
+            storage.reserve(count);
+            root = build_subtree(first, count, 0, max_depth, height);
+            set_parent(root, nil);
+            node_count = count;
+        }
+
+        bool contains(const Key &key) const {
+            return search_node(key) != nil;
+        }
+
+        std::optional<Value> search(const Key &key) const {
+            NodeRef node = search_node(key);
+            if(node != nil) {
+                return value(node);
+            }
+            return std::nullopt;
+        }
+
+        // The value stored for key, nullptr when key is not in the tree. No
+        // copy is made, and the pointer stays valid as long as emplace's
+        // reference would
+        Value* find(const Key &key) {
+            NodeRef node = search_node(key);
+            return (node != nil) ? &value(node) : nullptr;
+        }
+
+        const Value* find(const Key &key) const {
+            NodeRef node = search_node(key);
+            return (node != nil) ? &value(node) : nullptr;
+        }
+
+        // Lookups by any key type Compare can order against Key, e.g. a
+        // std::string_view into a tree of std::string under std::less<>
+        template<class K, class C = Compare, std::enable_if_t<IsTransparent<C>::value, int> = 0>
+        Value* find(const K &key) {
+            NodeRef node = search_node(key);
+            return (node != nil) ? &value(node) : nullptr;
+        }
+
+        template<class K, class C = Compare, std::enable_if_t<IsTransparent<C>::value, int> = 0>
+        const Value* find(const K &key) const {
+            NodeRef node = search_node(key);
+            return (node != nil) ? &value(node) : nullptr;
+        }
+
+        template<class K, class C = Compare, std::enable_if_t<IsTransparent<C>::value, int> = 0>
+        bool contains(const K &key) const {
+            return search_node(key) != nil;
+        }
+
+        // Looks up keys[0..n) and writes each key's value to out, or missing
+        // when the key is not in the tree. Up to SEARCH_BATCH_LANES lookups
+        // descend in lockstep, one level per pass, and each prefetches the
+        // child it moves to, so their cache misses overlap instead of being
+        // paid one after another. A finished lane picks up the next key.
+        // Each key counts as one lookup. Returns the number of keys found
+        size_t search_batch(const Key *keys, Value *out, size_t n, const Value &missing) const {
+            if(root == nil) {
+                std::fill(out, out + n, missing);
+                return 0;
+            }
+
+            NodeRef cursor[SEARCH_BATCH_LANES];
+            size_t slot[SEARCH_BATCH_LANES];
+            // Per-lane counts for Stats, dropped by the compiler under NoStats
+            size_t depth[SEARCH_BATCH_LANES];
+            size_t comparisons[SEARCH_BATCH_LANES];
+            size_t lanes = 0;
+            size_t next = 0;
+            size_t found = 0;
+
+            for(; lanes < SEARCH_BATCH_LANES && next < n; lanes++, next++) {
+                cursor[lanes] = root;
+                slot[lanes] = next;
+                depth[lanes] = comparisons[lanes] = 0;
+            }
+
+            while(lanes > 0) {
+                for(size_t i = 0; i < lanes;) {
+                    NodeRef node = cursor[i];
+                    const Key &wanted = keys[slot[i]];
+                    bool hit = false;
+
+                    depth[i]++;
+                    comparisons[i]++;
+                    if(compare(wanted, key(node))) {
+                        node = left(node);
+                    } else if(compare(key(node), wanted)) {
+                        comparisons[i]++;
+                        node = right(node);
+                    } else {
+                        comparisons[i]++;
+                        out[slot[i]] = value(node);
+                        hit = true;
+                        found++;
+                        node = nil;
+                    }
+
+                    if(node != nil) {
+                        storage.prefetch(node);
+                        cursor[i++] = node;
+                        continue;
+                    }
+
+                    if(!hit) {
+                        out[slot[i]] = missing;
+                    }
+                    counters.lookup(depth[i], comparisons[i]);
+
+                    if(next < n) {
+                        cursor[i] = root;
+                        slot[i] = next++;
+                        depth[i] = comparisons[i] = 0;
+                        i++;
+                    } else {
+                        // Move the last lane here, it runs in this pass
+                        lanes--;
+                        cursor[i] = cursor[lanes];
+                        slot[i] = slot[lanes];
+                        depth[i] = depth[lanes];
+                        comparisons[i] = comparisons[lanes];
+                    }
+                }
+            }
+
+            return found;
+        }
+
+    private:
+        // Links in a node for key with its value built from args, after any
+        // entries with the same key
+        template<class... Args>
+        NodeRef insert_node(const Key &key, Args &&...args) {
+            NodeRef parent = nil;
+            bool go_left = false;
+            size_t depth = 0;
+            for(NodeRef tmp = root; tmp != nil; tmp = go_left ? left(tmp) : right(tmp)) {
+                parent = tmp;
+                go_left = compare(key, this->key(tmp));
+                depth++;
+            }
+            counters.insert(depth + 1, depth);
+
+            NodeRef new_node = storage.create(key, std::forward<Args>(args)...);
+            set_parent(new_node, parent);
+            if(parent == nil) {
+                root = new_node;
+            } else if(go_left) {
+                set_left(parent, new_node);
+            } else {
+                set_right(parent, new_node);
+            }
+
+            node_count++;
+            BalancePolicy::after_insert(*this, new_node);
+            return new_node;
+        }
+
+    public:
+        void insert(const Key &key, const Value &value) {
+            insert_node(key, value);
+        }
+
+        void insert(const Key &key, Value &&value) {
+            insert_node(key, std::move(value));
+        }
+
+        // Builds the value from args inside the new node and returns it.
+        // Rebalancing relinks nodes but never moves a value, so the
+        // reference stays valid until the entry is removed (or, under
+        // CompactLayout, until its array grows)
+        template<class... Args>
+        Value& emplace(const Key &key, Args &&...args) {
+            return value(insert_node(key, std::forward<Args>(args)...));
+        }
+
+        bool remove(const Key &key) {
+            NodeRef nodeToRemove = search_node(key);
+
+            if(nodeToRemove == nil) {
+                return false;
+            }
+
+            // other_node takes the place of the node that is spliced out of the tree,
+            // it can be nil so its new parent and side are kept for the policy
+            NodeRef other_node = nil;
+            NodeRef other_parent = parent(nodeToRemove);
+            bool other_is_left = other_parent != nil && left(other_parent) == nodeToRemove;
+            unsigned removed_tag = tag(nodeToRemove);
+
+            // The move never ends: the node leaves the tree
+            storage.begin_move(nodeToRemove);
+
+            if(left(nodeToRemove) == nil) {
+                other_node = right(nodeToRemove);
+                transplant(nodeToRemove, other_node);
+            } else if(right(nodeToRemove) == nil) {
+                other_node = left(nodeToRemove);
+                transplant(nodeToRemove, other_node);
+            } else {
+                // The successor is spliced out instead and moves into nodeToRemove's
+                // place. It takes that place before it leaves its old one, so
+                // its key can always be reached from the root
+                NodeRef nodeToReplace = get_min_node(right(nodeToRemove));
+                removed_tag = tag(nodeToReplace);
+
+                other_node = right(nodeToReplace);
+                storage.begin_move(nodeToReplace);
+
+                set_left(nodeToReplace, left(nodeToRemove));
+                set_parent(left(nodeToReplace), nodeToReplace);
+
+                bool adjacent = parent(nodeToReplace) == nodeToRemove;
+                if(adjacent) {
+                    other_parent = nodeToReplace;
+                    other_is_left = false;
+                } else {
+                    other_parent = parent(nodeToReplace);
+                    other_is_left = true;
+                    set_right(nodeToReplace, right(nodeToRemove));
+                    set_parent(right(nodeToReplace), nodeToReplace);
+                }
+
+                transplant(nodeToRemove, nodeToReplace);
+                if(!adjacent) {
+                    // Every node between the successor and its new place loses
+                    // the successor's key when it leaves
+                    for(NodeRef node = other_parent; node != nodeToReplace; node = parent(node)) {
+                        storage.begin_move(node);
+                    }
+                    set_left(other_parent, other_node);
+                    if(other_node != nil) {
+                        set_parent(other_node, other_parent);
+                    }
+                    for(NodeRef node = other_parent; node != nodeToReplace; node = parent(node)) {
+                        storage.end_move(node);
+                    }
+                }
+
+                set_tag(nodeToReplace, tag(nodeToRemove));
+                data(nodeToReplace) = data(nodeToRemove);
+                storage.end_move(nodeToReplace);
+            }
+
+            storage.destroy(nodeToRemove);
+            node_count--;
+
+            BalancePolicy::after_remove(*this, other_node, other_parent, other_is_left, removed_tag);
+            return true;
+        }
+
+        std::optional<Value> get_min() const {
+            if(root != nil) {
+                return value(get_min_node(root));
+            }
+            return std::nullopt;
+        }
+
+        std::optional<Value> get_max() const {
+            if(root != nil) {
+                return value(get_max_node(root));
+            }
+            return std::nullopt;
+        }
+
+        std::optional<Value> get_predecessor(const Key &key) const {
+            NodeRef predecessor_node = get_predecessor_node(search_node(key));
+            if(predecessor_node != nil) {
+                return value(predecessor_node);
+            }
+            return std::nullopt;
+        }
+
+        std::optional<Value> get_successor(const Key &key) const {
+            NodeRef successor_node = get_successor_node(search_node(key));
+            if(successor_node != nil) {
+                return value(successor_node);
+            }
+            return std::nullopt;
+        }
+
+        const_iterator begin() const {
+            return const_iterator(this, get_min_node(root));
+        }
+
+        const_iterator end() const {
+            return const_iterator(this, nil);
+        }
+
+        // Bound queries work for any key, in the tree or not, and take one
+        // descent from the root. They return end() when there is no such entry
+
+        // First entry with a key not less than key
+        const_iterator lower_bound(const Key &key) const {
+            return const_iterator(this, lower_bound_node(key));
+        }
+
+        // First entry with a key greater than key
+        const_iterator upper_bound(const Key &key) const {
+            return const_iterator(this, upper_bound_node(key));
+        }
+
+        // Last entry with a key not greater than key
+        const_iterator floor(const Key &key) const {
+            return const_iterator(this, floor_node(key));
+        }
+
+        // First entry with a key not less than key, the same as lower_bound
+        const_iterator ceiling(const Key &key) const {
+            return lower_bound(key);
+        }
+
+        // Entries with keys in [lo, hi] in key order, found in O(log n) and
+        // walked in O(1) amortized per entry
+        Range range(const Key &lo, const Key &hi) const {
+            if(compare(hi, lo)) {
+                return Range(end(), end());
+            }
+            return Range(const_iterator(this, lower_bound_node(lo)), const_iterator(this, upper_bound_node(hi)));
+        }
+
+        // Set operations by key, which take over the nodes of other and leave
+        // it empty. Both trees are split and joined rather than rebuilt, in
+        // O(m log(n / m + 1)) work for trees of m <= n entries, and the
+        // independent halves of the recursion run in parallel on pool when
+        // one is given. The layout has to be able to move nodes between
+        // trees (Storage::shares_nodes)
+
+        // Keeps every entry of this tree and adds the entries of other whose
+        // key is not in this tree
+        void set_union(OrderedMap &other, WorkStealingPool *pool = nullptr) {
+            apply(SetOperation::set_union, other, pool);
+        }
+
+        // Keeps the entries of this tree whose key is in other
+        void set_intersection(OrderedMap &other, WorkStealingPool *pool = nullptr) {
+            apply(SetOperation::set_intersection, other, pool);
+        }
+
+        // Keeps the entries of this tree whose key is not in other
+        void set_difference(OrderedMap &other, WorkStealingPool *pool = nullptr) {
+            apply(SetOperation::set_difference, other, pool);
+        }
+
+        // Moves the entries with keys not less than key into upper, which
+        // loses what it held, and keeps the rest. O(log n): the tree is cut
+        // along one search path and the pieces on either side are joined
+        // back up. Needs an OrderStatistics balancing policy for the sizes
+        void split(const Key &key, OrderedMap &upper) {
+            static_assert(Storage::shares_nodes, "split moves nodes between trees, which this node layout cannot do");
+
+            if(&upper == this) {
+                return;
+            }
+
+            upper.clear();
+            size_t count;
+            Subtree before, after;
+            split_subtree(take_nodes(*this, count), key, false, before, after);
+            storage.share_with(upper.storage);
+
+            size_t upper_count = BalancePolicy::subtree_size(*this, after.root);
+            adopt(before, count - upper_count);
+            upper.adopt(after, upper_count);
+        }
+
+        // Replaces the contents with the entries of left_tree, then (key,
+        // value), then the entries of right_tree, and leaves both trees
+        // empty; either may be this tree. With every key of left_tree not
+        // greater than key and every key of right_tree not less, it costs
+        // O(log n): the shorter tree is hung off the spine of the taller one
+        // at the same height and the balance is repaired from there up.
+        // Keys out of order fall back to inserting right_tree's entries and
+        // the pivot one at a time
+        void join(OrderedMap &left_tree, const Key &key, const Value &value, OrderedMap &right_tree) {
+            static_assert(Storage::shares_nodes, "join moves nodes between trees, which this node layout cannot do");
+
+            bool ordered = &left_tree != &right_tree &&
+                           (left_tree.root == nil || !compare(key, left_tree.key(left_tree.get_max_node(left_tree.root)))) &&
+                           (right_tree.root == nil || !compare(right_tree.key(right_tree.get_min_node(right_tree.root)), key));
+            if(!ordered) {
+                std::vector<std::pair<Key, Value>> entries;
+                for(const_iterator it = right_tree.begin(); it != right_tree.end(); ++it) {
+                    entries.push_back({it.key(), it.value()});
+                }
+                if(&left_tree != &right_tree) {
+                    right_tree.clear();
+                }
+                join_with_inserts(left_tree, key, value, entries);
+                return;
+            }
+
+            if(this != &left_tree && this != &right_tree) {
+                clear();
+            }
+
+            size_t left_count, right_count;
+            Subtree left_part = take_nodes(left_tree, left_count);
+            Subtree right_part = take_nodes(right_tree, right_count);
+            NodeRef pivot = storage.create(key, value);
+            adopt(join_subtrees(left_part, pivot, right_part), left_count + right_count + 1);
+        }
+
+        // The queries below need an OrderStatistics balancing policy
+
+        // Number of entries with keys less than key
+        size_t rank(const Key &key) const {
+            size_t count = 0;
+            for(NodeRef tmp = root; tmp != nil;) {
+                if(compare(this->key(tmp), key)) {
+                    count += BalancePolicy::subtree_size(*this, left(tmp)) + 1;
+                    tmp = right(tmp);
+                } else {
+                    tmp = left(tmp);
+                }
+            }
+
+            return count;
+        }
+
+        // The entry with k entries before it in key order, end() if k >= size()
+        const_iterator select(size_t k) const {
+            NodeRef tmp = root;
+            while(tmp != nil) {
+                size_t left_size = BalancePolicy::subtree_size(*this, left(tmp));
+
+                if(k < left_size) {
+                    tmp = left(tmp);
+                } else if(k > left_size) {
+                    k -= left_size + 1;
+                    tmp = right(tmp);
+                } else {
+                    return const_iterator(this, tmp);
+                }
+            }
+
+            return end();
+        }
+
+        // Number of entries with keys in [lo, hi]
+        size_t count_range(const Key &lo, const Key &hi) const {
+            if(compare(hi, lo)) {
+                return 0;
+            }
+            return count_not_greater(hi) - rank(lo);
+        }
+
+        // Writes every value in key order, each followed by a space. Follows
+        // the parent links, so it needs no stack however deep the tree is
+        void print_in_order(std::ostream &out) const {
+            for(NodeRef node = get_min_node(root); node != nil; node = get_successor_node(node)) {
+                out << value(node) << " ";
+            }
+        }
+};
+
+// OrderedMap with each balancing scheme, for any key and value types. The
+// int trees wrap these with -1 for missing keys, the ranked ones with
+// OrderStatistics as well
+template<class Key, class Value, class Compare = std::less<Key>>
+using BinarySearchMap = OrderedMap<Key, Value, Compare, NoBalance>;
+
+template<class Key, class Value, class Compare = std::less<Key>>
+using RedBlackMap = OrderedMap<Key, Value, Compare, RedBlackBalance>;
+
+template<class Key, class Value, class Compare = std::less<Key>>
+using AVLMap = OrderedMap<Key, Value, Compare, AVLBalance>;
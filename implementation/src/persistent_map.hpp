@@ -0,0 +1,444 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <utility>
+#include <vector>
+
+// Persistent red-black tree: every version of the tree stays readable for as
+// long as someone holds it. Nodes are reference counted and shared between
+// versions. A write copies only the nodes on its root-to-leaf path that
+// another version still holds, and changes nodes no one else can see in
+// place, so it allocates O(log n) nodes and leaves every older version
+// intact. snapshot() pins the latest version in O(1), and the last holder of
+// a node frees it. The balancing is the left-leaning variant of red-black
+// trees, whose insert and remove are written top-down without parent links,
+// which path copying cannot keep.
+//
+// insert, remove and the queries on the map itself belong to one writer
+// thread. snapshot() may be called from any thread, and a Snapshot can be
+// read and dropped from any thread without blocking the writer. Equal keys
+// are allowed, a new key goes after the ones already in the tree.
+template<class Key, class Value, class Compare = std::less<Key>>
+class PersistentMap {
+    private:
+        struct Node {
+            std::atomic<size_t> refs;
+            Node *left;
+            Node *right;
+            bool  red;
+            Key   key;
+            Value value;
+
+            Node(const Key &key, const Value &value, bool red, Node *left, Node *right)
+                : refs(1), left(left), right(right), red(red), key(key), value(value) {}
+        };
+
+        static Node* retain(Node *node) {
+            if(node != nullptr) {
+                node->refs.fetch_add(1, std::memory_order_relaxed);
+            }
+            return node;
+        }
+
+        // Drops one reference and frees whatever it kept alive alone
+        static void release(Node *node) {
+            std::vector<Node*> pending = {node};
+            while(!pending.empty()) {
+                node = pending.back();
+                pending.pop_back();
+                if(node != nullptr && node->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                    pending.push_back(node->left);
+                    pending.push_back(node->right);
+                    delete node;
+                }
+            }
+        }
+
+        static bool is_red(const Node *node) {
+            return node != nullptr && node->red;
+        }
+
+        // Read-only queries shared by the map and its snapshots
+
+        static const Node* search_node(const Node *node, const Key &key, const Compare &compare) {
+            while(node != nullptr) {
+                if(compare(key, node->key)) {
+                    node = node->left;
+                } else if(compare(node->key, key)) {
+                    node = node->right;
+                } else {
+                    return node;
+                }
+            }
+            return nullptr;
+        }
+
+        static std::optional<Value> min_value(const Node *node) {
+            if(node == nullptr) {
+                return std::nullopt;
+            }
+            while(node->left != nullptr) {
+                node = node->left;
+            }
+            return node->value;
+        }
+
+        static std::optional<Value> max_value(const Node *node) {
+            if(node == nullptr) {
+                return std::nullopt;
+            }
+            while(node->right != nullptr) {
+                node = node->right;
+            }
+            return node->value;
+        }
+
+        // Without parent links, the neighbours of key are the last nodes
+        // passed on either side during one descent
+
+        static std::optional<Value> predecessor_value(const Node *node, const Key &key, const Compare &compare) {
+            const Node *below = nullptr;
+            bool found = false;
+            while(node != nullptr) {
+                if(compare(node->key, key)) {
+                    below = node;
+                    node = node->right;
+                } else {
+                    found = found || !compare(key, node->key);
+                    node = node->left;
+                }
+            }
+            if(found && below != nullptr) {
+                return below->value;
+            }
+            return std::nullopt;
+        }
+
+        static std::optional<Value> successor_value(const Node *node, const Key &key, const Compare &compare) {
+            const Node *above = nullptr;
+            bool found = false;
+            while(node != nullptr) {
+                if(compare(key, node->key)) {
+                    above = node;
+                    node = node->left;
+                } else {
+                    found = found || !compare(node->key, key);
+                    node = node->right;
+                }
+            }
+            if(found && above != nullptr) {
+                return above->value;
+            }
+            return std::nullopt;
+        }
+
+        static void print_values(const Node *node, std::ostream &out) {
+            std::vector<const Node*> stack;
+            while(node != nullptr || !stack.empty()) {
+                for(; node != nullptr; node = node->left) {
+                    stack.push_back(node);
+                }
+                node = stack.back();
+                stack.pop_back();
+                out << node->value << " ";
+                node = node->right;
+            }
+        }
+
+    public:
+        // One pinned version of the tree. Copies share it, and the nodes are
+        // freed when the last snapshot and the map itself have moved on
+        class Snapshot {
+            private:
+                friend class PersistentMap;
+
+                Node *root;
+                size_t count;
+                Compare compare;
+
+                Snapshot(Node *root, size_t count, const Compare &compare) : root(root), count(count), compare(compare) {}
+
+            public:
+                Snapshot() : root(nullptr), count(0) {}
+
+                Snapshot(const Snapshot &other) : root(retain(other.root)), count(other.count), compare(other.compare) {}
+
+                Snapshot(Snapshot &&other) noexcept : root(other.root), count(other.count), compare(other.compare) {
+                    other.root = nullptr;
+                    other.count = 0;
+                }
+
+                Snapshot& operator=(Snapshot other) noexcept {
+                    std::swap(root, other.root);
+                    std::swap(count, other.count);
+                    std::swap(compare, other.compare);
+                    return *this;
+                }
+
+                ~Snapshot() {
+                    release(root);
+                }
+
+                size_t size() const { return count; }
+                bool empty() const { return count == 0; }
+
+                std::optional<Value> search(const Key &key) const {
+                    const Node *node = search_node(root, key, compare);
+                    if(node != nullptr) {
+                        return node->value;
+                    }
+                    return std::nullopt;
+                }
+
+                std::optional<Value> get_min() const { return min_value(root); }
+                std::optional<Value> get_max() const { return max_value(root); }
+
+                // Values of the nearest smaller and larger keys, when key is in the tree
+                std::optional<Value> get_predecessor(const Key &key) const { return predecessor_value(root, key, compare); }
+                std::optional<Value> get_successor(const Key &key) const   { return successor_value(root, key, compare); }
+
+                // Writes every value in key order, each followed by a space
+                void print_in_order(std::ostream &out) const {
+                    print_values(root, out);
+                }
+        };
+
+    private:
+        Node *root;
+        size_t count;
+        Compare compare;
+
+        // The version snapshot() hands out, replaced after every write. Only
+        // the pointer swap and the reference count bump are under the lock
+        mutable std::mutex publish_lock;
+        Node *published;
+        size_t published_count;
+
+        void publish() {
+            Node *old;
+            {
+                std::lock_guard<std::mutex> lock(publish_lock);
+                old = published;
+                published = retain(root);
+                published_count = count;
+            }
+            release(old);
+        }
+
+        // Returns node itself when this version holds the only reference,
+        // otherwise a private copy that takes over the caller's reference.
+        // Every node a write changes goes through here first
+        static Node* own(Node *node) {
+            if(node->refs.load(std::memory_order_acquire) == 1) {
+                return node;
+            }
+
+            Node *copy = new Node(node->key, node->value, node->red, retain(node->left), retain(node->right));
+            release(node);
+            return copy;
+        }
+
+        // The helpers below take an owned node and return the owned root of
+        // the same subtree
+
+        static Node* rotate_left(Node *node) {
+            Node *target = own(node->right);
+            node->right = target->left;
+            target->left = node;
+            target->red = node->red;
+            node->red = true;
+            return target;
+        }
+
+        static Node* rotate_right(Node *node) {
+            Node *target = own(node->left);
+            node->left = target->right;
+            target->right = node;
+            target->red = node->red;
+            node->red = true;
+            return target;
+        }
+
+        static void flip_colors(Node *node) {
+            node->left = own(node->left);
+            node->right = own(node->right);
+            node->red = !node->red;
+            node->left->red = !node->left->red;
+            node->right->red = !node->right->red;
+        }
+
+        // Restores the left-leaning shape on the way back up
+        static Node* balance(Node *node) {
+            if(is_red(node->right) && !is_red(node->left)) {
+                node = rotate_left(node);
+            }
+            if(is_red(node->left) && is_red(node->left->left)) {
+                node = rotate_right(node);
+            }
+            if(is_red(node->left) && is_red(node->right)) {
+                flip_colors(node);
+            }
+            return node;
+        }
+
+        // Make the left or right child, or one of its children, red before
+        // descending into it, so a removal never leaves a black leaf gap
+
+        static Node* move_red_left(Node *node) {
+            flip_colors(node);
+            if(is_red(node->right->left)) {
+                node->right = rotate_right(node->right);
+                node = rotate_left(node);
+                flip_colors(node);
+            }
+            return node;
+        }
+
+        static Node* move_red_right(Node *node) {
+            flip_colors(node);
+            if(is_red(node->left->left)) {
+                node = rotate_right(node);
+                flip_colors(node);
+            }
+            return node;
+        }
+
+        Node* insert_into(Node *node, const Key &key, const Value &value) {
+            if(node == nullptr) {
+                return new Node(key, value, true, nullptr, nullptr);
+            }
+
+            node = own(node);
+            if(compare(key, node->key)) {
+                node->left = insert_into(node->left, key, value);
+            } else {
+                node->right = insert_into(node->right, key, value);
+            }
+            return balance(node);
+        }
+
+        static Node* remove_min(Node *node) {
+            node = own(node);
+            if(node->left == nullptr) {
+                release(node);
+                return nullptr;
+            }
+
+            if(!is_red(node->left) && !is_red(node->left->left)) {
+                node = move_red_left(node);
+            }
+            node->left = remove_min(node->left);
+            return balance(node);
+        }
+
+        // key has to be in the subtree
+        Node* remove_from(Node *node, const Key &key) {
+            node = own(node);
+            if(compare(key, node->key)) {
+                if(!is_red(node->left) && !is_red(node->left->left)) {
+                    node = move_red_left(node);
+                }
+                node->left = remove_from(node->left, key);
+                return balance(node);
+            }
+
+            // A right rotation moves the matching node into the right
+            // subtree, and an equal key that takes its place is not the one
+            // to remove, it sits on the left of it
+            bool match = !compare(node->key, key);
+            if(is_red(node->left)) {
+                node = rotate_right(node);
+                match = false;
+            }
+            if(match && node->right == nullptr) {
+                release(node);
+                return nullptr;
+            }
+            if(!is_red(node->right) && !is_red(node->right->left)) {
+                Node *top = node;
+                node = move_red_right(node);
+                match = match && node == top;
+            }
+
+            if(match) {
+                // Take over the smallest entry on the right, then remove it there
+                const Node *next = node->right;
+                while(next->left != nullptr) {
+                    next = next->left;
+                }
+                node->key = next->key;
+                node->value = next->value;
+                node->right = remove_min(node->right);
+            } else {
+                node->right = remove_from(node->right, key);
+            }
+            return balance(node);
+        }
+
+    public:
+        PersistentMap() : root(nullptr), count(0), published(nullptr), published_count(0) {}
+
+        PersistentMap(const PersistentMap &) = delete;
+        PersistentMap& operator=(const PersistentMap &) = delete;
+
+        ~PersistentMap() {
+            release(root);
+            release(published);
+        }
+
+        size_t size() const { return count; }
+        bool empty() const { return count == 0; }
+
+        Snapshot snapshot() const {
+            std::lock_guard<std::mutex> lock(publish_lock);
+            return Snapshot(retain(published), published_count, compare);
+        }
+
+        void insert(const Key &key, const Value &value) {
+            root = insert_into(root, key, value);
+            root->red = false;
+            count++;
+            publish();
+        }
+
+        // Returns false when key is not in the tree
+        bool remove(const Key &key) {
+            if(search_node(root, key, compare) == nullptr) {
+                return false;
+            }
+
+            root = own(root);
+            if(!is_red(root->left) && !is_red(root->right)) {
+                root->red = true;
+            }
+            root = remove_from(root, key);
+            if(root != nullptr) {
+                root->red = false;
+            }
+            count--;
+            publish();
+            return true;
+        }
+
+        std::optional<Value> search(const Key &key) const {
+            const Node *node = search_node(root, key, compare);
+            if(node != nullptr) {
+                return node->value;
+            }
+            return std::nullopt;
+        }
+
+        std::optional<Value> get_min() const { return min_value(root); }
+        std::optional<Value> get_max() const { return max_value(root); }
+        std::optional<Value> get_predecessor(const Key &key) const { return predecessor_value(root, key, compare); }
+        std::optional<Value> get_successor(const Key &key) const   { return successor_value(root, key, compare); }
+
+        void print_in_order(std::ostream &out) const {
+            print_values(root, out);
+        }
+};
\ No newline at end of file
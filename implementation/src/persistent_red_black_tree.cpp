@@ -0,0 +1,85 @@
+#include <iostream>
+#include <utility>
+
+#include "persistent_red_black_tree.hpp"
+
+// Missing keys and empty trees are reported as -1
+
+PersistentRedBlackTree::Snapshot::Snapshot(Map::Snapshot version) : version(std::move(version)) {}
+
+int PersistentRedBlackTree::Snapshot::search(int key) const {
+    return version.search(key).value_or(-1);
+}
+
+int PersistentRedBlackTree::Snapshot::get_min() const {
+    return version.get_min().value_or(-1);
+}
+
+int PersistentRedBlackTree::Snapshot::get_max() const {
+    return version.get_max().value_or(-1);
+}
+
+int PersistentRedBlackTree::Snapshot::get_predecessor(int key) const {
+    return version.get_predecessor(key).value_or(-1);
+}
+
+int PersistentRedBlackTree::Snapshot::get_successor(int key) const {
+    return version.get_successor(key).value_or(-1);
+}
+
+size_t PersistentRedBlackTree::Snapshot::size() const {
+    return version.size();
+}
+
+void PersistentRedBlackTree::Snapshot::print_in_order() const {
+    std::cout << "Printing Persistent Red-Black Tree snapshot inorder: ";
+    version.print_in_order(std::cout);
+    std::cout << std::endl;
+}
+
+int PersistentRedBlackTree::search(int key) {
+    return map.search(key).value_or(-1);
+}
+
+void PersistentRedBlackTree::insert(int data) {
+    insert(data, data);
+}
+
+void PersistentRedBlackTree::insert(int key, int data) {
+    map.insert(key, data);
+}
+
+void PersistentRedBlackTree::remove(int key) {
+    map.remove(key);
+}
+
+int PersistentRedBlackTree::get_min() {
+    return map.get_min().value_or(-1);
+}
+
+int PersistentRedBlackTree::get_max() {
+    return map.get_max().value_or(-1);
+}
+
+int PersistentRedBlackTree::get_predecessor(int key) {
+    return map.get_predecessor(key).value_or(-1);
+}
+
+int PersistentRedBlackTree::get_successor(int key) {
+    return map.get_successor(key).value_or(-1);
+}
+
+size_t PersistentRedBlackTree::size() const {
+    return map.size();
+}
+
+// O(1), safe to call from any thread while the writer keeps going
+PersistentRedBlackTree::Snapshot PersistentRedBlackTree::snapshot() const {
+    return Snapshot(map.snapshot());
+}
+
+void PersistentRedBlackTree::print_in_order() {
+    std::cout << "Printing Persistent Red-Black Tree inorder: ";
+    map.print_in_order(std::cout);
+    std::cout << std::endl;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+
+#include "persistent_map.hpp"
+
+// Red-black tree whose versions can be pinned in O(1) with snapshot() and
+// read for as long as needed while the writer keeps going
+class PersistentRedBlackTree {
+    public:
+        typedef PersistentMap<int, int> Map;
+
+        // Read-only view of the tree as it was when snapshot() was called
+        class Snapshot {
+            private:
+                Map::Snapshot version;
+
+            public:
+                Snapshot() = default;
+                explicit Snapshot(Map::Snapshot version);
+
+                int  search(int key) const;
+                int  get_min() const;
+                int  get_max() const;
+                int  get_predecessor(int key) const;
+                int  get_successor(int key) const;
+                size_t size() const;
+                void print_in_order() const;
+        };
+
+    private:
+        Map map;
+
+    public:
+        int  search(int key);
+        void insert(int data);
+        void insert(int key, int data);
+        void remove(int key);
+        int  get_min();
+        int  get_max();
+        int  get_predecessor(int key);
+        int  get_successor(int key);
+        size_t size() const;
+        Snapshot snapshot() const;
+        void print_in_order();
+};
@@ -1,422 +1,194 @@
 #include <iostream>
+#include <vector>
 
 #include "red_black_tree.hpp"
 
-RedBlackTree::RedBlackTree() {
-    root = nullptr;
-}
+// Missing keys and empty trees are reported as -1
 
-RedBlackTree::~RedBlackTree() {
-    rec_delete_tree(root);
+template<class BalancePolicy>
+int BasicRedBlackTree<BalancePolicy>::search(int key) {
+    return map.search(key).value_or(-1);
 }
 
-RedBlackNode* RedBlackTree::search_node(int key) {
-    RedBlackNode *tmp = root;
-    while(tmp != nullptr && tmp->key != key) {
-        tmp = (tmp->key > key) ? tmp->left : tmp->right;
-    }
-
-    if(tmp != nullptr && tmp->key == key) {
-        return tmp;
-    }
-
-    return nullptr;
+template<class BalancePolicy>
+bool BasicRedBlackTree<BalancePolicy>::contains(int key) {
+    return map.contains(key);
 }
 
-RedBlackNode* RedBlackTree::get_min_node(RedBlackNode *node) {
-    if(node == nullptr) {
-        return nullptr;
-    }
-
-    while(node->left != nullptr) {
-        node = node->left;
-    }
-
-    return node;
+template<class BalancePolicy>
+void BasicRedBlackTree<BalancePolicy>::search_batch(const int *keys, int *out, size_t n) {
+    map.search_batch(keys, out, n, -1);
 }
 
-RedBlackNode* RedBlackTree::get_max_node(RedBlackNode *node) {
-    if(node == nullptr) {
-        return nullptr;
-    }
-
-    while(node->right != nullptr) {
-        node = node->right;
-    }
-
-    return node;
+template<class BalancePolicy>
+void BasicRedBlackTree<BalancePolicy>::insert(int data) {
+    insert(data, data);
 }
 
-RedBlackNode* RedBlackTree::get_predecessor_node(RedBlackNode *node) {
-    if(node == nullptr) {
-        return nullptr;
-    }
-
-    // Attempt to get the largest value in the left subtree
-    RedBlackNode *tmp = get_max_node(node->left);
-    
-    // If tmp is nullptr, then node does not have a right subtree
-    // therefore, the next value will be a parent node
-    if(tmp == nullptr) {
-        tmp = node->parent;
-
-        // If tmp's left child is the current node, then the node is
-        // smaller than tmp, however it will be larger than tmp's parent
-        // So the predecessor must be higher up in the tree
-        while(tmp != nullptr && tmp->left == node) {
-            node = tmp;
-            tmp = tmp->parent;
-        }
-        
-        // By the end of the while loop, tmp will be the proper predecessor to the original input node
-    }
-
-    return tmp;
+template<class BalancePolicy>
+void BasicRedBlackTree<BalancePolicy>::insert(int key, int data) {
+    map.insert(key, data);
 }
 
-RedBlackNode* RedBlackTree::get_successor_node(RedBlackNode *node) {
-    if(node == nullptr) {
-        return nullptr;
-    }
-
-    // Attempt to get the smallest value in the right subtree
-    RedBlackNode *tmp = get_min_node(node->right);
-    
-    // If tmp is nullptr, then node does not have a right subtree
-    // therefore, the next value will be a parent node
-    if(tmp == nullptr) {
-        tmp = node->parent;
-
-        // If tmp's right child is the current node, then the node is
-        // larger than tmp, however it will be less than tmp's parent
-        // So the successor must be higher up in the tree
-        while(tmp != nullptr && tmp->right == node) {
-            node = tmp;
-            tmp = tmp->parent;
-        }
-        
-        // By the end of the while loop, tmp will be the proper successor to the original input node
-    }
-
-    return tmp;
+// Replaces the tree with the (key, data) pairs in [begin, end), sorted by key
+template<class BalancePolicy>
+void BasicRedBlackTree<BalancePolicy>::build_from_sorted(const std::pair<int, int> *begin, const std::pair<int, int> *end) {
+    map.build_from_sorted(begin, end);
 }
 
-void RedBlackTree::rec_print_in_order(RedBlackNode *node) {
-    if(node->left != nullptr) { 
-        rec_print_in_order(node->left);
-    }
-
-    std::cout << node->data << " ";
-
-    if(node->right != nullptr) {
-        rec_print_in_order(node->right);
-    }
+template<class BalancePolicy>
+void BasicRedBlackTree<BalancePolicy>::remove(int key) {
+    map.remove(key);
 }
 
-void RedBlackTree::rec_delete_tree(RedBlackNode *node) {
-    if(node->left != nullptr) { 
-        rec_delete_tree(node->left);
-    }
-
-    delete node;
-
-    if(node->right != nullptr) {
-        rec_delete_tree(node->right);
-    }
+template<class BalancePolicy>
+int BasicRedBlackTree<BalancePolicy>::get_min() {
+    return map.get_min().value_or(-1);
 }
 
-void RedBlackTree::transplant(RedBlackNode *node1, RedBlackNode *node2) {
-    if(node1->parent == nullptr) {
-        root = node2;
-    } else if(node1 == node1->parent->left) {
-        node1->parent->left = node2;
-    } else { // node1->parent->right == node1
-        node1->parent->right = node2;
-    }
-
-    if(node2 != nullptr) {
-        node2->parent = node1->parent;
-    }
+template<class BalancePolicy>
+int BasicRedBlackTree<BalancePolicy>::get_max() {
+    return map.get_max().value_or(-1);
 }
 
-void RedBlackTree::left_rotate(RedBlackNode *node) {
-    if(node == nullptr) {
-        return;
-    }
-
-    // target will take node's place in the rotation process
-    // - target's left will contain node (and by extention node's subtrees)
-    // - node's right will take target's left subtree
-    // - target's right will remain as is
-    RedBlackNode *target = node->right;
-    node->right = target->left;
-
-    if(target->left != nullptr) {
-        target->left->parent = node;
-    }
-
-    target->parent = node->parent;
-
-    transplant(node, target);
-
-    target->left = node;
-    node->parent = target;
+template<class BalancePolicy>
+int BasicRedBlackTree<BalancePolicy>::get_predecessor(int key) {
+    return map.get_predecessor(key).value_or(-1);
 }
 
-void RedBlackTree::right_rotate(RedBlackNode *node) {
-    if(node == nullptr) {
-        return;
-    }
-
-    // target will take node's place in the rotation process
-    // - target's right will contain node (and by extention node's subtrees)
-    // - node's left will take target's right subtree
-    // - target's left will remain as is
-    RedBlackNode *target = node->left;
-    node->left = target->right;
-
-    if(target->right != nullptr) {
-        target->right->parent = node;
-    }
-
-    target->parent = node->parent;
+template<class BalancePolicy>
+int BasicRedBlackTree<BalancePolicy>::get_successor(int key) {
+    return map.get_successor(key).value_or(-1);
+}
 
-    transplant(node, target);
+// The bound queries take any key, not only keys in the tree
 
-    target->right = node;
-    node->parent = target;
+// Data of the first key >= key
+template<class BalancePolicy>
+int BasicRedBlackTree<BalancePolicy>::lower_bound(int key) {
+    typename Map::const_iterator it = map.lower_bound(key);
+    return (it != map.end()) ? it.value() : -1;
 }
 
-void RedBlackTree::red_black_insert_fixup(RedBlackNode *node) {
-    while(node->parent != nullptr && node->parent->color == NodeColor::red) {
-        if(node->parent->parent != nullptr) {
-            if(node->parent == node->parent->parent->left) {
-                RedBlackNode *tmp = node->parent->parent->right;
-
-                if(tmp != nullptr && tmp->color == NodeColor::red) {
-                    node->parent->color = NodeColor::black;
-                    tmp->color = NodeColor::black;
-                    node->parent->parent->color = NodeColor::red;
-                    node = node->parent->parent;
-                } else {
-                    if (node == node->parent->right) {
-                        node = node->parent;
-                        left_rotate(node);
-                    }
-
-                    node->parent->color = NodeColor::black;
-                    node->parent->parent->color = NodeColor::red;
-                    right_rotate(node->parent->parent);
-                }
-            } else {
-                RedBlackNode *tmp = node->parent->parent->left;
-
-                if(tmp != nullptr && tmp->color == NodeColor::red) {
-                    node->parent->color = NodeColor::black;
-                    tmp->color = NodeColor::black;
-                    node->parent->parent->color = NodeColor::red;
-                    node = node->parent->parent;
-                } else {
-                    if (node == node->parent->left) {
-                        node = node->parent;
-                        right_rotate(node);
-                    }
-
-                    node->parent->color = NodeColor::black;
-                    node->parent->parent->color = NodeColor::red;
-                    left_rotate(node->parent->parent);
-                }
-            }
-        }
-    }
-
-    if(root != nullptr) {
-        root->color = NodeColor::black;
-    }
+// Data of the first key > key
+template<class BalancePolicy>
+int BasicRedBlackTree<BalancePolicy>::upper_bound(int key) {
+    typename Map::const_iterator it = map.upper_bound(key);
+    return (it != map.end()) ? it.value() : -1;
 }
 
-void RedBlackTree::red_black_delete_fixup(RedBlackNode *node) {
-    while(node->parent != nullptr && node != root && node->color != NodeColor::black) {
-        if(node == node->parent->left) {
-            RedBlackNode *tmp = node->parent->right;
-            
-            if(tmp->color == NodeColor::red) {
-                tmp->color = NodeColor::black;
-                node->parent->color = NodeColor::black;
-                node->parent->color = NodeColor::red;
-                left_rotate(node->parent);
-                tmp = node->parent->right;
-            }
-            if (tmp->left->color == NodeColor::black && tmp->right->color == NodeColor::black) {
-                tmp->color = NodeColor::red;
-                node = node->parent;
-            } else {
-                if (tmp->right->color == NodeColor::black) {
-                    tmp->left->color = NodeColor::black;
-                    tmp->color = NodeColor::red;
-                    right_rotate(tmp);
-                    tmp = node->parent->right;
-                }
-                tmp->color = node->parent->color;
-                node->parent->color = NodeColor::black;
-                tmp->right->color = NodeColor::black;
-                left_rotate(node->parent);
-                node = root;
-            }
-        } else {
-            RedBlackNode *tmp = node->parent->left;
-            
-            if(tmp->color == NodeColor::red) {
-                tmp->color = NodeColor::black;
-                node->parent->color = NodeColor::black;
-                node->parent->color = NodeColor::red;
-                right_rotate(node->parent);
-                tmp = node->parent->left;
-            }
-            if (tmp->left->color == NodeColor::black && tmp->right->color == NodeColor::black) {
-                tmp->color = NodeColor::red;
-                node = node->parent;
-            } else {
-                if (tmp->left->color == NodeColor::black) {
-                    tmp->right->color = NodeColor::black;
-                    tmp->color = NodeColor::red;
-                    left_rotate(tmp);
-                    tmp = node->parent->left;
-                }
-                tmp->color = node->parent->color;
-                node->parent->color = NodeColor::black;
-                tmp->left->color = NodeColor::black;
-                right_rotate(node->parent);
-                node = root;
-            }
-        }
-    }
+// Data of the last key <= key
+template<class BalancePolicy>
+int BasicRedBlackTree<BalancePolicy>::floor(int key) {
+    typename Map::const_iterator it = map.floor(key);
+    return (it != map.end()) ? it.value() : -1;
+}
 
-    if(root != nullptr) {
-        root->color = NodeColor::black;
-    }
+// Data of the first key >= key
+template<class BalancePolicy>
+int BasicRedBlackTree<BalancePolicy>::ceiling(int key) {
+    typename Map::const_iterator it = map.ceiling(key);
+    return (it != map.end()) ? it.value() : -1;
 }
 
-void RedBlackTree::insert(int data) {
-    insert(data, data);
+template<class BalancePolicy>
+typename BasicRedBlackTree<BalancePolicy>::iterator BasicRedBlackTree<BalancePolicy>::begin() const {
+    return map.begin();
 }
 
-void RedBlackTree::insert(int key, int data) {
-    RedBlackNode *new_node = new RedBlackNode;
-    new_node->key   = key;
-    new_node->data  = data;
-    new_node->left  = new_node->right = nullptr;
-    new_node->color = NodeColor::red;
-
-    if(root != nullptr) {
-        RedBlackNode *tmp = root;
-        while((tmp->left != nullptr && tmp->key > key) || (tmp->right != nullptr && tmp->key <= key)) {
-            tmp = (tmp->key > key) ? tmp->left : tmp->right;
-        }
-
-        new_node->parent = tmp;
-        if(tmp->key > key) {
-            tmp->left = new_node;
-        } else {
-            tmp->right = new_node;
-        }
-    } else {
-        new_node->parent = nullptr;
-        root = new_node;
-        root->color = NodeColor::black;
-    }
+template<class BalancePolicy>
+typename BasicRedBlackTree<BalancePolicy>::iterator BasicRedBlackTree<BalancePolicy>::end() const {
+    return map.end();
+}
 
-    red_black_insert_fixup(new_node);
+// Entries with keys in [lo, hi]
+template<class BalancePolicy>
+typename BasicRedBlackTree<BalancePolicy>::Map::Range BasicRedBlackTree<BalancePolicy>::range(int lo, int hi) const {
+    return map.range(lo, hi);
 }
 
-int RedBlackTree::search(int key) {
-    RedBlackNode *node = search_node(key);
-    if(node != nullptr) {
-        return node->data;
+// Every (key, data) pair in key order
+template<class BalancePolicy>
+std::vector<std::pair<int, int>> BasicRedBlackTree<BalancePolicy>::entries() const {
+    std::vector<std::pair<int, int>> entries;
+    entries.reserve(map.size());
+    for(typename Map::const_iterator it = map.begin(); it != map.end(); ++it) {
+        entries.push_back({it.key(), it.value()});
     }
-    return -1;
+    return entries;
 }
 
-void RedBlackTree::remove(int key) {
-    RedBlackNode *nodeToRemove = search_node(key);
-    RedBlackNode *other_node = nullptr;
+// Immutable snapshot of the current entries for read-mostly phases
+template<class BalancePolicy>
+FrozenIndex BasicRedBlackTree<BalancePolicy>::freeze() const {
+    std::vector<std::pair<int, int>> entries = this->entries();
+    return FrozenIndex(entries.data(), entries.data() + entries.size());
+}
 
-    if(nodeToRemove == nullptr) {
-        return;
-    }
+// Set operations by key on the shared work-stealing pool, other ends up empty
+template<class BalancePolicy>
+void BasicRedBlackTree<BalancePolicy>::set_union(BasicRedBlackTree &other) {
+    map.set_union(other.map, &WorkStealingPool::shared());
+}
 
-    NodeColor original_color = nodeToRemove->color;
-
-    if(nodeToRemove->left == nullptr) {
-        transplant(nodeToRemove, nodeToRemove->right);
-    } else if (nodeToRemove->right == nullptr) {
-        transplant(nodeToRemove, nodeToRemove->left);
-    } else {
-        RedBlackNode *nodeToReplace = get_min_node(nodeToRemove->right);
-        original_color = nodeToReplace->color;
-
-        other_node = nodeToReplace->right;
-
-        if(nodeToReplace->parent == nodeToRemove) {
-            other_node->parent = nodeToReplace;
-        } else {
-            transplant(nodeToReplace, nodeToReplace->right);
-            nodeToReplace->right = nodeToRemove->right;
-            nodeToReplace->right->parent = nodeToReplace;
-        }
-
-        transplant(nodeToRemove, nodeToReplace);
-        nodeToReplace->left = nodeToRemove->left;
-        nodeToReplace->left->parent = nodeToReplace;
-        nodeToReplace->color = nodeToRemove->color;
-    }
+template<class BalancePolicy>
+void BasicRedBlackTree<BalancePolicy>::set_intersection(BasicRedBlackTree &other) {
+    map.set_intersection(other.map, &WorkStealingPool::shared());
+}
 
-    delete nodeToRemove;
+template<class BalancePolicy>
+void BasicRedBlackTree<BalancePolicy>::set_difference(BasicRedBlackTree &other) {
+    map.set_difference(other.map, &WorkStealingPool::shared());
+}
 
-    if(original_color == NodeColor::black) {
-        red_black_delete_fixup(other_node);
-    }
+// Becomes left, then pivot, then right, which end up empty. O(log n) when
+// left's keys are not above pivot and right's are not below it
+template<class BalancePolicy>
+void BasicRedBlackTree<BalancePolicy>::join(BasicRedBlackTree &left, int pivot, BasicRedBlackTree &right) {
+    map.join(left.map, pivot, pivot, right.map);
+}
 
+// Counters are only kept when built with -DTREE_STATS, size is always
+// reported and the O(n) height when with_height is set
+template<class BalancePolicy>
+TreeStatsSnapshot BasicRedBlackTree<BalancePolicy>::stats(bool with_height) const {
+    return map.stats(with_height);
 }
 
-int RedBlackTree::get_max() {
-    if(root != nullptr) {
-        return get_max_node(root)->data;
-    }
+template<class BalancePolicy>
+void BasicRedBlackTree<BalancePolicy>::reset_stats() {
+    map.reset_stats();
+}
 
-    return -1;
+template<class BalancePolicy>
+void BasicRedBlackTree<BalancePolicy>::print_in_order() {
+    std::cout << "Printing Red-Black Tree inorder: ";
+    map.print_in_order(std::cout);
+    std::cout << std::endl;
 }
 
-int RedBlackTree::get_min() {
-    if(root != nullptr) {
-        return get_min_node(root)->data;
-    }
+// The two trees red_black_tree.hpp names
+template class BasicRedBlackTree<RedBlackBalance>;
+template class BasicRedBlackTree<OrderStatistics<RedBlackBalance>>;
 
-    return -1;
+// Number of keys less than key
+size_t RankedRedBlackTree::rank(int key) {
+    return map.rank(key);
 }
 
-int RedBlackTree::get_predecessor(int key) {
-    RedBlackNode *node = search_node(key);
-    if(node != nullptr) {
-        RedBlackNode *predecessor_node = get_predecessor_node(node);
-
-        return (predecessor_node != nullptr) ? predecessor_node->data : -1;
-    }
-    return -1;
+// The k-th smallest key, counting from 0
+int RankedRedBlackTree::select(size_t k) {
+    Map::const_iterator it = map.select(k);
+    return (it != map.end()) ? it.key() : -1;
 }
 
-int RedBlackTree::get_successor(int key) {
-    RedBlackNode *node = search_node(key);
-    if(node != nullptr) {
-        RedBlackNode *successor_node = get_successor_node(node);
+// Number of keys in [lo, hi]
+size_t RankedRedBlackTree::count_range(int lo, int hi) {
+    return map.count_range(lo, hi);
+}
 
-        return (successor_node != nullptr) ? successor_node->data : -1;
-    }
-    return node->data;
+// Keeps the keys below key and moves the rest into upper, in O(log n)
+void RankedRedBlackTree::split(int key, RankedRedBlackTree &upper) {
+    map.split(key, upper.map);
 }
 
-void RedBlackTree::print_in_order() {
-    std::cout << "Printing Red-Black Tree inorder: ";
-    rec_print_in_order(root);
-    std::cout << std::endl;
-}
\ No newline at end of file
@@ -1,46 +1,63 @@
 #pragma once
 
-enum NodeColor {
-    black, red
-};
-
-struct RedBlackNode {
-    int key;
-    int data;
-    NodeColor color;
-    RedBlackNode *left;
-    RedBlackNode *right;
-    RedBlackNode *parent;
-};
+#include <utility>
+#include <vector>
 
-class RedBlackTree {
-    private:
-        RedBlackNode *root;
-    
-        RedBlackNode* search_node(int key);
-        RedBlackNode* get_min_node(RedBlackNode *node);
-        RedBlackNode* get_max_node(RedBlackNode *node);
-        RedBlackNode* get_predecessor_node(RedBlackNode *node);
-        RedBlackNode* get_successor_node(RedBlackNode *node);
-        void rec_print_in_order(RedBlackNode *node);
-        void rec_delete_tree(RedBlackNode *node);
-        void transplant(RedBlackNode *node1, RedBlackNode *node2);
-        void left_rotate(RedBlackNode *node);
-        void right_rotate(RedBlackNode *node);
-        void red_black_insert_fixup(RedBlackNode *node);
-        void red_black_delete_fixup(RedBlackNode *node);
+#include "frozen_index.hpp"
+#include "ordered_map.hpp"
 
+// Int red-black tree over BalancePolicy, RedBlackBalance or the
+// OrderStatistics wrapper around it. Use RedBlackTree, or
+// RankedRedBlackTree for the queries that need subtree sizes
+template<class BalancePolicy>
+class BasicRedBlackTree {
     public:
-        RedBlackTree();
-        ~RedBlackTree();
+        typedef OrderedMap<int, int, std::less<int>, BalancePolicy, PointerLayout<>, IntTreeStats> Map;
+        typedef typename Map::const_iterator iterator;
 
+    protected:
+        Map map;
+
+    public:
         int  search(int key);
+        bool contains(int key);
+        void search_batch(const int *keys, int *out, size_t n);
         void insert(int data);
         void insert(int key, int data);
+        void build_from_sorted(const std::pair<int, int> *begin, const std::pair<int, int> *end);
         void remove(int key);
         int  get_min();
         int  get_max();
         int  get_predecessor(int key);
         int  get_successor(int key);
+        int  lower_bound(int key);
+        int  upper_bound(int key);
+        int  floor(int key);
+        int  ceiling(int key);
+        iterator begin() const;
+        iterator end() const;
+        typename Map::Range range(int lo, int hi) const;
+        std::vector<std::pair<int, int>> entries() const;
+        FrozenIndex freeze() const;
+        TreeStatsSnapshot stats(bool with_height = false) const;
+        void reset_stats();
+        void set_union(BasicRedBlackTree &other);
+        void set_intersection(BasicRedBlackTree &other);
+        void set_difference(BasicRedBlackTree &other);
+        void join(BasicRedBlackTree &left, int pivot, BasicRedBlackTree &right);
         void print_in_order();
-};
\ No newline at end of file
+};
+
+// Plain red-black tree, nodes hold no subtree sizes
+typedef BasicRedBlackTree<RedBlackBalance> RedBlackTree;
+
+// Keeps the size of every subtree in its node, 8 more bytes per node and a
+// walk up to the root on every insert and remove, for rank, select,
+// count_range and split in O(log n)
+class RankedRedBlackTree : public BasicRedBlackTree<OrderStatistics<RedBlackBalance>> {
+    public:
+        size_t rank(int key);
+        int    select(size_t k);
+        size_t count_range(int lo, int hi);
+        void   split(int key, RankedRedBlackTree &upper);
+};
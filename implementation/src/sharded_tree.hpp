@@ -0,0 +1,337 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "avl_tree.hpp"
+#include "red_black_tree.hpp"
+
+// Splits the int key space into ranges, each held by its own Tree
+// (RedBlackTree or AVLTree) behind its own lock, so writers to different
+// ranges never wait for each other or share the top levels of one tree.
+// Point operations lock one shard. get_min, get_max and a predecessor or
+// successor found in another shard lock one shard at a time, so they are
+// not atomic across shards.
+//
+// Shard i holds the keys in [bounds[i - 1], bounds[i]). When inserts pile
+// up in one shard, rebalance() moves the bounds so every shard holds about
+// the same number of keys. It locks every shard and rebuilds them from
+// their sorted entries in O(n), so it is only triggered once a shard holds
+// SKEW_FACTOR times its share. Equal keys stay in one shard, so a rebalance
+// may leave a shard above its share; the next one then waits until that
+// shard's size has grown SKEW_FACTOR times, which keeps the rebuilds
+// amortized O(1) per insert. Readers of the bounds take no lock: they
+// route by the bounds they see and check, under the shard lock, that no
+// rebalance happened in between.
+//
+// Missing keys and empty trees are reported as -1, like the trees.
+template<class Tree>
+class ShardedTree {
+    public:
+        static constexpr size_t DEFAULT_SHARDS = 16;
+
+        // A shard more than SKEW_FACTOR times the average size triggers a
+        // rebalance. It is checked every REBALANCE_CHECK inserts into a
+        // shard, and not at all below MIN_REBALANCE_KEYS keys
+        static constexpr size_t SKEW_FACTOR = 2;
+        static constexpr size_t REBALANCE_CHECK = 1024;
+        static constexpr size_t MIN_REBALANCE_KEYS = 4096;
+
+    private:
+        // Padded so shards locked by different threads share no cache line
+        struct alignas(64) Shard {
+            std::mutex lock;
+            Tree tree;
+            std::atomic<size_t> count{0};
+        };
+
+        size_t shard_count;
+        std::unique_ptr<Shard[]> shards;
+        std::unique_ptr<std::atomic<int>[]> bounds; // shard_count - 1 of them, non-decreasing
+        std::atomic<uint64_t> layout_version;       // bumped by every rebalance
+        std::atomic<size_t> uneven_largest;         // largest shard the last rebalance could not split, or 0
+        std::mutex rebalance_lock;
+
+        size_t route(int key) const {
+            size_t lo = 0, hi = shard_count - 1;
+            while(lo < hi) {
+                size_t mid = (lo + hi) / 2;
+                if(key < bounds[mid].load(std::memory_order_relaxed)) {
+                    hi = mid;
+                } else {
+                    lo = mid + 1;
+                }
+            }
+            return lo;
+        }
+
+        // Locks the shard that holds key and returns it. Retries when a
+        // rebalance moved the bounds between routing and locking
+        size_t lock_shard(int key, std::unique_lock<std::mutex> &guard) {
+            for(;;) {
+                uint64_t version = layout_version.load(std::memory_order_acquire);
+                size_t index = route(key);
+                guard = std::unique_lock<std::mutex>(shards[index].lock);
+                if(layout_version.load(std::memory_order_relaxed) == version) {
+                    return index;
+                }
+                guard.unlock();
+            }
+        }
+
+        // Whether the largest shard holds more than SKEW_FACTOR times its share,
+        // and SKEW_FACTOR times what the last rebalance had to leave in one shard
+        bool skewed() const {
+            size_t total = 0, largest = 0;
+            for(size_t i = 0; i < shard_count; i++) {
+                size_t count = shards[i].count.load(std::memory_order_relaxed);
+                total += count;
+                largest = std::max(largest, count);
+            }
+            return total >= MIN_REBALANCE_KEYS && largest * shard_count > SKEW_FACTOR * total
+                && largest > SKEW_FACTOR * uneven_largest.load(std::memory_order_relaxed);
+        }
+
+    public:
+        explicit ShardedTree(size_t shard_count = DEFAULT_SHARDS)
+            : shard_count(std::max<size_t>(shard_count, 1)),
+              shards(new Shard[this->shard_count]),
+              bounds(new std::atomic<int>[this->shard_count]),
+              layout_version(0),
+              uneven_largest(0) {
+            // Start with the int range cut into equal slices
+            int64_t span = ((int64_t)INT32_MAX - INT32_MIN + 1) / (int64_t)this->shard_count;
+            for(size_t i = 0; i + 1 < this->shard_count; i++) {
+                bounds[i].store((int)(INT32_MIN + span * (int64_t)(i + 1)), std::memory_order_relaxed);
+            }
+        }
+
+        ShardedTree(const ShardedTree &) = delete;
+        ShardedTree& operator=(const ShardedTree &) = delete;
+
+        size_t get_shard_count() const {
+            return shard_count;
+        }
+
+        // Rebalances so far
+        uint64_t rebalances() const {
+            return layout_version.load(std::memory_order_relaxed);
+        }
+
+        // Keys per shard, in key order
+        std::vector<size_t> shard_sizes() const {
+            std::vector<size_t> sizes;
+            for(size_t i = 0; i < shard_count; i++) {
+                sizes.push_back(shards[i].count.load(std::memory_order_relaxed));
+            }
+            return sizes;
+        }
+
+        size_t size() const {
+            size_t total = 0;
+            for(size_t i = 0; i < shard_count; i++) {
+                total += shards[i].count.load(std::memory_order_relaxed);
+            }
+            return total;
+        }
+
+        int search(int key) {
+            std::unique_lock<std::mutex> guard;
+            size_t index = lock_shard(key, guard);
+            return shards[index].tree.search(key);
+        }
+
+        void insert(int data) {
+            insert(data, data);
+        }
+
+        void insert(int key, int data) {
+            size_t count;
+            {
+                std::unique_lock<std::mutex> guard;
+                size_t index = lock_shard(key, guard);
+                shards[index].tree.insert(key, data);
+                count = shards[index].count.fetch_add(1, std::memory_order_relaxed) + 1;
+            }
+
+            // Another insert may have rebalanced while this one waited
+            if(count % REBALANCE_CHECK == 0 && skewed()) {
+                std::lock_guard<std::mutex> single(rebalance_lock);
+                if(skewed()) {
+                    redistribute();
+                }
+            }
+        }
+
+        void remove(int key) {
+            std::unique_lock<std::mutex> guard;
+            size_t index = lock_shard(key, guard);
+            if(shards[index].tree.contains(key)) {
+                shards[index].tree.remove(key);
+                shards[index].count.fetch_sub(1, std::memory_order_relaxed);
+            }
+        }
+
+        int get_min() {
+            for(size_t i = 0; i < shard_count; i++) {
+                std::lock_guard<std::mutex> guard(shards[i].lock);
+                if(shards[i].count.load(std::memory_order_relaxed) > 0) {
+                    return shards[i].tree.get_min();
+                }
+            }
+            return -1;
+        }
+
+        int get_max() {
+            for(size_t i = shard_count; i-- > 0;) {
+                std::lock_guard<std::mutex> guard(shards[i].lock);
+                if(shards[i].count.load(std::memory_order_relaxed) > 0) {
+                    return shards[i].tree.get_max();
+                }
+            }
+            return -1;
+        }
+
+        // When key is the smallest or largest in its shard, the neighbour is
+        // the largest or smallest key of the nearest non-empty shard
+
+        int get_predecessor(int key) {
+            size_t index;
+            {
+                std::unique_lock<std::mutex> guard;
+                index = lock_shard(key, guard);
+                Tree &tree = shards[index].tree;
+                if(!tree.contains(key)) {
+                    return -1;
+                }
+                int predecessor = tree.get_predecessor(key);
+                if(predecessor != -1) {
+                    return predecessor;
+                }
+            }
+
+            while(index-- > 0) {
+                std::lock_guard<std::mutex> guard(shards[index].lock);
+                if(shards[index].count.load(std::memory_order_relaxed) > 0) {
+                    return shards[index].tree.get_max();
+                }
+            }
+            return -1;
+        }
+
+        int get_successor(int key) {
+            size_t index;
+            {
+                std::unique_lock<std::mutex> guard;
+                index = lock_shard(key, guard);
+                Tree &tree = shards[index].tree;
+                if(!tree.contains(key)) {
+                    return -1;
+                }
+                int successor = tree.get_successor(key);
+                if(successor != -1) {
+                    return successor;
+                }
+            }
+
+            while(++index < shard_count) {
+                std::lock_guard<std::mutex> guard(shards[index].lock);
+                if(shards[index].count.load(std::memory_order_relaxed) > 0) {
+                    return shards[index].tree.get_min();
+                }
+            }
+            return -1;
+        }
+
+        // Calls visit(key, data) for every entry with a key in [lo, hi], in
+        // key order. The next shard is locked before the current one is
+        // released, in the order rebalance() locks them, so no rebalance
+        // can move entries past the scan
+        template<class Visit>
+        void range(int lo, int hi, Visit visit) {
+            if(hi < lo) {
+                return;
+            }
+
+            std::unique_lock<std::mutex> guard;
+            size_t index = lock_shard(lo, guard);
+            for(;;) {
+                typename Tree::Map::Range entries = shards[index].tree.range(lo, hi);
+                for(typename Tree::iterator it = entries.begin(); it != entries.end(); ++it) {
+                    visit(it.key(), it.value());
+                }
+
+                if(++index == shard_count || bounds[index - 1].load(std::memory_order_relaxed) > hi) {
+                    return;
+                }
+                std::unique_lock<std::mutex> next(shards[index].lock);
+                guard = std::move(next);
+            }
+        }
+
+    private:
+        // Moves the bounds so every shard holds about size() / shard count
+        // keys, keeping equal keys in one shard. Called with rebalance_lock
+        // held, takes every shard lock in key order
+        void redistribute() {
+            std::vector<std::unique_lock<std::mutex>> guards;
+            for(size_t i = 0; i < shard_count; i++) {
+                guards.emplace_back(shards[i].lock);
+            }
+
+            std::vector<std::pair<int, int>> entries;
+            entries.reserve(size());
+            for(size_t i = 0; i < shard_count; i++) {
+                for(typename Tree::iterator it = shards[i].tree.begin(); it != shards[i].tree.end(); ++it) {
+                    entries.push_back({it.key(), it.value()});
+                }
+            }
+
+            // Shard i starts at the first entry whose key is not below the
+            // key at its even share of the entries
+            std::vector<size_t> starts = {0};
+            for(size_t i = 1; i < shard_count; i++) {
+                size_t share = entries.size() * i / shard_count;
+                size_t start = starts.back();
+                if(share < entries.size()) {
+                    int bound = entries[share].first;
+                    start = std::lower_bound(entries.begin() + start, entries.end(), bound,
+                                             [](const std::pair<int, int> &entry, int key) { return entry.first < key; })
+                            - entries.begin();
+                    bounds[i - 1].store(bound, std::memory_order_relaxed);
+                } else {
+                    start = entries.size();
+                    bounds[i - 1].store(INT32_MAX, std::memory_order_relaxed);
+                }
+                starts.push_back(start);
+            }
+            starts.push_back(entries.size());
+
+            size_t largest = 0;
+            for(size_t i = 0; i < shard_count; i++) {
+                shards[i].tree.build_from_sorted(entries.data() + starts[i], entries.data() + starts[i + 1]);
+                shards[i].count.store(starts[i + 1] - starts[i], std::memory_order_relaxed);
+                largest = std::max(largest, starts[i + 1] - starts[i]);
+            }
+            bool uneven = largest * shard_count > SKEW_FACTOR * entries.size();
+            uneven_largest.store(uneven ? largest : 0, std::memory_order_relaxed);
+
+            layout_version.fetch_add(1, std::memory_order_release);
+        }
+
+    public:
+        // Evens out the shards now, whatever their sizes
+        void rebalance() {
+            std::lock_guard<std::mutex> single(rebalance_lock);
+            redistribute();
+        }
+};
+
+typedef ShardedTree<RedBlackTree> ShardedRedBlackTree;
+typedef ShardedTree<AVLTree> ShardedAVLTree;
\ No newline at end of file
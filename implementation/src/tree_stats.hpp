@@ -0,0 +1,154 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Hot-path counters for OrderedMap, chosen at compile time by its Stats
+// parameter. NoStats has empty hooks that compile away. TreeStats counts
+// with relaxed atomics, so const lookups running on several threads can
+// count too. A lookup or insert keeps its depth and comparisons in locals
+// and adds them once when it ends, not once per level.
+
+// A copy of the counters, as returned by stats(). Depth histograms count
+// the nodes on the search path, the root at depth 1, and the last bucket
+// also holds every deeper path. size is filled in whether the counters are
+// compiled in or not, height only when stats() is asked for it.
+//
+// lookups counts every descent that looks for a key: search, find,
+// contains, remove, predecessor, successor, each key of search_batch, and
+// lower_bound, upper_bound, floor and ceiling (range takes two). The
+// descents of rank, select, count_range, split, join and the set
+// operations are not counted
+struct TreeStatsSnapshot {
+    uint64_t lookups = 0;
+    uint64_t lookup_comparisons = 0;
+    uint64_t inserts = 0;
+    uint64_t insert_comparisons = 0;
+    uint64_t rotations = 0;          // single rotations, a double one counts twice
+    uint64_t insert_fixup_steps = 0; // passes of the rebalancing loops
+    uint64_t remove_fixup_steps = 0;
+    std::vector<uint64_t> lookup_depths;
+    std::vector<uint64_t> insert_depths;
+    size_t size = 0;
+    int height = 0;                  // 0 unless asked for
+};
+
+struct NoStats {
+    static constexpr bool enabled = false;
+
+    void lookup(size_t, size_t) const {}
+    void insert(size_t, size_t) {}
+    void rotation() {}
+    void insert_fixup_step() {}
+    void remove_fixup_step() {}
+    void reset() {}
+    void snapshot(TreeStatsSnapshot &) const {}
+};
+
+class TreeStats {
+    public:
+        static constexpr bool enabled = true;
+        static constexpr size_t DEPTH_BUCKETS = 64;
+
+    private:
+        typedef std::atomic<uint64_t> Counter;
+
+        // Lookups are const, so their counters are mutable
+        mutable Counter lookups;
+        mutable Counter lookup_comparisons;
+        mutable Counter lookup_depths[DEPTH_BUCKETS];
+        Counter inserts;
+        Counter insert_comparisons;
+        Counter insert_depths[DEPTH_BUCKETS];
+        Counter rotations;
+        Counter insert_fixup_steps;
+        Counter remove_fixup_steps;
+
+        static void add(Counter &counter, uint64_t amount) {
+            counter.fetch_add(amount, std::memory_order_relaxed);
+        }
+
+        static uint64_t read(const Counter &counter) {
+            return counter.load(std::memory_order_relaxed);
+        }
+
+        static size_t bucket(size_t depth) {
+            return std::min(depth, DEPTH_BUCKETS - 1);
+        }
+
+    public:
+        TreeStats() {
+            reset();
+        }
+
+        TreeStats(const TreeStats &) = delete;
+        TreeStats& operator=(const TreeStats &) = delete;
+
+        void lookup(size_t depth, size_t comparisons) const {
+            add(lookups, 1);
+            add(lookup_comparisons, comparisons);
+            add(lookup_depths[bucket(depth)], 1);
+        }
+
+        void insert(size_t depth, size_t comparisons) {
+            add(inserts, 1);
+            add(insert_comparisons, comparisons);
+            add(insert_depths[bucket(depth)], 1);
+        }
+
+        void rotation()          { add(rotations, 1); }
+        void insert_fixup_step() { add(insert_fixup_steps, 1); }
+        void remove_fixup_step() { add(remove_fixup_steps, 1); }
+
+        void reset() {
+            for(Counter *counter : {&lookups, &lookup_comparisons, &inserts, &insert_comparisons,
+                                    &rotations, &insert_fixup_steps, &remove_fixup_steps}) {
+                counter->store(0, std::memory_order_relaxed);
+            }
+            for(size_t i = 0; i < DEPTH_BUCKETS; i++) {
+                lookup_depths[i].store(0, std::memory_order_relaxed);
+                insert_depths[i].store(0, std::memory_order_relaxed);
+            }
+        }
+
+        // Counters are read one at a time, so a snapshot taken while other
+        // threads count is not consistent across counters
+        void snapshot(TreeStatsSnapshot &out) const {
+            out.lookups = read(lookups);
+            out.lookup_comparisons = read(lookup_comparisons);
+            out.inserts = read(inserts);
+            out.insert_comparisons = read(insert_comparisons);
+            out.rotations = read(rotations);
+            out.insert_fixup_steps = read(insert_fixup_steps);
+            out.remove_fixup_steps = read(remove_fixup_steps);
+
+            // Histograms stop at the deepest bucket in use
+            size_t lookup_used = 0, insert_used = 0;
+            for(size_t i = 0; i < DEPTH_BUCKETS; i++) {
+                if(read(lookup_depths[i]) != 0) {
+                    lookup_used = i + 1;
+                }
+                if(read(insert_depths[i]) != 0) {
+                    insert_used = i + 1;
+                }
+            }
+            out.lookup_depths.assign(lookup_used, 0);
+            out.insert_depths.assign(insert_used, 0);
+            for(size_t i = 0; i < lookup_used; i++) {
+                out.lookup_depths[i] = read(lookup_depths[i]);
+            }
+            for(size_t i = 0; i < insert_used; i++) {
+                out.insert_depths[i] = read(insert_depths[i]);
+            }
+        }
+};
+
+// The int trees count only when built with -DTREE_STATS (make STATS=1)
+#ifdef TREE_STATS
+typedef TreeStats IntTreeStats;
+#else
+typedef NoStats IntTreeStats;
+#endif
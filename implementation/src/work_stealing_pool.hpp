@@ -0,0 +1,230 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fork-join thread pool for divide-and-conquer work. Every worker keeps a
+// deque of tasks: it pushes and pops its own tasks at the back, so it works
+// depth-first on the newest (smallest) piece, and idle workers steal from
+// the front of other deques, which takes the oldest (largest) piece. Tasks
+// live on the stack of the invoke() that forked them and are waited for
+// before it returns, so nothing is allocated per task.
+class WorkStealingPool {
+    private:
+        struct Task {
+            void (*call)(void *context);
+            void *context;
+            std::atomic<bool> done;
+
+            Task(void (*call)(void *), void *context) : call(call), context(context), done(false) {}
+        };
+
+        struct alignas(64) Queue {
+            std::mutex lock;
+            std::deque<Task*> tasks;
+        };
+
+        size_t queue_count; // fixed before the workers start, unlike workers.size()
+        std::unique_ptr<Queue[]> queues;
+        std::vector<std::thread> workers;
+        std::atomic<size_t> queued;
+        std::atomic<bool> stopping;
+        std::atomic<size_t> sleeping; // workers waiting on idle, counted under idle_lock
+        std::mutex idle_lock;
+        std::condition_variable idle;
+
+        // The pool and queue of the worker running on this thread
+        inline static thread_local WorkStealingPool *current_pool = nullptr;
+        inline static thread_local size_t current_queue = 0;
+
+        template<class F>
+        static void call_function(void *context) {
+            (*static_cast<F*>(context))();
+        }
+
+        void push(Task *task, size_t queue) {
+            {
+                std::lock_guard<std::mutex> guard(queues[queue].lock);
+                queues[queue].tasks.push_back(task);
+            }
+            wake();
+        }
+
+        // Counts an added task and wakes a sleeping worker if there is one.
+        // A worker counts itself as sleeping before it checks queued, and
+        // this checks sleeping after adding to queued, so either the worker
+        // sees the task or this sees the worker. Taking idle_lock makes
+        // sure it is already waiting when notified
+        void wake() {
+            queued.fetch_add(1);
+            if(sleeping.load() > 0) {
+                std::lock_guard<std::mutex> guard(idle_lock);
+                idle.notify_one();
+            }
+        }
+
+        Task* pop_back(size_t queue) {
+            std::lock_guard<std::mutex> guard(queues[queue].lock);
+            if(queues[queue].tasks.empty()) {
+                return nullptr;
+            }
+            Task *task = queues[queue].tasks.back();
+            queues[queue].tasks.pop_back();
+            queued.fetch_sub(1, std::memory_order_relaxed);
+            return task;
+        }
+
+        Task* steal(size_t thief) {
+            for(size_t i = 1; i <= queue_count; i++) {
+                Queue &victim = queues[(thief + i) % queue_count];
+                std::lock_guard<std::mutex> guard(victim.lock);
+                if(!victim.tasks.empty()) {
+                    Task *task = victim.tasks.front();
+                    victim.tasks.pop_front();
+                    queued.fetch_sub(1, std::memory_order_relaxed);
+                    return task;
+                }
+            }
+            return nullptr;
+        }
+
+        Task* find_task(size_t queue) {
+            Task *task = pop_back(queue);
+            return (task != nullptr) ? task : steal(queue);
+        }
+
+        static void execute(Task *task) {
+            task->call(task->context);
+            task->done.store(true, std::memory_order_release);
+        }
+
+        void work(size_t queue) {
+            current_pool = this;
+            current_queue = queue;
+
+            while(!stopping.load(std::memory_order_acquire)) {
+                Task *task = find_task(queue);
+                if(task != nullptr) {
+                    execute(task);
+                    continue;
+                }
+
+                std::unique_lock<std::mutex> guard(idle_lock);
+                sleeping.fetch_add(1);
+                idle.wait(guard, [this]() {
+                    return queued.load() > 0 || stopping.load(std::memory_order_acquire);
+                });
+                sleeping.fetch_sub(1);
+            }
+        }
+
+        // Runs other tasks until task is done, so a worker whose task was
+        // stolen keeps busy instead of blocking
+        void wait_for(Task &task) {
+            while(!task.done.load(std::memory_order_acquire)) {
+                Task *other = find_task(current_queue);
+                if(other != nullptr) {
+                    execute(other);
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+        }
+
+    public:
+        explicit WorkStealingPool(size_t threads = std::thread::hardware_concurrency())
+            : queue_count(std::max<size_t>(threads, 1)), queues(new Queue[queue_count]), queued(0), stopping(false),
+              sleeping(0) {
+            for(size_t i = 0; i < queue_count; i++) {
+                workers.emplace_back(&WorkStealingPool::work, this, i);
+            }
+        }
+
+        ~WorkStealingPool() {
+            {
+                std::lock_guard<std::mutex> guard(idle_lock);
+                stopping.store(true, std::memory_order_release);
+            }
+            idle.notify_all();
+            for(std::thread &worker : workers) {
+                worker.join();
+            }
+        }
+
+        WorkStealingPool(const WorkStealingPool &) = delete;
+        WorkStealingPool& operator=(const WorkStealingPool &) = delete;
+
+        // Pool sized to the machine, started on first use
+        static WorkStealingPool& shared() {
+            static WorkStealingPool pool;
+            return pool;
+        }
+
+        size_t size() const {
+            return queue_count;
+        }
+
+        // Runs root on a worker and returns once it and everything it forked
+        // have finished. Called from a worker, it just runs root
+        template<class F>
+        void run(F root) {
+            if(current_pool == this) {
+                root();
+                return;
+            }
+
+            std::mutex finished_lock;
+            std::condition_variable finished;
+            bool complete = false;
+
+            auto wrapper = [&]() {
+                root();
+                std::lock_guard<std::mutex> guard(finished_lock);
+                complete = true;
+                finished.notify_one();
+            };
+
+            Task task(&call_function<decltype(wrapper)>, &wrapper);
+            push(&task, 0);
+
+            std::unique_lock<std::mutex> guard(finished_lock);
+            finished.wait(guard, [&complete]() { return complete; });
+
+            // The worker still marks task done after root returns, and task
+            // lives on this stack
+            while(!task.done.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+        }
+
+        // Runs first and second, in parallel when another worker is free to
+        // steal second. Outside the pool both run on the calling thread
+        template<class F, class G>
+        void invoke(F first, G second) {
+            if(current_pool != this) {
+                first();
+                second();
+                return;
+            }
+
+            Task task(&call_function<G>, &second);
+            push(&task, current_queue);
+            first();
+
+            // Nested invokes have taken their own tasks back, and thieves
+            // take older tasks first, so the back of this deque is either
+            // task or, if it was stolen, nothing
+            if(pop_back(current_queue) == &task) {
+                execute(&task);
+            } else {
+                wait_for(task);
+            }
+        }
+};
\ No newline at end of file
@@ -0,0 +1,132 @@
+#include <climits>
+#include <iterator>
+#include <map>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "bplus_tree.hpp"
+#include "check.hpp"
+
+// BPlusTree against std::multimap. Both put a new key after the equal ones
+// already there, and remove, search, get_predecessor and get_successor all
+// take the first entry with a key, so the two agree entry for entry. Few
+// distinct keys make runs of equal keys span several leaves, and the
+// removals that follow the inserts merge and refill leaves and inner nodes
+
+typedef std::multimap<int, int> Expected;
+typedef std::vector<std::pair<int, int>> Entries;
+
+static Entries range_of(const BPlusTree &tree, int lo, int hi) {
+    Entries entries;
+    tree.range(lo, hi, [&](int key, int data) { entries.push_back({key, data}); });
+    return entries;
+}
+
+static void check_tree(BPlusTree &tree, const Expected &expected, int key_limit) {
+    CHECK(tree.entries() == Entries(expected.begin(), expected.end()));
+    CHECK(range_of(tree, INT_MIN, INT_MAX) == Entries(expected.begin(), expected.end()));
+    CHECK(tree.get_min() == (expected.empty() ? -1 : expected.begin()->second));
+    CHECK(tree.get_max() == (expected.empty() ? -1 : expected.rbegin()->second));
+    for(int key = -2; key < key_limit + 2; key++) {
+        Expected::const_iterator it = expected.find(key);
+        CHECK(tree.search(key) == ((it != expected.end()) ? it->second : -1));
+        if(it != expected.end()) {
+            Expected::const_iterator next = std::next(it);
+            CHECK(tree.get_predecessor(key) == ((it != expected.begin()) ? std::prev(it)->second : -1));
+            CHECK(tree.get_successor(key) == ((next != expected.end()) ? next->second : -1));
+        }
+    }
+}
+
+// Inserts grow the tree through leaf and inner splits, then removals
+// shrink it back to empty
+void grow_and_shrink(unsigned seed, int key_limit) {
+    std::mt19937 random(seed);
+    BPlusTree tree;
+    Expected expected;
+
+    for(int i = 0; i < 20000; i++) {
+        int key = random() % key_limit;
+        tree.insert(key, i);
+        expected.insert({key, i});
+        if(i % 5000 == 0) {
+            check_tree(tree, expected, key_limit);
+        }
+    }
+    check_tree(tree, expected, key_limit);
+
+    for(int i = 0; i < 200; i++) {
+        int lo = random() % key_limit;
+        int hi = lo + random() % (key_limit / 4 + 1);
+        CHECK(range_of(tree, lo, hi) == Entries(expected.lower_bound(lo), expected.upper_bound(hi)));
+    }
+    CHECK(range_of(tree, 1, 0).empty());
+
+    // Mixed inserts and removals, including keys that are not there
+    for(int i = 0; i < 40000; i++) {
+        int key = random() % (key_limit + 2);
+        if(random() % 3 == 0) {
+            tree.insert(key, -i);
+            expected.insert({key, -i});
+        } else {
+            tree.remove(key);
+            Expected::iterator it = expected.find(key);
+            if(it != expected.end()) {
+                expected.erase(it);
+            }
+        }
+        if(i % 10000 == 0) {
+            check_tree(tree, expected, key_limit);
+        }
+    }
+    check_tree(tree, expected, key_limit);
+
+    while(!expected.empty()) {
+        int key = expected.begin()->first + random() % 2;
+        tree.remove(key);
+        Expected::iterator it = expected.find(key);
+        if(it != expected.end()) {
+            expected.erase(it);
+        }
+    }
+    check_tree(tree, expected, key_limit);
+}
+
+// A packed tree built from sorted input takes ordinary inserts and
+// removals afterwards
+void build_then_update() {
+    std::vector<std::pair<int, int>> sorted;
+    Expected expected;
+    for(int i = 0; i < 5000; i++) {
+        sorted.push_back({i / 3, i});
+        expected.insert({i / 3, i});
+    }
+    BPlusTree tree;
+    tree.build_from_sorted(sorted.data(), sorted.data() + sorted.size());
+    check_tree(tree, expected, 5000 / 3);
+
+    std::mt19937 random(73);
+    for(int i = 0; i < 5000; i++) {
+        int key = random() % (5000 / 3);
+        if(i % 2 == 0) {
+            tree.insert(key, i);
+            expected.insert({key, i});
+        } else {
+            tree.remove(key);
+            Expected::iterator it = expected.find(key);
+            if(it != expected.end()) {
+                expected.erase(it);
+            }
+        }
+    }
+    check_tree(tree, expected, 5000 / 3);
+}
+
+int main() {
+    grow_and_shrink(71, 8);
+    grow_and_shrink(72, 300);
+    grow_and_shrink(74, 100000);
+    build_then_update();
+    return test_result("bplus_tree_test");
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <iterator>
+#include <map>
+#include <random>
+#include <thread>
+#include <vector>
+
+// Checks for the test programs under tests/. A failed CHECK prints the
+// condition and carries on, and main returns test_result() so make test
+// stops at the first program with a failure.
+
+static int check_failures = 0;
+
+#define CHECK(condition)                                                                     \
+    do {                                                                                     \
+        if(!(condition)) {                                                                   \
+            std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            check_failures++;                                                                \
+        }                                                                                    \
+    } while(0)
+
+inline int test_result(const char *name) {
+    if(check_failures == 0) {
+        std::printf("%s: ok\n", name);
+        return 0;
+    }
+    std::printf("%s: %d checks failed\n", name, check_failures);
+    return 1;
+}
+
+// Height a balanced tree of size entries may reach: 2 log2(n + 1) for a
+// red-black tree, which also covers AVL's 1.44 log2(n + 2)
+inline bool height_is_balanced(int height, size_t size) {
+    return height <= 2.0 * std::log2((double)size + 1) + 1e-9;
+}
+
+// The int interface of tree against expected for every key in
+// [-5, key_limit + 5): size, min, max, search, and the neighbours of each
+// key in the tree. Missing keys and empty trees answer -1
+template<class Tree>
+void check_against(Tree &&tree, const std::map<int, int> &expected, int key_limit) {
+    CHECK(tree.size() == expected.size());
+    CHECK(tree.get_min() == (expected.empty() ? -1 : expected.begin()->second));
+    CHECK(tree.get_max() == (expected.empty() ? -1 : expected.rbegin()->second));
+    for(int key = -5; key < key_limit + 5; key++) {
+        std::map<int, int>::const_iterator it = expected.find(key);
+        CHECK(tree.search(key) == ((it != expected.end()) ? it->second : -1));
+        if(it != expected.end()) {
+            std::map<int, int>::const_iterator next = std::next(it);
+            CHECK(tree.get_predecessor(key) == ((it != expected.begin()) ? std::prev(it)->second : -1));
+            CHECK(tree.get_successor(key) == ((next != expected.end()) ? next->second : -1));
+        }
+    }
+}
+
+// The same with equal keys, where every entry's value is its key. Which of
+// the equal entries search lands on is up to the tree, so a neighbour may
+// be another entry with the same key or the next key over
+template<class Tree>
+void check_against(Tree &&tree, const std::multimap<int, int> &expected, int key_limit) {
+    CHECK(tree.size() == expected.size());
+    CHECK(tree.get_min() == (expected.empty() ? -1 : expected.begin()->first));
+    CHECK(tree.get_max() == (expected.empty() ? -1 : expected.rbegin()->first));
+    for(int key = -5; key < key_limit + 5; key++) {
+        std::multimap<int, int>::const_iterator first = expected.lower_bound(key);
+        std::multimap<int, int>::const_iterator last = expected.upper_bound(key);
+        CHECK(tree.search(key) == ((first != last) ? key : -1));
+        if(first != last) {
+            int below = (first != expected.begin()) ? std::prev(first)->first : -1;
+            int above = (last != expected.end()) ? last->first : -1;
+            bool equal_run = std::next(first) != last;
+            int predecessor = tree.get_predecessor(key);
+            int successor = tree.get_successor(key);
+            CHECK(predecessor == below || (equal_run && predecessor == key));
+            CHECK(successor == above || (equal_run && successor == key));
+        }
+    }
+}
+
+// Multiples of STRIDE up to keys stay in the tree while a writer toggles
+// the keys between them, each mapped to itself, so every moment has the
+// multiples and at most every key. reader_count threads call
+// read(random) until the writer is done, each call returning how many
+// wrong answers it saw
+static const int STRIDE = 8;
+
+template<class Tree, class Read>
+void readers_during_writes(Tree &tree, int keys, int rounds, int reader_count, unsigned seed, Read read) {
+    for(int key = 0; key <= keys; key += STRIDE) {
+        tree.insert(key, key);
+    }
+
+    std::atomic<bool> done(false);
+    std::atomic<long> failures(0);
+    std::atomic<long> reads(0);
+
+    std::thread writer([&]() {
+        std::mt19937 random(seed);
+        std::vector<bool> present(keys, false);
+        for(int round = 0; round < rounds; round++) {
+            int key = random() % keys;
+            if(key % STRIDE == 0) {
+                continue;
+            }
+            if(present[key]) {
+                tree.remove(key);
+            } else {
+                tree.insert(key, key);
+            }
+            present[key] = !present[key];
+        }
+        done.store(true);
+    });
+
+    std::vector<std::thread> readers;
+    for(int t = 0; t < reader_count; t++) {
+        readers.emplace_back([&, t]() {
+            std::mt19937 random(seed + 1 + t);
+            long bad = 0, count = 0;
+            while(!done.load(std::memory_order_relaxed)) {
+                bad += read(random);
+                count++;
+            }
+            failures += bad;
+            reads += count;
+        });
+    }
+
+    writer.join();
+    for(std::thread &reader : readers) {
+        reader.join();
+    }
+    CHECK(failures.load() == 0);
+    CHECK(reads.load() > 0);
+}
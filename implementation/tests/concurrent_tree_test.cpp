@@ -0,0 +1,56 @@
+#include <map>
+#include <random>
+
+#include "check.hpp"
+#include "concurrent_red_black_tree.hpp"
+
+// ConcurrentRedBlackTree against std::map with one thread, then readers
+// checking answers that hold at every moment while a writer keeps
+// inserting and removing around them
+
+void single_thread() {
+    std::mt19937 random(41);
+    ConcurrentRedBlackTree tree;
+    std::map<int, int> expected;
+    for(int i = 0; i < 50000; i++) {
+        int key = random() % 20000;
+        if(random() % 3 == 0) {
+            tree.remove(key);
+            expected.erase(key);
+        } else if(expected.count(key) == 0) {
+            tree.insert(key, i);
+            expected[key] = i;
+        }
+    }
+
+    check_against(tree, expected, 20000);
+}
+
+// Every key maps to itself, so each read checks answers that hold at
+// every moment of the writes
+static const int KEYS = 1 << 14;
+
+void readers_during_writes() {
+    ConcurrentRedBlackTree tree;
+    readers_during_writes(tree, KEYS, 400000, 3, 42, [&tree](std::mt19937 &random) {
+        int key = (random() % (KEYS / STRIDE)) * STRIDE + STRIDE;
+        int found = tree.search(key);
+        int below = tree.get_predecessor(key);
+        int above = tree.get_successor(key - STRIDE);
+        int other = tree.search(KEYS + 1 + (int)(random() % 100));
+        long bad = 0;
+        bad += found != key;
+        bad += below < key - STRIDE || below >= key;
+        bad += above <= key - STRIDE || above > key;
+        bad += other != -1;
+        bad += tree.get_min() != 0;
+        bad += tree.get_max() != KEYS;
+        return bad;
+    });
+}
+
+int main() {
+    single_thread();
+    readers_during_writes();
+    return test_result("concurrent_tree_test");
+}
@@ -0,0 +1,232 @@
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "check.hpp"
+#include "frozen_index.hpp"
+
+// FrozenIndex against std::lower_bound with every kernel the CPU has, at
+// sizes around block and level boundaries, then saved images: a round trip
+// through save and open, and truncated, bit-flipped and foreign files that
+// open has to turn down
+
+static const size_t HEADER_BYTES = 64;
+
+static std::string directory;
+
+typedef std::vector<std::pair<int, int>> Entries;
+
+static const SearchKernel KERNELS[] = {SearchKernel::scalar, SearchKernel::sse42, SearchKernel::avx2};
+
+off_t file_size(const std::string &file) {
+    struct stat status;
+    return (stat(file.c_str(), &status) == 0) ? status.st_size : -1;
+}
+
+void flip_byte(const std::string &file, off_t offset) {
+    int fd = open(file.c_str(), O_RDWR);
+    unsigned char byte = 0;
+    CHECK(fd >= 0 && pread(fd, &byte, 1, offset) == 1);
+    byte ^= 0x5A;
+    CHECK(pwrite(fd, &byte, 1, offset) == 1);
+    close(fd);
+}
+
+// Even keys with gaps between them, and INT_MAX last when with_max is set
+// so the largest key equals the padding
+Entries make_entries(size_t count, bool with_max) {
+    Entries entries;
+    for(size_t i = 0; i < count; i++) {
+        entries.push_back({(int)(2 * i) - 100, (int)i});
+    }
+    if(with_max && count > 0) {
+        entries.back().first = INT_MAX;
+    }
+    return entries;
+}
+
+// The index answers for entries: range(probe, hi) starts at the lower
+// bound of probe, so with hi set to that bound exactly one entry comes back
+void check_index(const FrozenIndex &index, const Entries &entries, const std::vector<int> &probes) {
+    CHECK(index.size() == entries.size());
+    for(int probe : probes) {
+        Entries::const_iterator it = std::lower_bound(entries.begin(), entries.end(), std::make_pair(probe, INT_MIN));
+        Entries found;
+        int hi = (it != entries.end()) ? it->first : INT_MAX;
+        index.range(probe, hi, [&](int key, int value) { found.push_back({key, value}); });
+        CHECK(found == ((it != entries.end()) ? Entries(1, *it) : Entries()));
+
+        bool present = it != entries.end() && it->first == probe;
+        CHECK(index.search(probe) == (present ? it->second : -1));
+        if(present) {
+            CHECK(index.get_predecessor(probe) == ((it != entries.begin()) ? (it - 1)->second : -1));
+            CHECK(index.get_successor(probe) == ((it + 1 != entries.end()) ? (it + 1)->second : -1));
+        }
+    }
+}
+
+std::vector<int> probes_for(const Entries &entries, std::mt19937 &random) {
+    std::vector<int> probes = {INT_MIN, -101, -100, -99, INT_MAX - 1, INT_MAX};
+    for(const std::pair<int, int> &entry : entries) {
+        probes.push_back(entry.first);
+        probes.push_back(entry.first + 1);
+    }
+    for(int i = 0; i < 200; i++) {
+        probes.push_back((int)(random() % (2 * entries.size() + 200)) - 150);
+    }
+    return probes;
+}
+
+void kernels_match_lower_bound() {
+    std::mt19937 random(81);
+    const size_t BLOCK = FrozenIndex::BLOCK_KEYS;
+    const size_t FANOUT = FrozenIndex::FANOUT;
+    std::vector<size_t> sizes = {0, 1, 2};
+    for(size_t boundary : {BLOCK, BLOCK * FANOUT, BLOCK * FANOUT * FANOUT}) {
+        sizes.push_back(boundary - 1);
+        sizes.push_back(boundary);
+        sizes.push_back(boundary + 1);
+    }
+    sizes.push_back(100000);
+
+    for(size_t count : sizes) {
+        for(bool with_max : {false, true}) {
+            Entries entries = make_entries(count, with_max);
+            std::vector<int> probes = probes_for(entries, random);
+            FrozenIndex index(entries.data(), entries.data() + entries.size());
+            for(SearchKernel kernel : KERNELS) {
+                if(!index.set_kernel(kernel)) {
+                    CHECK(!FrozenIndex::kernel_supported(kernel));
+                    continue;
+                }
+                CHECK(index.get_kernel() == kernel);
+                check_index(index, entries, probes);
+            }
+        }
+    }
+}
+
+void round_trip() {
+    std::mt19937 random(82);
+    std::string path = directory + "/round_trip.index";
+    Entries entries = make_entries(5000, false);
+    std::vector<int> probes = probes_for(entries, random);
+
+    FrozenIndex built(entries.data(), entries.data() + entries.size());
+    CHECK(built.save(path));
+    CHECK(file_size(path + ".tmp") == -1);
+
+    for(bool verify_data : {false, true}) {
+        FrozenIndex opened;
+        CHECK(opened.open(path, verify_data));
+        CHECK(opened.is_mapped());
+        for(SearchKernel kernel : KERNELS) {
+            if(opened.set_kernel(kernel)) {
+                check_index(opened, entries, probes);
+            }
+        }
+    }
+
+    // Saving over a file another index has mapped leaves that index
+    // reading the old image
+    FrozenIndex old_image;
+    CHECK(old_image.open(path));
+    Entries other = make_entries(300, true);
+    FrozenIndex replacement(other.data(), other.data() + other.size());
+    CHECK(replacement.save(path));
+    check_index(old_image, entries, probes);
+
+    FrozenIndex reopened;
+    CHECK(reopened.open(path, true));
+    check_index(reopened, other, probes_for(other, random));
+
+    FrozenIndex empty;
+    CHECK(empty.save(path));
+    CHECK(reopened.open(path, true));
+    check_index(reopened, Entries(), probes);
+    CHECK(!built.save(directory + "/missing/round_trip.index"));
+}
+
+// open fails on path and leaves the index it was called on as it was
+void check_rejected(const std::string &path, bool verify_data) {
+    Entries entries = make_entries(20, false);
+    FrozenIndex index(entries.data(), entries.data() + entries.size());
+    CHECK(!index.open(path, verify_data));
+    CHECK(!index.is_mapped());
+    CHECK(index.size() == entries.size());
+    CHECK(index.search(entries[7].first) == entries[7].second);
+}
+
+void damaged_images() {
+    std::string path = directory + "/damaged.index";
+    Entries entries = make_entries(3000, false);
+    FrozenIndex built(entries.data(), entries.data() + entries.size());
+    off_t bytes = 0;
+
+    // Truncated: shorter than the header, or missing the tail of the values
+    for(off_t keep : {(off_t)0, (off_t)HEADER_BYTES - 1, (off_t)HEADER_BYTES, (off_t)-4}) {
+        CHECK(built.save(path));
+        bytes = file_size(path);
+        CHECK(truncate(path.c_str(), (keep < 0) ? bytes + keep : keep) == 0);
+        check_rejected(path, false);
+        check_rejected(path, true);
+    }
+
+    // A byte too many
+    CHECK(built.save(path));
+    int fd = open(path.c_str(), O_WRONLY | O_APPEND);
+    CHECK(fd >= 0 && write(fd, "x", 1) == 1);
+    close(fd);
+    check_rejected(path, false);
+    check_rejected(path, true);
+
+    // Wrong magic, and a flipped bit in each header field
+    for(off_t offset : {(off_t)0, (off_t)7, (off_t)8, (off_t)12, (off_t)16, (off_t)20, (off_t)24, (off_t)32, (off_t)40, (off_t)48}) {
+        CHECK(built.save(path));
+        flip_byte(path, offset);
+        check_rejected(path, false);
+        check_rejected(path, true);
+    }
+
+    // A flipped bit in the keys or values is only caught by the checksum
+    for(off_t offset : {(off_t)HEADER_BYTES, (off_t)HEADER_BYTES + 1000, bytes - 1}) {
+        CHECK(built.save(path));
+        flip_byte(path, offset);
+        check_rejected(path, true);
+        FrozenIndex unchecked;
+        CHECK(unchecked.open(path, false));
+        CHECK(unchecked.size() == entries.size());
+    }
+
+    // A missing file
+    unlink(path.c_str());
+    check_rejected(path, false);
+}
+
+int main() {
+    char name[] = "/tmp/frozen_index_test.XXXXXX";
+    if(mkdtemp(name) == nullptr) {
+        std::perror("mkdtemp");
+        return 1;
+    }
+    directory = name;
+
+    kernels_match_lower_bound();
+    round_trip();
+    damaged_images();
+
+    std::string command = "rm -rf " + directory;
+    if(std::system(command.c_str()) != 0) {
+        std::fprintf(stderr, "could not remove %s\n", name);
+    }
+    return test_result("frozen_index_test");
+}
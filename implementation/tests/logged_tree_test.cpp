@@ -0,0 +1,376 @@
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "check.hpp"
+#include "logged_tree.hpp"
+
+// Recovery of LoggedTree against a std::multimap of what was committed:
+// clean reopens, checkpoints, torn tails that are cut off, and damaged logs
+// and checkpoints that fail the open. Then what writes report: removes of
+// missing keys that log nothing, and a full disk under SyncPolicy::always
+
+static const size_t HEADER_BYTES = 40;
+static const size_t RECORD_BYTES = 16;
+
+static std::string directory;
+
+typedef std::vector<std::pair<int, int>> Entries;
+
+Entries entries_of(const std::multimap<int, int> &map) {
+    return Entries(map.begin(), map.end());
+}
+
+std::string fresh_path(const char *name) {
+    std::string path = directory + "/" + name;
+    unlink((path + ".log").c_str());
+    unlink((path + ".checkpoint").c_str());
+    return path;
+}
+
+off_t file_size(const std::string &file) {
+    struct stat status;
+    return (stat(file.c_str(), &status) == 0) ? status.st_size : -1;
+}
+
+void write_at(const std::string &file, off_t offset, const void *data, size_t bytes) {
+    int fd = open(file.c_str(), O_WRONLY);
+    CHECK(fd >= 0 && pwrite(fd, data, bytes, offset) == (ssize_t)bytes);
+    close(fd);
+}
+
+void flip_byte(const std::string &file, off_t offset) {
+    int fd = open(file.c_str(), O_RDWR);
+    unsigned char byte = 0;
+    CHECK(fd >= 0 && pread(fd, &byte, 1, offset) == 1);
+    byte ^= 0x5A;
+    CHECK(pwrite(fd, &byte, 1, offset) == 1);
+    close(fd);
+}
+
+// Logs count inserts of distinct keys with group_records per write, commits
+// and closes, and returns what was logged
+std::multimap<int, int> write_log(const std::string &path, int count, size_t group_records) {
+    std::multimap<int, int> expected;
+    LoggedRedBlackTree tree;
+    CHECK(tree.open(path, SyncPolicy::group, group_records));
+    for(int i = 0; i < count; i++) {
+        int key = (i * 7919) % 100003;
+        tree.insert(key, i);
+        expected.insert({key, i});
+    }
+    CHECK(tree.commit());
+    return expected;
+}
+
+void clean_reopen() {
+    std::string path = fresh_path("clean");
+    std::multimap<int, int> expected;
+    {
+        LoggedRedBlackTree tree;
+        CHECK(tree.open(path, SyncPolicy::group, 64));
+        for(int i = 0; i < 5000; i++) {
+            tree.insert(i % 1000, i);
+            expected.insert({i % 1000, i});
+            if(i % 3 == 0) {
+                tree.remove(i % 500);
+                expected.erase(expected.find(i % 500));
+            }
+        }
+    }
+
+    // Removes may take another entry with the same key, so keys are compared
+    LoggedRedBlackTree tree;
+    CHECK(tree.open(path));
+    std::vector<int> keys, expected_keys;
+    for(const std::pair<int, int> &entry : tree.entries()) {
+        keys.push_back(entry.first);
+    }
+    for(const std::pair<const int, int> &entry : expected) {
+        expected_keys.push_back(entry.first);
+    }
+    CHECK(keys == expected_keys);
+    CHECK(tree.log_records() == 5000 + 5000 / 3 + 1);
+}
+
+void torn_tail() {
+    // A partial record at the end is cut off
+    std::string path = fresh_path("partial");
+    std::multimap<int, int> expected = write_log(path, 1000, 64);
+    std::string log = path + ".log";
+    off_t size = file_size(log);
+    char garbage[7] = {1, 2, 3, 4, 5, 6, 7};
+    write_at(log, size, garbage, sizeof(garbage));
+    {
+        LoggedRedBlackTree tree;
+        CHECK(tree.open(path));
+        CHECK(tree.entries() == entries_of(expected));
+    }
+    CHECK(file_size(log) == size);
+
+    // So is a last record that fails its check
+    flip_byte(log, size - 3);
+    expected.erase(expected.find(((999 * 7919) % 100003)));
+    {
+        LoggedRedBlackTree tree;
+        CHECK(tree.open(path));
+        CHECK(tree.entries() == entries_of(expected));
+    }
+    CHECK(file_size(log) == size - (off_t)RECORD_BYTES);
+
+    // And a last group the crash left as zeros
+    std::vector<char> zeros(RECORD_BYTES * 64, 0);
+    write_at(log, file_size(log), zeros.data(), zeros.size());
+    {
+        LoggedRedBlackTree tree;
+        CHECK(tree.open(path, SyncPolicy::group, 64));
+        CHECK(tree.entries() == entries_of(expected));
+        tree.insert(-1, -1);
+        expected.insert({-1, -1});
+    }
+    LoggedRedBlackTree tree;
+    CHECK(tree.open(path));
+    CHECK(tree.entries() == entries_of(expected));
+}
+
+void damaged_log() {
+    // A bad record with whole ones after it loses committed records if cut
+    // off there, so the open fails
+    std::string path = fresh_path("middle");
+    write_log(path, 1000, 64);
+    flip_byte(path + ".log", HEADER_BYTES + 500 * RECORD_BYTES + 4);
+    {
+        LoggedRedBlackTree tree;
+        CHECK(!tree.open(path));
+    }
+
+    // More bad records at the end than one write holds
+    path = fresh_path("long_tail");
+    write_log(path, 1000, 16);
+    std::vector<char> zeros(RECORD_BYTES * 17, 0);
+    write_at(path + ".log", file_size(path + ".log"), zeros.data(), zeros.size());
+    {
+        LoggedRedBlackTree tree;
+        CHECK(!tree.open(path));
+    }
+
+    // A damaged header
+    path = fresh_path("log_header");
+    write_log(path, 10, 16);
+    flip_byte(path + ".log", 16);
+    LoggedRedBlackTree tree;
+    CHECK(!tree.open(path));
+}
+
+void checkpoints() {
+    std::string path = fresh_path("checkpoint");
+    std::multimap<int, int> expected;
+    std::vector<char> stale_log;
+    {
+        LoggedRedBlackTree tree;
+        CHECK(tree.open(path, SyncPolicy::group, 64, 1000));
+        for(int i = 0; i < 3000; i++) {
+            tree.insert(i % 777, i);
+            expected.insert({i % 777, i});
+        }
+        // Inserts never checkpoint on their own
+        CHECK(tree.checkpoint_due());
+        CHECK(tree.log_records() == 3000);
+        CHECK(file_size(path + ".checkpoint") < 0);
+
+        CHECK(tree.checkpoint());
+        CHECK(!tree.checkpoint_due());
+        CHECK(tree.log_records() == 0);
+        CHECK(file_size(path + ".log") == (off_t)HEADER_BYTES);
+        for(int i = 0; i < 100; i++) {
+            tree.insert(-i, i);
+            expected.insert({-i, i});
+        }
+    }
+    {
+        LoggedRedBlackTree tree;
+        CHECK(tree.open(path));
+        CHECK(tree.entries() == entries_of(expected));
+        CHECK(tree.log_records() == 100);
+    }
+
+    // A log from before the last checkpoint, as a crash between writing the
+    // checkpoint and resetting the log leaves it, is already in the checkpoint
+    std::string stale = fresh_path("stale");
+    write_log(stale, 500, 64);
+    std::multimap<int, int> checkpointed;
+    {
+        LoggedRedBlackTree tree;
+        CHECK(tree.open(stale));
+        CHECK(tree.checkpoint());
+        for(const std::pair<int, int> &entry : tree.entries()) {
+            checkpointed.insert(entry);
+        }
+    }
+    CHECK(rename((stale + ".checkpoint").c_str(), (stale + ".keep").c_str()) == 0);
+    write_log(fresh_path("stale"), 500, 64);
+    CHECK(rename((stale + ".keep").c_str(), (stale + ".checkpoint").c_str()) == 0);
+    {
+        LoggedRedBlackTree tree;
+        CHECK(tree.open(stale));
+        CHECK(tree.entries() == entries_of(checkpointed));
+        CHECK(tree.log_records() == 0);
+    }
+}
+
+void damaged_checkpoint() {
+    std::string path = fresh_path("bad_checkpoint");
+    write_log(path, 2000, 64);
+    {
+        LoggedRedBlackTree tree;
+        CHECK(tree.open(path));
+        CHECK(tree.checkpoint());
+    }
+    std::string checkpoint = path + ".checkpoint";
+    std::string saved = directory + "/saved.checkpoint";
+    CHECK(rename(checkpoint.c_str(), saved.c_str()) == 0);
+
+    auto restore = [&]() {
+        std::FILE *from = std::fopen(saved.c_str(), "rb");
+        std::FILE *to = std::fopen(checkpoint.c_str(), "wb");
+        int c;
+        while((c = std::fgetc(from)) != EOF) {
+            std::fputc(c, to);
+        }
+        std::fclose(from);
+        std::fclose(to);
+    };
+
+    // A huge count fails the open without trying to allocate for it
+    restore();
+    uint64_t count = (uint64_t)1 << 60;
+    write_at(checkpoint, 24, &count, sizeof(count));
+    {
+        LoggedRedBlackTree tree;
+        CHECK(!tree.open(path));
+    }
+
+    // A changed entry, a changed generation, a cut-off file
+    restore();
+    flip_byte(checkpoint, HEADER_BYTES + 100);
+    {
+        LoggedRedBlackTree tree;
+        CHECK(!tree.open(path));
+    }
+    restore();
+    flip_byte(checkpoint, 16);
+    {
+        LoggedRedBlackTree tree;
+        CHECK(!tree.open(path));
+    }
+    restore();
+    CHECK(truncate(checkpoint.c_str(), file_size(checkpoint) - 8) == 0);
+    {
+        LoggedRedBlackTree tree;
+        CHECK(!tree.open(path));
+    }
+
+    restore();
+    LoggedRedBlackTree tree;
+    CHECK(tree.open(path));
+    CHECK(tree.entries().size() == 2000);
+}
+
+// Removing a key that is not in the tree writes no record
+template<class Logged>
+void missing_removes(const char *name) {
+    std::string path = fresh_path(name);
+    std::string log = path + ".log";
+    Logged tree;
+    CHECK(tree.open(path, SyncPolicy::always));
+    for(int key = 0; key < 10; key++) {
+        CHECK(tree.insert(key, key));
+    }
+    off_t size = file_size(log);
+    size_t records = tree.log_records();
+
+    for(int key = 10; key < 100; key++) {
+        CHECK(tree.remove(key));
+    }
+    CHECK(file_size(log) == size);
+    CHECK(tree.log_records() == records);
+
+    CHECK(tree.remove(5));
+    CHECK(file_size(log) == size + (off_t)RECORD_BYTES);
+    CHECK(tree.log_records() == records + 1);
+    CHECK(tree.search(5) == -1);
+}
+
+// A write that fails makes that insert return false, and every write after
+// it, so the caller learns of the failure at once. The file size limit
+// stands in for a full disk
+void failed_writes() {
+    std::string path = fresh_path("full");
+    std::multimap<int, int> expected;
+    LoggedRedBlackTree tree;
+    CHECK(tree.open(path, SyncPolicy::always));
+    for(int key = 0; key < 10; key++) {
+        CHECK(tree.insert(key, key));
+        expected.insert({key, key});
+    }
+
+    struct rlimit limit, old_limit;
+    CHECK(getrlimit(RLIMIT_FSIZE, &old_limit) == 0);
+    limit = old_limit;
+    limit.rlim_cur = file_size(path + ".log") + 2 * RECORD_BYTES;
+    signal(SIGXFSZ, SIG_IGN);
+    CHECK(setrlimit(RLIMIT_FSIZE, &limit) == 0);
+
+    CHECK(tree.insert(10, 10));
+    CHECK(tree.insert(11, 11));
+    expected.insert({10, 10});
+    expected.insert({11, 11});
+    CHECK(!tree.insert(12, 12));
+    CHECK(!tree.insert(13, 13));
+    CHECK(!tree.remove(0));
+    CHECK(!tree.remove(100));
+    CHECK(!tree.commit());
+    CHECK(!tree.checkpoint());
+
+    CHECK(setrlimit(RLIMIT_FSIZE, &old_limit) == 0);
+    signal(SIGXFSZ, SIG_DFL);
+
+    // Only what was reported as logged comes back
+    LoggedRedBlackTree reopened;
+    CHECK(reopened.open(path));
+    CHECK(reopened.entries() == entries_of(expected));
+}
+
+int main() {
+    char name[] = "/tmp/logged_tree_test.XXXXXX";
+    if(mkdtemp(name) == nullptr) {
+        std::perror("mkdtemp");
+        return 1;
+    }
+    directory = name;
+
+    clean_reopen();
+    torn_tail();
+    damaged_log();
+    checkpoints();
+    damaged_checkpoint();
+    missing_removes<LoggedRedBlackTree>("missing_rb");
+    missing_removes<LoggedBinarySearchTree>("missing_bst");
+    missing_removes<LoggedBPlusTree>("missing_bplus");
+    failed_writes();
+
+    std::string command = "rm -rf " + directory;
+    if(std::system(command.c_str()) != 0) {
+        std::fprintf(stderr, "could not remove %s\n", name);
+    }
+    return test_result("logged_tree_test");
+}
@@ -0,0 +1,480 @@
+#include <algorithm>
+#include <cstdlib>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "check.hpp"
+#include "ordered_map.hpp"
+
+// OrderedMap under each balance policy and node layout against
+// std::multimap: balance after inserts and removes, build_from_sorted's
+// shape and its fallback, search_batch, iteration both ways, range and the
+// bound queries, with equal keys throughout. Then the generic side:
+// move-only values, std::string keys found by std::string_view, and
+// emplace's reference outliving later inserts
+
+typedef std::vector<std::pair<int, int>> Entries;
+typedef std::multimap<int, int> Expected;
+
+template<class Map>
+Entries entries_of(const Map &map) {
+    Entries entries;
+    for(typename Map::const_iterator it = map.begin(); it != map.end(); ++it) {
+        entries.push_back({it.key(), it.value()});
+    }
+    return entries;
+}
+
+// Height of the subtree under node, -1 when it breaks the AVL rule that
+// the heights of a node's two subtrees differ by at most one
+template<class Map>
+int avl_height(const Map &map, typename Map::NodeRef node) {
+    if(node == Map::nil) {
+        return 0;
+    }
+    int left = avl_height(map, map.node_storage().left(node));
+    int right = avl_height(map, map.node_storage().right(node));
+    if(left < 0 || right < 0 || std::abs(left - right) > 1) {
+        return -1;
+    }
+    return std::max(left, right) + 1;
+}
+
+// The shape each policy promises: none for NoBalance, the red-black height
+// bound, and the AVL rule at every node
+template<class Map, class Policy>
+struct Shape {
+    static bool check(const Map &map) { return height_is_balanced(map.height(), map.size()); }
+};
+
+template<class Map>
+struct Shape<Map, NoBalance> {
+    static bool check(const Map &) { return true; }
+};
+
+template<class Map>
+struct Shape<Map, AVLBalance> {
+    static bool check(const Map &map) { return avl_height(map, map.root_node()) == map.height(); }
+};
+
+// remove() takes any one of the entries with its key, so after removes
+// only the keys are compared
+template<class Map>
+void check_keys(const Map &map, const Expected &expected) {
+    std::vector<int> keys, expected_keys;
+    for(typename Map::const_iterator it = map.begin(); it != map.end(); ++it) {
+        keys.push_back(it.key());
+    }
+    for(const std::pair<const int, int> &entry : expected) {
+        expected_keys.push_back(entry.first);
+    }
+    CHECK(map.size() == expected.size());
+    CHECK(keys == expected_keys);
+}
+
+template<class Map, class Policy>
+void inserts_and_removes(unsigned seed) {
+    typedef Shape<Map, Policy> MapShape;
+    std::mt19937 random(seed);
+    Map map;
+    Expected expected;
+
+    // Ascending runs are the worst case for an unbalanced tree, so they
+    // stay short enough for NoBalance
+    for(int i = 0; i < 3000; i++) {
+        map.insert(i, i);
+        expected.insert({i, i});
+    }
+    CHECK(MapShape::check(map));
+
+    for(int i = 0; i < 30000; i++) {
+        int key = random() % 2000;
+        if(random() % 3 == 0) {
+            CHECK(map.remove(key) == (expected.count(key) > 0));
+            Expected::iterator it = expected.find(key);
+            if(it != expected.end()) {
+                expected.erase(it);
+            }
+        } else {
+            map.insert(key, i);
+            expected.insert({key, i});
+        }
+        if(i % 5000 == 0) {
+            CHECK(MapShape::check(map));
+            check_keys(map, expected);
+        }
+    }
+    CHECK(MapShape::check(map));
+    check_keys(map, expected);
+
+    while(!expected.empty()) {
+        int key = expected.begin()->first;
+        CHECK(map.remove(key));
+        expected.erase(expected.begin());
+        if(expected.size() % 1000 == 0) {
+            CHECK(MapShape::check(map));
+        }
+    }
+    CHECK(map.empty());
+    CHECK(map.height() == 0);
+    CHECK(!map.remove(0));
+}
+
+// Sorted input becomes a perfectly balanced tree, whose shape the policy
+// keeps up through later updates; unsorted input is inserted one by one
+template<class Map, class Policy>
+void build_from_sorted(unsigned seed) {
+    typedef Shape<Map, Policy> MapShape;
+    std::mt19937 random(seed);
+    for(size_t count : {0, 1, 2, 3, 7, 8, 1000, 4095, 4096}) {
+        Entries sorted;
+        for(size_t i = 0; i < count; i++) {
+            sorted.push_back({(int)(i / 3), (int)i});
+        }
+
+        Map map;
+        map.build_from_sorted(sorted.begin(), sorted.end());
+        int perfect = 0;
+        while((count >> perfect) != 0) {
+            perfect++;
+        }
+        CHECK(map.size() == count);
+        CHECK(map.height() == perfect);
+        CHECK(entries_of(map) == sorted);
+        CHECK(MapShape::check(map));
+
+        Expected expected(sorted.begin(), sorted.end());
+        for(int i = 0; i < 2000; i++) {
+            int key = random() % (count / 3 + 2);
+            if(i % 2 == 0) {
+                map.insert(key, -i);
+                expected.insert({key, -i});
+            } else {
+                map.remove(key);
+                Expected::iterator it = expected.find(key);
+                if(it != expected.end()) {
+                    expected.erase(it);
+                }
+            }
+        }
+        CHECK(MapShape::check(map));
+        check_keys(map, expected);
+    }
+
+    // Equal keys keep their input order in the fallback, as in std::multimap
+    Entries unsorted;
+    for(int i = 0; i < 3000; i++) {
+        unsorted.push_back({(int)(random() % 500), i});
+    }
+    Map map;
+    map.build_from_sorted(unsorted.begin(), unsorted.end());
+    Expected expected;
+    for(const std::pair<int, int> &entry : unsorted) {
+        expected.insert(entry);
+    }
+    CHECK(entries_of(map) == Entries(expected.begin(), expected.end()));
+    CHECK(MapShape::check(map));
+}
+
+template<class Map>
+void search_batch(unsigned seed) {
+    std::mt19937 random(seed);
+    Map map;
+    std::vector<int> keys(1000);
+    std::vector<int> out(keys.size(), 0);
+
+    // An empty tree answers missing for every key
+    CHECK(map.search_batch(keys.data(), out.data(), keys.size(), -7) == 0);
+    CHECK(std::count(out.begin(), out.end(), -7) == (long)out.size());
+
+    for(int i = 0; i < 5000; i++) {
+        int key = random() % 10000;
+        if(!map.contains(key)) {
+            map.insert(key, i);
+        }
+    }
+
+    // Batches shorter than, equal to and not a multiple of the lane count
+    for(size_t n : {(size_t)0, (size_t)1, (size_t)5, Map::SEARCH_BATCH_LANES, (size_t)37, keys.size()}) {
+        for(int &key : keys) {
+            key = random() % 10100 - 50;
+        }
+        std::fill(out.begin(), out.end(), 0);
+        size_t found = map.search_batch(keys.data(), out.data(), n, -1);
+
+        size_t expected_found = 0;
+        for(size_t i = 0; i < n; i++) {
+            CHECK(out[i] == map.search(keys[i]).value_or(-1));
+            expected_found += map.contains(keys[i]);
+        }
+        CHECK(found == expected_found);
+        CHECK(std::count(out.begin() + n, out.end(), 0) == (long)(out.size() - n));
+    }
+}
+
+// Value of the entry at it, -1 at end
+template<class Map>
+int value_at(const Map &map, typename Map::const_iterator it) {
+    return (it != map.end()) ? it.value() : -1;
+}
+
+int value_at(const Expected &expected, Expected::const_iterator it) {
+    return (it != expected.end()) ? it->second : -1;
+}
+
+// Only inserts, so equal keys sit in the same order in both and every
+// query names one exact entry
+template<class Map>
+void iteration_and_bounds(unsigned seed) {
+    std::mt19937 random(seed);
+    Map map;
+    Expected expected;
+    CHECK(map.begin() == map.end());
+    CHECK(map.lower_bound(0) == map.end());
+    CHECK(map.floor(0) == map.end());
+    CHECK(map.range(0, 10).begin() == map.range(0, 10).end());
+
+    for(int i = 0; i < 4000; i++) {
+        int key = random() % 700;
+        map.insert(key, i);
+        expected.insert({key, i});
+    }
+
+    CHECK(entries_of(map) == Entries(expected.begin(), expected.end()));
+    Entries backward;
+    for(typename Map::const_iterator it = map.end(); it != map.begin();) {
+        --it;
+        backward.push_back({it.key(), it.value()});
+    }
+    CHECK(backward == Entries(expected.rbegin(), expected.rend()));
+
+    typename Map::const_iterator last = map.end();
+    --last;
+    CHECK(last.value() == expected.rbegin()->second);
+    CHECK((*map.begin()).second == expected.begin()->second);
+    CHECK(map.begin()->first == expected.begin()->first);
+
+    // Every key from below the smallest to above the largest
+    for(int key = -2; key < 703; key++) {
+        Expected::const_iterator upper = expected.upper_bound(key);
+        Expected::const_iterator floor = (upper != expected.begin()) ? std::prev(upper) : expected.end();
+        CHECK(value_at(map, map.lower_bound(key)) == value_at(expected, expected.lower_bound(key)));
+        CHECK(value_at(map, map.ceiling(key)) == value_at(expected, expected.lower_bound(key)));
+        CHECK(value_at(map, map.upper_bound(key)) == value_at(expected, upper));
+        CHECK(value_at(map, map.floor(key)) == value_at(expected, floor));
+    }
+
+    for(int i = 0; i < 300; i++) {
+        int lo = random() % 720 - 10;
+        int hi = lo + random() % 100 - 5;
+        Entries found;
+        for(typename Map::const_iterator it = map.range(lo, hi).begin(); it != map.range(lo, hi).end(); ++it) {
+            found.push_back({it.key(), it.value()});
+        }
+        Entries wanted;
+        if(lo <= hi) {
+            wanted = Entries(expected.lower_bound(lo), expected.upper_bound(hi));
+        }
+        CHECK(found == wanted);
+    }
+
+    // Iterators stay valid while other entries come and go
+    typename Map::const_iterator kept = map.lower_bound(350);
+    int kept_key = kept.key(), kept_value = kept.value();
+    for(int i = 0; i < 1000; i++) {
+        map.insert(random() % 700 + 1000, i);
+        map.remove(random() % 300);
+    }
+    CHECK(kept.key() == kept_key);
+    CHECK(kept.value() == kept_value);
+}
+
+template<class Policy, class Layout>
+void each_test(unsigned seed) {
+    typedef OrderedMap<int, int, std::less<int>, Policy, Layout> Map;
+    inserts_and_removes<Map, Policy>(seed);
+    build_from_sorted<Map, Policy>(seed + 1);
+    search_batch<Map>(seed + 2);
+    iteration_and_bounds<Map>(seed + 3);
+}
+
+// A value that counts the live copies, so a test can tell every removed or
+// cleared value was destroyed
+struct Counted {
+    static long live;
+    int value;
+
+    explicit Counted(int value) : value(value) { live++; }
+    ~Counted() { live--; }
+};
+
+long Counted::live = 0;
+
+typedef std::unique_ptr<Counted> Payload;
+
+// Move-only values, moved in by insert and built in place by emplace
+template<class Policy>
+void move_only_values(unsigned seed) {
+    typedef OrderedMap<int, Payload, std::less<int>, Policy> Map;
+    std::mt19937 random(seed);
+    {
+        Map map;
+        Expected expected;
+        for(int i = 0; i < 6000; i++) {
+            int key = random() % 1500;
+            if(i % 2 == 0) {
+                map.insert(key, Payload(new Counted(i)));
+            } else {
+                CHECK(map.emplace(key, new Counted(i))->value == i);
+            }
+            expected.insert({key, i});
+        }
+
+        Entries entries;
+        for(typename Map::const_iterator it = map.begin(); it != map.end(); ++it) {
+            entries.push_back({it.key(), it.value()->value});
+        }
+        CHECK(entries == Entries(expected.begin(), expected.end()));
+        CHECK(Counted::live == (long)expected.size());
+
+        // find may land on any one of the entries with its key
+        for(int key = -1; key < 1501; key++) {
+            Payload *found = map.find(key);
+            CHECK((found != nullptr) == (expected.count(key) > 0));
+            bool listed = false;
+            for(Expected::const_iterator it = expected.lower_bound(key); it != expected.upper_bound(key); ++it) {
+                listed = listed || (found != nullptr && (*found)->value == it->second);
+            }
+            CHECK(found == nullptr || listed);
+        }
+
+        for(int i = 0; i < 4000; i++) {
+            int key = random() % 1600;
+            CHECK(map.remove(key) == (expected.count(key) > 0));
+            Expected::iterator it = expected.find(key);
+            if(it != expected.end()) {
+                expected.erase(it);
+            }
+        }
+        check_keys(map, expected);
+        CHECK(Counted::live == (long)expected.size());
+
+        // A found value can be moved out and back
+        int key = expected.begin()->first;
+        Payload taken = std::move(*map.find(key));
+        CHECK(*map.find(key) == nullptr);
+        *map.find(key) = std::move(taken);
+        CHECK(*map.find(key) != nullptr);
+
+        map.clear();
+        CHECK(Counted::live == 0);
+        map.emplace(1, new Counted(1));
+    }
+    CHECK(Counted::live == 0);
+}
+
+template<class Policy>
+void ranked_move_only_values(unsigned seed) {
+    typedef OrderedMap<int, Payload, std::less<int>, OrderStatistics<Policy>> Map;
+    std::mt19937 random(seed);
+    Map map;
+    Expected expected;
+    for(int i = 0; i < 4000; i++) {
+        int key = random() % 1000;
+        map.emplace(key, new Counted(i));
+        expected.insert({key, i});
+    }
+    for(int key = -1; key < 1001; key += 7) {
+        CHECK(map.rank(key) == (size_t)std::distance(expected.begin(), expected.lower_bound(key)));
+    }
+    for(size_t k = 0; k < expected.size(); k += 97) {
+        typename Map::const_iterator it = map.select(k);
+        CHECK(it.value()->value == std::next(expected.begin(), k)->second);
+    }
+}
+
+// Under std::less<> a std::string_view or a C string is compared with the
+// keys as it is, with no std::string built for the lookup
+void string_keys() {
+    typedef OrderedMap<std::string, int, std::less<>> Map;
+    Map map;
+    std::map<std::string, int, std::less<>> expected;
+    for(int i = 0; i < 2000; i++) {
+        std::string key = "key-" + std::to_string(i * 7919 % 2000);
+        map.insert(key, i);
+        expected[key] = i;
+    }
+
+    std::string text = "key-1234 key-99 key-2000 key-";
+    for(std::string_view key : {std::string_view(text).substr(0, 8), std::string_view(text).substr(9, 6),
+                                std::string_view(text).substr(16, 8), std::string_view(text).substr(25, 4)}) {
+        std::map<std::string, int, std::less<>>::const_iterator it = expected.find(key);
+        const int *found = map.find(key);
+        CHECK(map.contains(key) == (it != expected.end()));
+        CHECK((found != nullptr) == (it != expected.end()));
+        CHECK(found == nullptr || *found == it->second);
+    }
+    CHECK(map.contains("key-0"));
+    CHECK(!map.contains("key"));
+
+    const Map &constant = map;
+    CHECK(constant.find(std::string_view("key-5")) == map.find(std::string("key-5")));
+    std::vector<std::string> keys;
+    for(Map::const_iterator it = map.begin(); it != map.end(); ++it) {
+        keys.push_back(it.key());
+    }
+    CHECK(std::is_sorted(keys.begin(), keys.end()));
+    CHECK(keys.size() == expected.size());
+}
+
+// Rebalancing relinks nodes without moving values, so the reference emplace
+// returned still names the same value after many inserts and removes.
+// CompactLayout only keeps it while its array does not grow, so that map
+// reserves room first
+template<class Map>
+void emplace_reference_stays(unsigned seed, bool reserve) {
+    std::mt19937 random(seed);
+    Map map;
+    if(reserve) {
+        map.reserve(20001);
+    }
+    int &value = map.emplace(-1, 42);
+    for(int i = 0; i < 20000; i++) {
+        map.insert(random() % 5000, i);
+        if(i % 3 == 0) {
+            map.remove(random() % 5000);
+        }
+    }
+    CHECK(map.find(-1) == &value);
+    CHECK(value == 42);
+    value = 43;
+    CHECK(map.search(-1) == 43);
+}
+
+int main() {
+    each_test<NoBalance, PointerLayout<>>(91);
+    each_test<RedBlackBalance, PointerLayout<>>(92);
+    each_test<AVLBalance, PointerLayout<>>(93);
+    each_test<NoBalance, CompactLayout>(94);
+    each_test<RedBlackBalance, CompactLayout>(95);
+    each_test<AVLBalance, CompactLayout>(96);
+
+    move_only_values<NoBalance>(101);
+    move_only_values<RedBlackBalance>(102);
+    move_only_values<AVLBalance>(103);
+    move_only_values<OrderStatistics<RedBlackBalance>>(104);
+    move_only_values<OrderStatistics<AVLBalance>>(105);
+    ranked_move_only_values<RedBlackBalance>(106);
+    ranked_move_only_values<AVLBalance>(107);
+    string_keys();
+    emplace_reference_stays<OrderedMap<int, int, std::less<int>, RedBlackBalance>>(108, false);
+    emplace_reference_stays<OrderedMap<int, int, std::less<int>, AVLBalance>>(109, false);
+    emplace_reference_stays<OrderedMap<int, int, std::less<int>, RedBlackBalance, CompactLayout>>(110, true);
+    return test_result("ordered_map_test");
+}
@@ -0,0 +1,131 @@
+#include <map>
+#include <random>
+#include <vector>
+
+#include "check.hpp"
+#include "persistent_red_black_tree.hpp"
+
+// PersistentRedBlackTree against std::map: snapshots taken along the way
+// must keep answering for the version they pinned while the writer goes
+// on, including when other snapshots sharing their nodes are dropped, and
+// snapshots taken on reader threads must see whole versions. Equal keys
+// are checked against std::multimap
+
+void snapshots_keep_their_version() {
+    static const int KEYS = 3000;
+    std::mt19937 random(61);
+    PersistentRedBlackTree tree;
+    std::map<int, int> expected;
+    std::vector<PersistentRedBlackTree::Snapshot> snapshots;
+    std::vector<std::map<int, int>> versions;
+
+    for(int i = 0; i < 40000; i++) {
+        int key = random() % KEYS;
+        if(random() % 3 == 0) {
+            tree.remove(key);
+            expected.erase(key);
+        } else if(expected.count(key) == 0) {
+            tree.insert(key, i);
+            expected[key] = i;
+        }
+
+        if(i % 2500 == 0) {
+            snapshots.push_back(tree.snapshot());
+            versions.push_back(expected);
+        }
+        // Dropping every third snapshot releases nodes the others may share
+        if(i % 7500 == 5000) {
+            snapshots.erase(snapshots.begin() + snapshots.size() / 2);
+            versions.erase(versions.begin() + versions.size() / 2);
+        }
+    }
+
+    CHECK(tree.size() == expected.size());
+    check_against(tree.snapshot(), expected, KEYS);
+    for(size_t i = 0; i < snapshots.size(); i++) {
+        check_against(snapshots[i], versions[i], KEYS);
+    }
+
+    // Snapshots outlive the tree's later writes and each other
+    tree.insert(KEYS + 1, 1);
+    snapshots.erase(snapshots.begin());
+    versions.erase(versions.begin());
+    for(size_t i = 0; i < snapshots.size(); i++) {
+        check_against(snapshots[i], versions[i], KEYS);
+    }
+}
+
+// Snapshots pinned by readers stay the same while the writer goes on
+static const int KEYS = 1 << 13;
+
+void snapshots_during_writes() {
+    PersistentRedBlackTree tree;
+    readers_during_writes(tree, KEYS, 200000, 2, 62, [&tree](std::mt19937 &random) {
+        PersistentRedBlackTree::Snapshot version = tree.snapshot();
+        long bad = 0;
+        bad += version.size() < (size_t)(KEYS / STRIDE + 1) || version.size() > (size_t)(KEYS + 1);
+        bad += version.get_min() != 0;
+        bad += version.get_max() != KEYS;
+
+        // A pinned version answers the same way every time
+        for(int i = 0; i < 50; i++) {
+            int key = random() % KEYS;
+            int found = version.search(key);
+            bad += (key % STRIDE == 0) ? found != key : (found != key && found != -1);
+            bad += version.search(key) != found;
+        }
+        return bad;
+    });
+}
+
+// Few distinct keys, so runs of equal keys are long and removes take the
+// equal-key path. Every value is its key
+void duplicate_keys() {
+    static const int DISTINCT = 40;
+    std::mt19937 random(63);
+    PersistentRedBlackTree tree;
+    std::multimap<int, int> expected;
+    std::vector<PersistentRedBlackTree::Snapshot> snapshots;
+    std::vector<std::multimap<int, int>> versions;
+
+    for(int i = 0; i < 20000; i++) {
+        int key = random() % DISTINCT;
+        if(random() % 5 < 2) {
+            tree.remove(key);
+            std::multimap<int, int>::iterator it = expected.find(key);
+            if(it != expected.end()) {
+                expected.erase(it);
+            }
+        } else {
+            tree.insert(key, key);
+            expected.insert({key, key});
+        }
+
+        if(i % 2000 == 0) {
+            snapshots.push_back(tree.snapshot());
+            versions.push_back(expected);
+        }
+    }
+
+    check_against(tree.snapshot(), expected, DISTINCT);
+    for(size_t i = 0; i < snapshots.size(); i++) {
+        check_against(snapshots[i], versions[i], DISTINCT);
+    }
+
+    // Emptying the tree leaves the snapshots as they were
+    while(!expected.empty()) {
+        tree.remove(expected.begin()->first);
+        expected.erase(expected.begin());
+    }
+    check_against(tree.snapshot(), expected, DISTINCT);
+    for(size_t i = 0; i < snapshots.size(); i++) {
+        check_against(snapshots[i], versions[i], DISTINCT);
+    }
+}
+
+int main() {
+    snapshots_keep_their_version();
+    snapshots_during_writes();
+    duplicate_keys();
+    return test_result("persistent_tree_test");
+}
@@ -0,0 +1,57 @@
+#include <iterator>
+#include <map>
+#include <random>
+
+#include "avl_tree.hpp"
+#include "check.hpp"
+#include "red_black_tree.hpp"
+
+// rank, select, count_range and split of the ranked int trees against
+// std::multimap, and the plain trees leaving the subtree sizes out
+
+template<class Tree>
+void ranked_queries(unsigned seed) {
+    std::mt19937 random(seed);
+    Tree tree, upper;
+    std::multimap<int, int> expected;
+    for(int i = 0; i < 20000; i++) {
+        int key = random() % 5000;
+        tree.insert(key, i);
+        expected.insert({key, i});
+        if(i % 4 == 0) {
+            key = random() % 5000;
+            if(expected.count(key) > 0) {
+                tree.remove(key);
+                expected.erase(expected.find(key));
+            }
+        }
+    }
+
+    for(int i = 0; i < 2000; i++) {
+        int key = random() % 5100 - 50;
+        CHECK(tree.rank(key) == (size_t)std::distance(expected.begin(), expected.lower_bound(key)));
+        CHECK(tree.contains(key) == (expected.count(key) > 0));
+
+        int hi = key + random() % 200;
+        CHECK(tree.count_range(key, hi) == (size_t)std::distance(expected.lower_bound(key), expected.upper_bound(hi)));
+
+        size_t k = random() % (expected.size() + 10);
+        CHECK(tree.select(k) == ((k < expected.size()) ? std::next(expected.begin(), k)->first : -1));
+    }
+
+    tree.split(2500, upper);
+    CHECK(tree.count_range(-1, 5000) == (size_t)std::distance(expected.begin(), expected.lower_bound(2500)));
+    CHECK(upper.count_range(-1, 5000) == (size_t)std::distance(expected.lower_bound(2500), expected.end()));
+    CHECK(upper.select(0) == expected.lower_bound(2500)->first);
+    CHECK(tree.rank(2500) == tree.count_range(-1, 5000));
+}
+
+int main() {
+    ranked_queries<RankedRedBlackTree>(31);
+    ranked_queries<RankedAVLTree>(32);
+
+    CHECK(sizeof(RedBlackTree::Map::Storage::Node) + sizeof(size_t) == sizeof(RankedRedBlackTree::Map::Storage::Node));
+    CHECK(sizeof(AVLTree::Map::Storage::Node) + sizeof(size_t) == sizeof(RankedAVLTree::Map::Storage::Node));
+
+    return test_result("ranked_tree_test");
+}
@@ -0,0 +1,164 @@
+#include <algorithm>
+#include <map>
+#include <random>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "check.hpp"
+#include "ordered_map.hpp"
+#include "work_stealing_pool.hpp"
+
+// set_union, set_intersection and set_difference against the same
+// operations done by hand on std::multimap contents, serially and on a
+// work-stealing pool, and the slabs a tree holds after many of them
+
+typedef std::vector<std::pair<int, int>> Entries;
+
+// Entries with equal keys may come out of a set operation in any order, so
+// they are compared sorted by key and value
+template<class Map>
+Entries sorted_entries(const Map &map) {
+    Entries entries;
+    for(typename Map::const_iterator it = map.begin(); it != map.end(); ++it) {
+        entries.push_back({it.key(), it.value()});
+    }
+    std::sort(entries.begin(), entries.end());
+    return entries;
+}
+
+enum class Operation { set_union, set_intersection, set_difference };
+
+Entries expected_result(Operation operation, const std::multimap<int, int> &ours, const std::multimap<int, int> &theirs) {
+    Entries result;
+    for(const std::pair<const int, int> &entry : ours) {
+        bool in_theirs = theirs.count(entry.first) > 0;
+        if(operation == Operation::set_union || (operation == Operation::set_intersection) == in_theirs) {
+            result.push_back(entry);
+        }
+    }
+    if(operation == Operation::set_union) {
+        for(const std::pair<const int, int> &entry : theirs) {
+            if(ours.count(entry.first) == 0) {
+                result.push_back(entry);
+            }
+        }
+    }
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+template<class Map>
+void apply(Operation operation, Map &ours, Map &theirs, WorkStealingPool *pool) {
+    if(operation == Operation::set_union) {
+        ours.set_union(theirs, pool);
+    } else if(operation == Operation::set_intersection) {
+        ours.set_intersection(theirs, pool);
+    } else {
+        ours.set_difference(theirs, pool);
+    }
+}
+
+template<class Map>
+void random_set_operations(unsigned seed, WorkStealingPool *pool) {
+    std::mt19937 random(seed);
+
+    for(int round = 0; round < 300; round++) {
+        Map ours, theirs;
+        std::multimap<int, int> expected_ours, expected_theirs;
+        int our_count = random() % ((round % 10 == 0) ? 3000 : 200);
+        int their_count = random() % ((round % 7 == 0) ? 3000 : 200);
+        int range = 1 + random() % 400;
+        for(int i = 0; i < our_count; i++) {
+            int key = random() % range;
+            ours.insert(key, i);
+            expected_ours.insert({key, i});
+        }
+        for(int i = 0; i < their_count; i++) {
+            int key = random() % range;
+            theirs.insert(key, 100000 + i);
+            expected_theirs.insert({key, 100000 + i});
+        }
+
+        Operation operation = (Operation)(round % 3);
+        apply(operation, ours, theirs, pool);
+
+        Entries expected = expected_result(operation, expected_ours, expected_theirs);
+        CHECK(ours.size() == expected.size());
+        CHECK(sorted_entries(ours) == expected);
+        CHECK(height_is_balanced(ours.height(), ours.size()));
+        CHECK(theirs.size() == 0 && theirs.begin() == theirs.end());
+
+        // Both trees keep working after the nodes moved
+        for(int i = 0; i < 20; i++) {
+            ours.insert(random() % range, i);
+            theirs.insert(random() % range, i);
+        }
+        CHECK(ours.size() == expected.size() + 20);
+        CHECK(theirs.size() == 20);
+        CHECK(height_is_balanced(ours.height(), ours.size()));
+    }
+
+    // With itself: union and intersection change nothing, difference empties
+    Map tree;
+    for(int i = 0; i < 100; i++) {
+        tree.insert(i % 10, i);
+    }
+    tree.set_union(tree, pool);
+    tree.set_intersection(tree, pool);
+    CHECK(tree.size() == 100);
+    tree.set_difference(tree, pool);
+    CHECK(tree.size() == 0);
+}
+
+// Trees that trade nodes back and forth must not pile up references to the
+// same slabs, and nodes a set operation frees are reused by the tree that
+// freed them
+template<class Map>
+void repeated_set_operations(WorkStealingPool *pool) {
+    Map tree, other;
+    for(int i = 0; i < 100000; i++) {
+        tree.insert(i, i);
+    }
+    size_t slabs = tree.slab_count();
+
+    for(int round = 0; round < 20; round++) {
+        tree.split(50000, other);
+        tree.set_union(other, pool);
+        CHECK(tree.slab_count() <= slabs + 1);
+        CHECK(tree.size() == 100000);
+    }
+
+    // Drop every odd key along with the other tree's nodes, then fill the
+    // freed chunks again: the tree has to reuse them, not add slabs
+    for(int i = 1; i < 100000; i += 2) {
+        other.insert(i, i);
+    }
+    size_t both = tree.slab_count() + other.slab_count();
+    tree.set_difference(other, pool);
+    CHECK(tree.size() == 50000);
+    CHECK(tree.slab_count() <= both);
+
+    size_t after = tree.slab_count();
+    for(int i = 0; i < 100000; i++) {
+        tree.insert(100000 + i, i);
+    }
+    CHECK(tree.slab_count() == after);
+}
+
+int main() {
+    typedef OrderedMap<int, int, std::less<int>, OrderStatistics<RedBlackBalance>> RedBlack;
+    typedef OrderedMap<int, int, std::less<int>, OrderStatistics<AVLBalance>> AVL;
+    typedef OrderedMap<int, int, std::less<int>, OrderStatistics<AVLBalance>, PointerLayout<HeapPool>> HeapAVL;
+
+    WorkStealingPool pool(4);
+    random_set_operations<RedBlack>(21, nullptr);
+    random_set_operations<AVL>(22, nullptr);
+    random_set_operations<RedBlack>(23, &pool);
+    random_set_operations<AVL>(24, &pool);
+    random_set_operations<HeapAVL>(25, &pool);
+    repeated_set_operations<RedBlack>(nullptr);
+    repeated_set_operations<AVL>(&pool);
+
+    return test_result("set_operations_test");
+}
@@ -0,0 +1,173 @@
+#include <algorithm>
+#include <climits>
+#include <map>
+#include <random>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "check.hpp"
+#include "sharded_tree.hpp"
+
+// ShardedTree against std::map, with keys packed into one starting shard so
+// that inserts trigger rebalances: first on one thread, then against
+// std::multimap with few distinct keys, then with several writers on
+// disjoint keys while rebalances move the bounds under them
+
+typedef std::vector<std::pair<int, int>> Entries;
+
+template<class Sharded>
+Entries entries_of(Sharded &tree) {
+    Entries entries;
+    tree.range(INT_MIN, INT_MAX, [&](int key, int data) { entries.push_back({key, data}); });
+    return entries;
+}
+
+// Whether no shard holds much more than its share: they may run past
+// SKEW_FACTOR times it until their next rebalance check
+template<class Sharded>
+bool shards_even(Sharded &tree) {
+    std::vector<size_t> sizes = tree.shard_sizes();
+    size_t largest = *std::max_element(sizes.begin(), sizes.end());
+    size_t shards = tree.get_shard_count();
+    return largest * shards <= Sharded::SKEW_FACTOR * tree.size() + shards * Sharded::REBALANCE_CHECK;
+}
+
+template<class Sharded>
+void single_thread(unsigned seed) {
+    std::mt19937 random(seed);
+    Sharded tree;
+    std::map<int, int> expected;
+    for(int i = 0; i < 60000; i++) {
+        int key = random() % 40000;
+        if(random() % 4 == 0) {
+            tree.remove(key);
+            expected.erase(key);
+        } else if(expected.count(key) == 0) {
+            tree.insert(key, i);
+            expected[key] = i;
+        }
+    }
+
+    // Every key starts out in one shard, the rebalances spread them
+    CHECK(shards_even(tree));
+    check_against(tree, expected, 40000);
+    CHECK(entries_of(tree) == Entries(expected.begin(), expected.end()));
+
+    for(int i = 0; i < 200; i++) {
+        int lo = random() % 40000;
+        int hi = lo + random() % 2000;
+        Entries found;
+        tree.range(lo, hi, [&](int key, int data) { found.push_back({key, data}); });
+        CHECK(found == Entries(expected.lower_bound(lo), expected.upper_bound(hi)));
+    }
+
+    tree.rebalance();
+    CHECK(tree.size() == expected.size());
+    CHECK(entries_of(tree) == Entries(expected.begin(), expected.end()));
+}
+
+// Few distinct keys: equal keys stay in one shard, so no rebalance can
+// even the shards out, and rebuilding on every check would make inserts
+// quadratic
+template<class Sharded>
+void duplicate_keys(unsigned seed) {
+    std::mt19937 random(seed);
+    Sharded tree;
+    std::multimap<int, int> expected;
+    for(int i = 0; i < 200000; i++) {
+        int key = random() % 4;
+        tree.insert(key, i);
+        expected.insert({key, i});
+    }
+
+    CHECK(tree.rebalances() > 0);
+    CHECK(tree.rebalances() <= 20);
+    CHECK(tree.size() == expected.size());
+    CHECK(tree.get_min() == expected.begin()->second);
+    CHECK(tree.get_max() == expected.rbegin()->second);
+    CHECK(entries_of(tree) == Entries(expected.begin(), expected.end()));
+    for(int key = -1; key <= 4; key++) {
+        int found = tree.search(key);
+        std::pair<std::multimap<int, int>::iterator, std::multimap<int, int>::iterator> equal = expected.equal_range(key);
+        bool listed = false;
+        for(std::multimap<int, int>::iterator it = equal.first; it != equal.second; ++it) {
+            listed = listed || it->second == found;
+        }
+        CHECK((equal.first == equal.second) ? found == -1 : listed);
+    }
+
+    // remove takes any one entry with the key, so only the keys are compared
+    for(int i = 0; i < 100000; i++) {
+        int key = random() % 5;
+        tree.remove(key);
+        std::multimap<int, int>::iterator it = expected.find(key);
+        if(it != expected.end()) {
+            expected.erase(it);
+        }
+    }
+    std::vector<int> keys, expected_keys;
+    for(const std::pair<int, int> &entry : entries_of(tree)) {
+        keys.push_back(entry.first);
+    }
+    for(const std::pair<const int, int> &entry : expected) {
+        expected_keys.push_back(entry.first);
+    }
+    CHECK(tree.size() == expected.size());
+    CHECK(keys == expected_keys);
+}
+
+// Writer t owns the keys equal to t modulo WRITERS, so each one can check
+// its own keys while the others insert and rebalance
+static const int WRITERS = 4;
+
+template<class Sharded>
+void concurrent_writers() {
+    Sharded tree;
+    std::vector<std::map<int, int>> expected(WRITERS);
+    std::vector<long> failures(WRITERS, 0);
+
+    std::vector<std::thread> writers;
+    for(int t = 0; t < WRITERS; t++) {
+        writers.emplace_back([&, t]() {
+            std::mt19937 random(200 + t);
+            std::map<int, int> &mine = expected[t];
+            for(int i = 0; i < 30000; i++) {
+                int key = (int)(random() % 20000) * WRITERS + t;
+                if(random() % 4 == 0) {
+                    tree.remove(key);
+                    mine.erase(key);
+                    failures[t] += tree.search(key) != -1;
+                } else if(mine.count(key) == 0) {
+                    tree.insert(key, i);
+                    mine[key] = i;
+                    failures[t] += tree.search(key) != i;
+                }
+            }
+        });
+    }
+    for(std::thread &writer : writers) {
+        writer.join();
+    }
+
+    std::map<int, int> all;
+    for(const std::map<int, int> &mine : expected) {
+        all.insert(mine.begin(), mine.end());
+    }
+    for(long failed : failures) {
+        CHECK(failed == 0);
+    }
+    CHECK(tree.size() == all.size());
+    CHECK(shards_even(tree));
+    CHECK(entries_of(tree) == Entries(all.begin(), all.end()));
+}
+
+int main() {
+    single_thread<ShardedRedBlackTree>(51);
+    single_thread<ShardedAVLTree>(52);
+    duplicate_keys<ShardedRedBlackTree>(53);
+    duplicate_keys<ShardedAVLTree>(54);
+    concurrent_writers<ShardedRedBlackTree>();
+    concurrent_writers<ShardedAVLTree>();
+    return test_result("sharded_tree_test");
+}
@@ -0,0 +1,158 @@
+#include <algorithm>
+#include <map>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "check.hpp"
+#include "ordered_map.hpp"
+
+// split and join against std::multimap, and the slabs two trees hold after
+// many round trips between them
+
+typedef std::vector<std::pair<int, int>> Entries;
+
+template<class Map>
+Entries entries_of(const Map &map) {
+    Entries entries;
+    for(typename Map::const_iterator it = map.begin(); it != map.end(); ++it) {
+        entries.push_back({it.key(), it.value()});
+    }
+    return entries;
+}
+
+Entries entries_of(const std::multimap<int, int> &map) {
+    return Entries(map.begin(), map.end());
+}
+
+template<class Map>
+void check_tree(const Map &map, const std::multimap<int, int> &expected) {
+    CHECK(map.size() == expected.size());
+    CHECK(entries_of(map) == entries_of(expected));
+    CHECK(height_is_balanced(map.height(), map.size()));
+}
+
+// remove() takes any one of the entries with its key, so after removes
+// only the keys are compared
+template<class Map>
+void check_keys(const Map &map, const std::multimap<int, int> &expected) {
+    std::vector<int> keys, expected_keys;
+    for(typename Map::const_iterator it = map.begin(); it != map.end(); ++it) {
+        keys.push_back(it.key());
+    }
+    for(const std::pair<const int, int> &entry : expected) {
+        expected_keys.push_back(entry.first);
+    }
+    CHECK(keys == expected_keys);
+    CHECK(height_is_balanced(map.height(), map.size()));
+}
+
+template<class Map>
+void random_split_join(unsigned seed) {
+    std::mt19937 random(seed);
+
+    for(int round = 0; round < 300; round++) {
+        Map lower, upper, joined;
+        std::multimap<int, int> expected_lower, expected_upper;
+        int count = random() % ((round % 10 == 0) ? 5000 : 300);
+        int range = 1 + random() % 1000;
+        for(int i = 0; i < count; i++) {
+            int key = random() % range;
+            lower.insert(key, i);
+            expected_lower.insert({key, i});
+        }
+        // split() throws away what upper held
+        for(int i = 0; i < 5; i++) {
+            upper.insert(random() % range, -1);
+        }
+
+        int split_key = random() % (range + 10) - 5;
+        lower.split(split_key, upper);
+        expected_upper.insert(expected_lower.lower_bound(split_key), expected_lower.end());
+        expected_lower.erase(expected_lower.lower_bound(split_key), expected_lower.end());
+        check_tree(lower, expected_lower);
+        check_tree(upper, expected_upper);
+
+        // Join back around a pivot into either tree or a third one
+        Map *target = (round % 3 == 0) ? &lower : (round % 3 == 1) ? &upper : &joined;
+        int pivot = expected_lower.empty() ? split_key : expected_lower.rbegin()->first;
+        target->join(lower, pivot, 777, upper);
+
+        std::multimap<int, int> expected = expected_lower;
+        expected.insert({pivot, 777});
+        expected.insert(expected_upper.begin(), expected_upper.end());
+        check_tree(*target, expected);
+        CHECK(target == &lower || lower.size() == 0);
+        CHECK(target == &upper || upper.size() == 0);
+
+        // The joined tree keeps working as a tree
+        for(int i = 0; i < 50; i++) {
+            int key = random() % range;
+            target->insert(key, i);
+            expected.insert({key, i});
+            key = random() % range;
+            if(target->remove(key)) {
+                expected.erase(expected.find(key));
+            }
+        }
+        check_keys(*target, expected);
+    }
+}
+
+// Keys out of order around the pivot fall back to inserts, so equal keys
+// may come out in another order
+template<class Map>
+void unordered_join() {
+    Map left, right;
+    std::multimap<int, int> expected = {{50, 0}};
+    for(int i = 0; i < 100; i++) {
+        left.insert(i, i);
+        right.insert(i * 2, i);
+        expected.insert({i, i});
+        expected.insert({i * 2, i});
+    }
+    left.join(left, 50, 0, right);
+
+    Entries got = entries_of(left), want = entries_of(expected);
+    std::sort(got.begin(), got.end());
+    std::sort(want.begin(), want.end());
+    CHECK(got == want);
+    CHECK(right.size() == 0);
+}
+
+// Splitting a tree and joining it back over and over must not pile up
+// references to the same slabs in either tree
+template<class Map>
+void repeated_round_trips() {
+    Map tree, upper;
+    for(int i = 0; i < 100000; i++) {
+        tree.insert(i * 2, i);
+    }
+    size_t slabs = tree.slab_count();
+
+    for(int trip = 0; trip < 20; trip++) {
+        int key = 1 + (trip * 9973 % 100000) * 2;
+        tree.split(key, upper);
+        tree.join(tree, key, trip, upper);
+        CHECK(tree.slab_count() <= slabs + 1);
+        CHECK(upper.slab_count() <= slabs + 1);
+    }
+    CHECK(tree.size() == 100020);
+    CHECK(upper.size() == 0);
+}
+
+int main() {
+    typedef OrderedMap<int, int, std::less<int>, OrderStatistics<RedBlackBalance>> RedBlack;
+    typedef OrderedMap<int, int, std::less<int>, OrderStatistics<AVLBalance>> AVL;
+    typedef OrderedMap<int, int, std::less<int>, OrderStatistics<RedBlackBalance>, PointerLayout<HeapPool>> HeapRedBlack;
+
+    random_split_join<RedBlack>(11);
+    random_split_join<AVL>(12);
+    random_split_join<HeapRedBlack>(13);
+    unordered_join<RedBlack>();
+    unordered_join<AVL>();
+    repeated_round_trips<RedBlack>();
+    repeated_round_trips<AVL>();
+
+    return test_result("split_join_test");
+}
@@ -0,0 +1,130 @@
+#include <numeric>
+#include <vector>
+
+#include "check.hpp"
+#include "ordered_map.hpp"
+
+// The TreeStats counters of OrderedMap on inputs whose counts are known:
+// sorted inserts into an unbalanced tree form a chain, so every depth and
+// comparison follows from the key, and the lookup histogram adds up to the
+// lookup count over every kind of lookup. Uses TreeStats directly, so it
+// runs without -DTREE_STATS
+
+typedef OrderedMap<int, int, std::less<int>, NoBalance, PointerLayout<>, TreeStats> Chain;
+typedef OrderedMap<int, int, std::less<int>, RedBlackBalance, PointerLayout<>, TreeStats> RedBlack;
+typedef OrderedMap<int, int, std::less<int>, RedBlackBalance> Uncounted;
+
+static const int COUNT = 40;
+
+uint64_t total(const std::vector<uint64_t> &histogram) {
+    return std::accumulate(histogram.begin(), histogram.end(), (uint64_t)0);
+}
+
+void sorted_chain() {
+    Chain chain;
+    for(int key = 0; key < COUNT; key++) {
+        chain.insert(key, key);
+    }
+
+    TreeStatsSnapshot stats = chain.stats();
+    CHECK(stats.size == (size_t)COUNT);
+    CHECK(stats.height == 0);
+    CHECK(stats.inserts == (uint64_t)COUNT);
+    CHECK(stats.rotations == 0);
+    CHECK(stats.insert_fixup_steps == 0);
+
+    // Key k goes below the k keys before it, one comparison each
+    CHECK(stats.insert_comparisons == (uint64_t)(COUNT * (COUNT - 1) / 2));
+    CHECK(stats.insert_depths.size() == (size_t)COUNT + 1);
+    CHECK(stats.insert_depths[0] == 0);
+    for(int depth = 1; depth <= COUNT; depth++) {
+        CHECK(stats.insert_depths[depth] == 1);
+    }
+    CHECK(chain.stats(true).height == COUNT);
+
+    // Finding key k passes k + 1 nodes with two comparisons at each
+    chain.reset_stats();
+    for(int key = 0; key < COUNT; key++) {
+        CHECK(chain.search(key) == key);
+    }
+    stats = chain.stats();
+    CHECK(stats.inserts == 0);
+    CHECK(stats.lookups == (uint64_t)COUNT);
+    CHECK(stats.lookup_comparisons == (uint64_t)(COUNT * (COUNT + 1)));
+    CHECK(total(stats.lookup_depths) == stats.lookups);
+
+    // The batch counts the same per key as search does
+    chain.reset_stats();
+    std::vector<int> keys(COUNT), out(COUNT);
+    std::iota(keys.begin(), keys.end(), 0);
+    CHECK(chain.search_batch(keys.data(), out.data(), keys.size(), -1) == (size_t)COUNT);
+    TreeStatsSnapshot batch = chain.stats();
+    CHECK(batch.lookups == stats.lookups);
+    CHECK(batch.lookup_comparisons == stats.lookup_comparisons);
+    CHECK(batch.lookup_depths == stats.lookup_depths);
+}
+
+void every_lookup_counts() {
+    RedBlack tree;
+    for(int key = 0; key < 1000; key += 2) {
+        tree.insert(key, key);
+    }
+    TreeStatsSnapshot stats = tree.stats();
+    CHECK(stats.rotations > 0);
+    CHECK(stats.insert_fixup_steps > 0);
+    CHECK(total(stats.insert_depths) == stats.inserts);
+
+    tree.reset_stats();
+    stats = tree.stats();
+    CHECK(stats.inserts == 0 && stats.lookups == 0 && stats.rotations == 0);
+    CHECK(stats.lookup_depths.empty() && stats.insert_depths.empty());
+
+    std::vector<int> keys = {1, 2, 3, 500, 998, 999, -1};
+    std::vector<int> out(keys.size());
+    uint64_t lookups = 0;
+    for(int key : keys) {
+        tree.search(key);
+        tree.contains(key);
+        tree.find(key);
+        tree.lower_bound(key);
+        tree.upper_bound(key);
+        tree.floor(key);
+        tree.ceiling(key);
+        tree.range(key, key + 10);
+        lookups += 9;
+    }
+    tree.search_batch(keys.data(), out.data(), keys.size(), -1);
+    lookups += keys.size();
+    tree.get_predecessor(500);
+    tree.get_successor(500);
+    tree.remove(500);
+    tree.remove(501);
+    lookups += 4;
+
+    stats = tree.stats();
+    CHECK(stats.lookups == lookups);
+    CHECK(total(stats.lookup_depths) == stats.lookups);
+    CHECK(stats.lookup_comparisons >= stats.lookups);
+}
+
+// Without counters only the size, and the height when asked for, are filled in
+void without_counters() {
+    Uncounted tree;
+    for(int key = 0; key < 100; key++) {
+        tree.insert(key, key);
+        tree.search(key);
+    }
+    TreeStatsSnapshot stats = tree.stats();
+    CHECK(stats.size == 100);
+    CHECK(stats.lookups == 0 && stats.inserts == 0 && stats.rotations == 0);
+    CHECK(stats.height == 0);
+    CHECK(tree.stats(true).height == tree.height());
+    CHECK(height_is_balanced(tree.stats(true).height, 100));
+}
+
+int main() {
+    sorted_chain();
+    every_lookup_counts();
+    without_counters();
+    return test_result("tree_stats_test");
+}